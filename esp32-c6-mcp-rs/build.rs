@@ -1,4 +1,13 @@
+use std::fmt::Write as _;
+
 fn main() {
+    buffer_pool_config();
+
+    // The linker setup is only for the firmware; host builds of the library
+    // (see ../esp32-mcp-host) link normally
+    if std::env::var("CARGO_CFG_TARGET_OS").as_deref() != Ok("none") {
+        return;
+    }
     linker_be_nice();
     // make sure linkall.x is the last linker script (otherwise might cause problems with flip-link)
     println!("cargo:rustc-link-arg=-Tlinkall.x");
@@ -50,3 +59,55 @@ fn linker_be_nice() {
         std::env::current_exe().unwrap().display()
     );
 }
+
+/// Connection buffer sizing, overridable at build time through the
+/// environment (e.g. `MCP_CONNECTIONS=2 MCP_TX_BUFFER_SIZE=16384 cargo build`).
+const BUFFER_POOL: [(&str, usize); 6] = [
+    ("MCP_CONNECTIONS", 4),
+    ("MCP_RX_BUFFER_SIZE", 4096),
+    ("MCP_TX_BUFFER_SIZE", 4096),
+    ("MCP_FRAME_BUFFER_SIZE", 3072),
+    ("MCP_JSON_BUFFER_SIZE", 3072),
+    ("MCP_RESULT_BUFFER_SIZE", 1024),
+];
+
+/// Most the whole pool may take; buffers.rs fails the build past it.
+const BUFFER_BUDGET: (&str, usize) = ("MCP_BUFFER_BUDGET", 128 * 1024);
+
+fn env_size(name: &str, default: usize) -> usize {
+    println!("cargo:rerun-if-env-changed={name}");
+    let value = match std::env::var(name) {
+        Ok(value) => value
+            .parse()
+            .unwrap_or_else(|_| panic!("{name} must be a number, got {value:?}")),
+        Err(_) => default,
+    };
+    assert!(value > 0, "{name} must be greater than zero");
+    value
+}
+
+fn buffer_pool_config() {
+    let mut config = String::new();
+    let mut values = [0usize; BUFFER_POOL.len()];
+
+    for (value, (name, default)) in values.iter_mut().zip(BUFFER_POOL) {
+        *value = env_size(name, default);
+        writeln!(config, "pub const {name}: usize = {value};").unwrap();
+    }
+
+    // Const panics can't format numbers, so the figures go in the message here
+    let [connections, rx, tx, frame, json, result] = values;
+    let bytes = connections * (rx + tx + frame + json + result);
+    let (name, default) = BUFFER_BUDGET;
+    let budget = env_size(name, default);
+    writeln!(config, "pub const MCP_BUFFER_BYTES: usize = {bytes};").unwrap();
+    writeln!(config, "pub const {name}: usize = {budget};").unwrap();
+    writeln!(
+        config,
+        "const OVER_BUDGET: &str = \"MCP buffer pool: {connections} x ({rx} rx + {tx} tx + {frame} frame + {json} json + {result} result) = {bytes} bytes, over the {name} of {budget} bytes\";"
+    )
+    .unwrap();
+
+    let out = std::path::PathBuf::from(std::env::var("OUT_DIR").unwrap());
+    std::fs::write(out.join("buffer_pool.rs"), config).unwrap();
+}
@@ -7,19 +7,29 @@
 )]
 
 use embassy_executor::Spawner;
-use embassy_net::{tcp::TcpSocket, Runner, Stack, StackResources};
-use embassy_time::{Duration, Timer};
-use embedded_io_async::{Read, Write};
-use esp32_c6_mcp_rs::mcp::{
-    handle_mcp_request, set_led_sender, LedCommand, McpRequest, MAX_JSON_SIZE,
+use embassy_futures::select::{select, Either};
+use embassy_net::{tcp, tcp::TcpSocket, Runner, Stack, StackResources};
+use embassy_time::{Duration, Instant, Timer};
+use embedded_io_async::{ErrorKind, ErrorType, Read, Write};
+use esp32_c6_mcp_rs::buffers::{
+    ConnectionBuffers, McpBufferPool, MCP_CONNECTIONS, MCP_RX_BUFFER_SIZE, MCP_TX_BUFFER_SIZE,
 };
+use esp32_c6_mcp_rs::connections::Connections;
+use esp32_c6_mcp_rs::hal::{set_led_sink, set_wifi_source, LedSink, WifiStatusSource};
+use esp32_c6_mcp_rs::mcp::LedCommand;
+use esp32_c6_mcp_rs::server::handle_mcp_connection;
+use esp32_c6_mcp_rs::telemetry::{WifiSnapshot, WIFI};
+use esp32_c6_mcp_rs::trace::EVENTS;
 use esp_hal::clock::CpuClock;
 use esp_hal::rng::Rng;
 use esp_hal::timer::systimer::SystemTimer;
 use esp_hal::timer::timg::TimerGroup;
 use esp_wifi::{
     init,
-    wifi::{ClientConfiguration, Configuration, WifiController, WifiDevice, WifiEvent, WifiState},
+    wifi::{
+        ClientConfiguration, Configuration, ScanConfig, WifiController, WifiDevice, WifiEvent,
+        WifiState,
+    },
     EspWifiController,
 };
 use log::{error, info, warn};
@@ -37,7 +47,6 @@ fn panic(_: &core::panic::PanicInfo) -> ! {
 }
 
 extern crate alloc;
-use alloc::string::{String, ToString};
 
 // This creates a default app-descriptor required by the esp-idf bootloader.
 // For more information see: <https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/system/app_image_format.html#application-description>
@@ -61,10 +70,28 @@ const PASSWORD: &str = env!(
     "WiFi password must be set via environment variable"
 );
 const MCP_PORT: u16 = 3000;
+const LOG_DRAIN_INTERVAL_MS: u64 = 200;
+const TELEMETRY_REFRESH_SECS: u64 = 2;
+// Also how long a client may sit idle before a waiting one takes its place
+const SOCKET_TIMEOUT_SECS: u64 = 30;
+const IDLE_SWEEP_INTERVAL_MS: u64 = 1000;
+
+// Listener sockets plus DHCP and one spare
+const STACK_SOCKETS: usize = MCP_CONNECTIONS + 2;
+
+// One listener task per connection, each with its own buffers from the
+// pool; counts and sizes are set at build time (see build.rs)
+type Buffers = ConnectionBuffers<MCP_RX_BUFFER_SIZE, MCP_TX_BUFFER_SIZE>;
+static BUFFERS: McpBufferPool = McpBufferPool::new();
+
+static CONNECTIONS: Connections<MCP_CONNECTIONS> =
+    Connections::new(SOCKET_TIMEOUT_SECS as u32 * 1000);
 
 // LED command channel - global static for inter-task communication
 static LED_CHANNEL: Channel<CriticalSectionRawMutex, LedCommand, 4> = Channel::new();
 
+static WIFI_SOURCE: &dyn WifiStatusSource = &WIFI;
+
 #[esp_hal_embassy::main]
 async fn main(spawner: Spawner) -> ! {
     esp_println::logger::init_logger_from_env();
@@ -104,7 +131,10 @@ async fn main(spawner: Spawner) -> ! {
     let (stack, runner) = embassy_net::new(
         wifi_interface,
         config,
-        mk_static!(StackResources<3>, StackResources::<3>::new()),
+        mk_static!(
+            StackResources<STACK_SOCKETS>,
+            StackResources::<STACK_SOCKETS>::new()
+        ),
         seed,
     );
 
@@ -116,21 +146,32 @@ async fn main(spawner: Spawner) -> ! {
         led
     );
 
-    // Set up LED sender for MCP communication - create static reference
+    // Hand the MCP tools their hardware: LED commands go to the LED task's
+    // channel, WiFi status comes from the connection task's telemetry
     let sender_static = mk_static!(
         embassy_sync::channel::Sender<'static, CriticalSectionRawMutex, LedCommand, 4>,
         LED_CHANNEL.sender()
     );
-    set_led_sender(sender_static);
+    set_led_sink(mk_static!(&'static dyn LedSink, sender_static));
+    set_wifi_source(&WIFI_SOURCE);
 
     // Spawn hardware task for LED control
     spawner
         .spawn(led_hardware_task(led_static, LED_CHANNEL.receiver()))
         .ok();
 
-    spawner.spawn(connection_task(controller)).ok();
+    spawner.spawn(connection_task(controller, stack)).ok();
     spawner.spawn(net_task(runner)).ok();
-    spawner.spawn(mcp_server_task(stack)).ok();
+    info!(
+        "MCP buffer pool: {} connections, {} bytes",
+        MCP_CONNECTIONS,
+        McpBufferPool::SIZE
+    );
+    for (id, buffers) in BUFFERS.take().iter_mut().enumerate() {
+        spawner.spawn(mcp_listener_task(stack, id, buffers)).ok();
+    }
+    spawner.spawn(log_drain_task()).ok();
+    spawner.spawn(idle_sweep_task()).ok();
 
     info!("ESP32-C6 MCP Server starting...");
     info!("Connecting to WiFi: {}", SSID);
@@ -163,7 +204,7 @@ async fn main(spawner: Spawner) -> ! {
 }
 
 #[embassy_executor::task]
-async fn connection_task(mut controller: WifiController<'static>) {
+async fn connection_task(mut controller: WifiController<'static>, stack: &'static Stack<'static>) {
     info!("WiFi connection task started");
     info!("Device capabilities: {:?}", controller.capabilities());
 
@@ -173,11 +214,43 @@ async fn connection_task(mut controller: WifiController<'static>) {
         .set_power_saving(esp_wifi::config::PowerSaveMode::None)
         .unwrap();
 
+    // This task is the only telemetry writer; wifi_status reads the snapshot
+    let mut snapshot = WifiSnapshot {
+        ssid: SSID.try_into().unwrap_or_default(),
+        ..Default::default()
+    };
+    let mut connected_before = false;
+
     loop {
         match esp_wifi::wifi::wifi_state() {
             WifiState::StaConnected => {
-                // Wait until we're no longer connected
-                controller.wait_for_event(WifiEvent::StaDisconnected).await;
+                // Refresh RSSI and IP until we're no longer connected
+                loop {
+                    let refresh = Timer::after(Duration::from_secs(TELEMETRY_REFRESH_SECS));
+                    match select(
+                        controller.wait_for_event(WifiEvent::StaDisconnected),
+                        refresh,
+                    )
+                    .await
+                    {
+                        Either::First(()) => break,
+                        Either::Second(()) => {
+                            if !matches!(esp_wifi::wifi::wifi_state(), WifiState::StaConnected) {
+                                break;
+                            }
+                            snapshot.rssi = controller.rssi().ok().map(|rssi| rssi as i8);
+                            snapshot.ipv4 = stack
+                                .config_v4()
+                                .map(|config| config.address.address().octets());
+                            WIFI.publish(&snapshot);
+                        }
+                    }
+                }
+
+                snapshot.connected = false;
+                snapshot.ipv4 = None;
+                snapshot.rssi = None;
+                WIFI.publish(&snapshot);
                 Timer::after(Duration::from_millis(5000)).await
             }
             _ => {}
@@ -195,9 +268,31 @@ async fn connection_task(mut controller: WifiController<'static>) {
             info!("WiFi started!");
         }
 
+        // The driver doesn't report channel or BSSID once associated, so
+        // take them from a scan for our network
+        let scan = ScanConfig {
+            ssid: Some(SSID),
+            ..Default::default()
+        };
+        if let Ok(access_points) = controller.scan_with_config_async(scan).await {
+            if let Some(ap) = access_points.iter().max_by_key(|ap| ap.signal_strength) {
+                snapshot.channel = Some(ap.channel);
+                snapshot.bssid = Some(ap.bssid);
+                snapshot.rssi = Some(ap.signal_strength);
+            }
+        }
+
         info!("Attempting to connect to WiFi...");
         match controller.connect_async().await {
-            Ok(_) => info!("Successfully connected to WiFi!"),
+            Ok(_) => {
+                info!("Successfully connected to WiFi!");
+                if connected_before {
+                    snapshot.reconnects += 1;
+                }
+                connected_before = true;
+                snapshot.connected = true;
+                WIFI.publish(&snapshot);
+            }
             Err(e) => {
                 error!("Failed to connect to WiFi: {e:?}");
                 Timer::after(Duration::from_millis(5000)).await
@@ -206,14 +301,44 @@ async fn connection_task(mut controller: WifiController<'static>) {
     }
 }
 
+/// Decode and print the request path's deferred event log, off the hot path.
+#[embassy_executor::task]
+async fn log_drain_task() {
+    loop {
+        Timer::after(Duration::from_millis(LOG_DRAIN_INTERVAL_MS)).await;
+
+        while let Some(entry) = EVENTS.pop() {
+            info!("{}", entry);
+        }
+        let dropped = EVENTS.take_dropped();
+        if dropped > 0 {
+            warn!("Event log full, dropped {} entries", dropped);
+        }
+    }
+}
+
+/// Once every listener is serving, free the one whose client has been idle
+/// longest past the socket timeout, for a client waiting to connect.
+#[embassy_executor::task]
+async fn idle_sweep_task() {
+    loop {
+        Timer::after(Duration::from_millis(IDLE_SWEEP_INTERVAL_MS)).await;
+        CONNECTIONS.evict_idle(now_ms());
+    }
+}
+
 #[embassy_executor::task]
 async fn net_task(mut runner: Runner<'static, WifiDevice<'static>>) {
     runner.run().await
 }
 
-#[embassy_executor::task]
-async fn mcp_server_task(stack: &'static Stack<'static>) {
-    info!("MCP server task starting...");
+#[embassy_executor::task(pool_size = MCP_CONNECTIONS)]
+async fn mcp_listener_task(
+    stack: &'static Stack<'static>,
+    id: usize,
+    buffers: &'static mut Buffers,
+) {
+    info!("MCP listener {} starting...", id);
 
     loop {
         // Wait until we have an IP address
@@ -222,282 +347,127 @@ async fn mcp_server_task(stack: &'static Stack<'static>) {
             continue;
         }
 
-        // TCP buffers sized for ESP32-C6 memory constraints but large enough for responses
-        let mut rx_buffer = [0; 4096];
-        let mut tx_buffer = [0; 4096];
-        let mut socket = TcpSocket::new(*stack, &mut rx_buffer, &mut tx_buffer);
-        socket.set_timeout(Some(Duration::from_secs(30)));
+        let mut socket = TcpSocket::new(*stack, &mut buffers.rx, &mut buffers.tx);
+        socket.set_timeout(Some(Duration::from_secs(SOCKET_TIMEOUT_SECS)));
         socket.set_keep_alive(Some(Duration::from_secs(10))); // Enable TCP keep-alive
 
-        info!("MCP server listening on port {}...", MCP_PORT);
-
-        match socket.accept(MCP_PORT).await {
-            Ok(()) => {
-                info!("MCP client connected!");
-
-                // Turn LED green to indicate MCP client is connected
-                if let Err(e) = LED_CHANNEL.sender().try_send(LedCommand::SetColor {
-                    r: 0,
-                    g: 255,
-                    b: 0,
-                    brightness: 20,
-                }) {
-                    warn!("Failed to set LED to green: {:?}", e);
-                } else {
-                    info!("LED set to green - MCP client connected");
-                }
-
-                // Handle the connection
-                match handle_mcp_connection(&mut socket).await {
-                    Ok(()) => {
-                        info!("MCP client disconnected normally");
-                        // Turn LED back to blue when client disconnects
-                        if let Err(e) = LED_CHANNEL.sender().try_send(LedCommand::SetColor {
-                            r: 0,
-                            g: 0,
-                            b: 255,
-                            brightness: 20,
-                        }) {
-                            warn!("Failed to set LED back to blue: {:?}", e);
-                        } else {
-                            info!("LED set back to blue - MCP client disconnected");
-                        }
-                    }
-                    Err(e) => {
-                        warn!(
-                            "MCP connection error: {:?}. Server will accept new connections.",
-                            e
-                        );
-                        // Turn LED back to blue on error too
-                        if let Err(e) = LED_CHANNEL.sender().try_send(LedCommand::SetColor {
-                            r: 0,
-                            g: 0,
-                            b: 255,
-                            brightness: 20,
-                        }) {
-                            warn!("Failed to set LED back to blue after error: {:?}", e);
-                        } else {
-                            info!("LED set back to blue after connection error");
-                        }
-
-                        // Add a small delay before accepting new connections to allow client to reconnect
-                        Timer::after(Duration::from_millis(100)).await;
-                    }
-                }
-            }
-            Err(e) => {
-                error!("Socket accept error: {:?}", e);
-                Timer::after(Duration::from_millis(1000)).await;
-            }
+        if let Err(e) = socket.accept(MCP_PORT).await {
+            error!("Socket accept error on listener {}: {:?}", id, e);
+            Timer::after(Duration::from_millis(1000)).await;
+            continue;
         }
-    }
-}
 
-async fn handle_mcp_connection<T: Read + Write>(socket: &mut T) -> Result<(), T::Error>
-where
-    T::Error: core::fmt::Debug,
-{
-    let mut buffer = [0u8; MAX_JSON_SIZE];
-    let mut response_buf = [0u8; MAX_JSON_SIZE];
-    let mut pending_data = String::new();
+        let active = CONNECTIONS.connected(id, now_ms());
+        info!(
+            "MCP client connected on listener {} ({} active)",
+            id, active
+        );
 
-    loop {
-        info!("Waiting for MCP request...");
+        // Green while any MCP client is connected
+        if active == 1 {
+            set_status_led(0, 255, 0);
+        }
 
-        // Read new data from socket
-        match socket.read(&mut buffer).await {
-            Ok(0) => {
-                info!("MCP connection closed by client (no data received)");
-                return Ok(());
+        let mut pooled = PooledSocket {
+            socket: &mut socket,
+            id,
+        };
+        let result = handle_mcp_connection(
+            &mut pooled,
+            &mut buffers.frame,
+            &mut buffers.json,
+            &mut buffers.result,
+        )
+        .await;
+
+        match result {
+            Ok(()) => info!("MCP client on listener {} disconnected normally", id),
+            Err(ConnectionError::Evicted) => {
+                info!("Evicting idle MCP client on listener {}", id);
+                socket.close();
+                let _ = socket.flush().await;
             }
-            Ok(n) => {
-                info!("Received {} bytes of data", n);
-
-                // Convert to string and add to pending data
-                match core::str::from_utf8(&buffer[..n]) {
-                    Ok(new_data) => {
-                        pending_data.push_str(new_data);
-                    }
-                    Err(_) => {
-                        warn!("Invalid UTF-8 in received data");
-                        continue;
-                    }
-                }
-
-                // Process all complete messages (separated by newlines)
-                while let Some(newline_pos) = pending_data.find('\n') {
-                    let message = pending_data[..newline_pos].trim().to_string();
-                    pending_data = pending_data[newline_pos + 1..].to_string();
-
-                    if message.is_empty() {
-                        continue;
-                    }
+            Err(e) => warn!(
+                "MCP connection error on listener {}: {:?}. Listener will accept new connections.",
+                id, e
+            ),
+        }
 
-                    info!("Processing message ({}bytes): {}", message.len(), message);
+        // Blue again once the last client is gone
+        if CONNECTIONS.disconnected(id) == 0 {
+            set_status_led(0, 0, 255);
+        }
 
-                    // Process this complete message
-                    if let Err(e) = process_mcp_message(socket, &message, &mut response_buf).await {
-                        error!("Error processing message: {:?}", e);
-                        return Err(e);
-                    }
-                }
-            }
-            Err(e) => {
-                error!("Socket read error: {:?}", e);
-                return Err(e);
-            }
+        if matches!(result, Err(ConnectionError::Tcp(_))) {
+            // Add a small delay before accepting new connections to allow client to reconnect
+            Timer::after(Duration::from_millis(100)).await;
         }
     }
 }
 
-async fn process_mcp_message<T: Write>(
-    socket: &mut T,
-    request_str: &str,
-    response_buf: &mut [u8; MAX_JSON_SIZE],
-) -> Result<(), T::Error>
-where
-    T::Error: core::fmt::Debug,
-{
-    info!("Attempting to parse JSON...");
-
-    // Parse and handle MCP request
-    match serde_json_core::from_str::<McpRequest>(request_str) {
-        Ok((request, _)) => {
-            info!(
-                "Successfully parsed MCP request: method={}",
-                request.method.as_str()
-            );
-
-            // Check if this is a notification (no id field)
-            if request.id.is_none() {
-                info!("Processing notification: {}", request.method.as_str());
-
-                // For notifications, just handle them but don't send a response
-                match request.method.as_str() {
-                    "notifications/initialized" => {
-                        info!("Client initialization notification received - connection ready");
-                    }
-                    _ => {
-                        warn!("Unknown notification method: {}", request.method.as_str());
-                    }
-                }
+fn now_ms() -> u32 {
+    Instant::now().as_millis() as u32
+}
 
-                // Return without sending a response for notifications
-                return Ok(());
-            }
+fn set_status_led(r: u8, g: u8, b: u8) {
+    let command = LedCommand::SetColor {
+        r,
+        g,
+        b,
+        brightness: 20,
+    };
+    if let Err(e) = LED_CHANNEL.sender().try_send(command) {
+        warn!("Failed to set status LED: {:?}", e);
+    }
+}
 
-            let response = handle_mcp_request(&request, request_str);
-
-            // Manually construct JSON to avoid double-encoding the result field
-            let response_str = if let Some(ref result) = response.result {
-                // Construct JSON with raw result (not escaped)
-                let id_str = match response.id {
-                    Some(id) => id.to_string(),
-                    None => "null".to_string(),
-                };
-                let mut response_json = String::new();
-                response_json.push_str("{\"jsonrpc\":\"");
-                response_json.push_str(response.jsonrpc.as_str());
-                response_json.push_str("\",\"id\":");
-                response_json.push_str(&id_str);
-                response_json.push_str(",\"result\":");
-                response_json.push_str(result);
-                response_json.push_str("}");
-                response_json
-            } else if let Some(ref error) = response.error {
-                // Serialize error normally
-                match serde_json_core::to_string::<_, MAX_JSON_SIZE>(&error) {
-                    Ok(error_json) => {
-                        let id_str = match response.id {
-                            Some(id) => id.to_string(),
-                            None => "null".to_string(),
-                        };
-                        let mut response_json = String::new();
-                        response_json.push_str("{\"jsonrpc\":\"");
-                        response_json.push_str(response.jsonrpc.as_str());
-                        response_json.push_str("\",\"id\":");
-                        response_json.push_str(&id_str);
-                        response_json.push_str(",\"error\":");
-                        response_json.push_str(&error_json);
-                        response_json.push_str("}");
-                        response_json
-                    }
-                    Err(e) => {
-                        error!("Failed to serialize error: {:?}", e);
-                        return Ok(());
-                    }
-                }
-            } else {
-                return Ok(()); // Invalid response
-            };
-
-            info!(
-                "Successfully constructed response ({}bytes)",
-                response_str.len()
-            );
-
-            // Safety check: ensure response fits in buffer
-            if response_str.len() >= MAX_JSON_SIZE {
-                error!(
-                    "Response too large ({} bytes), exceeds buffer size ({})",
-                    response_str.len(),
-                    MAX_JSON_SIZE
-                );
-                return Ok(()); // Drop this response to prevent crash
-            }
+#[derive(Debug)]
+enum ConnectionError {
+    Tcp(tcp::Error),
+    /// Closed to free a listener for a new client.
+    Evicted,
+}
 
-            info!("Sending MCP response: {}", response_str);
+impl embedded_io_async::Error for ConnectionError {
+    fn kind(&self) -> ErrorKind {
+        match self {
+            ConnectionError::Tcp(e) => e.kind(),
+            ConnectionError::Evicted => ErrorKind::ConnectionAborted,
+        }
+    }
+}
 
-            // Send response
-            response_buf[..response_str.len()].copy_from_slice(response_str.as_bytes());
-            response_buf[response_str.len()] = b'\n';
+/// A listener's socket: reads record activity for idle eviction and end
+/// with `ConnectionError::Evicted` once the pool needs the listener back.
+struct PooledSocket<'a, 'b> {
+    socket: &'a mut TcpSocket<'b>,
+    id: usize,
+}
 
-            if let Err(e) = socket
-                .write_all(&response_buf[..response_str.len() + 1])
-                .await
-            {
-                error!("Write error: {:?}", e);
-                return Err(e);
-            }
+impl ErrorType for PooledSocket<'_, '_> {
+    type Error = ConnectionError;
+}
 
-            // CRITICAL: Flush the socket to ensure data is actually sent
-            if let Err(e) = socket.flush().await {
-                error!("Flush error: {:?}", e);
-                return Err(e);
+impl Read for PooledSocket<'_, '_> {
+    async fn read(&mut self, buf: &mut [u8]) -> Result<usize, Self::Error> {
+        match select(self.socket.read(buf), CONNECTIONS.evicted(self.id)).await {
+            Either::First(result) => {
+                CONNECTIONS.touch(self.id, now_ms());
+                result.map_err(ConnectionError::Tcp)
             }
-
-            // Give client time to receive the response before potentially closing connection
-            Timer::after(Duration::from_millis(10)).await;
-
-            info!("Response sent and flushed successfully");
+            Either::Second(()) => Err(ConnectionError::Evicted),
         }
-        Err(e) => {
-            error!("JSON parse failed: {:?}", e);
-            error!("Raw request bytes: {:?}", request_str.as_bytes());
-
-            // Send error response
-            let error_response =
-                r#"{"jsonrpc":"2.0","id":null,"error":{"code":-32700,"message":"Parse error"}}\n"#;
-            info!("Sending error response: {}", error_response);
-
-            if let Err(e) = socket.write_all(error_response.as_bytes()).await {
-                error!("Write error: {:?}", e);
-                return Err(e);
-            }
-
-            // CRITICAL: Flush the socket to ensure error response is actually sent
-            if let Err(e) = socket.flush().await {
-                error!("Error response flush error: {:?}", e);
-                return Err(e);
-            }
+    }
+}
 
-            // Give client time to receive the error response
-            Timer::after(Duration::from_millis(10)).await;
+impl Write for PooledSocket<'_, '_> {
+    async fn write(&mut self, buf: &[u8]) -> Result<usize, Self::Error> {
+        self.socket.write(buf).await.map_err(ConnectionError::Tcp)
+    }
 
-            info!("Error response sent and flushed successfully");
-        }
+    async fn flush(&mut self) -> Result<(), Self::Error> {
+        self.socket.flush().await.map_err(ConnectionError::Tcp)
     }
-    Ok(())
 }
 
 #[embassy_executor::task]
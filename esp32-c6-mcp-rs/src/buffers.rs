@@ -0,0 +1,66 @@
+// Statically allocated per-connection buffers.
+//
+// Every listener gets its socket windows, its request framing buffer, room
+// for CBOR requests transcoded to JSON and its tool result buffer from one
+// pool in .bss, so none of them live on a task
+// stack or in the embassy task arena. Counts and sizes come from build.rs
+// (`MCP_CONNECTIONS`, `MCP_RX_BUFFER_SIZE`, ...); the firmware logs the
+// pool's total size at boot.
+
+use static_cell::ConstStaticCell;
+
+include!(concat!(env!("OUT_DIR"), "/buffer_pool.rs"));
+
+// Sizes that add up past MCP_BUFFER_BUDGET fail the build rather than the
+// boot
+const _: () = assert!(MCP_BUFFER_BYTES <= MCP_BUFFER_BUDGET, "{}", OVER_BUDGET);
+
+pub struct ConnectionBuffers<const RX: usize, const TX: usize> {
+    pub rx: [u8; RX],
+    pub tx: [u8; TX],
+    pub frame: [u8; MCP_FRAME_BUFFER_SIZE],
+    pub json: [u8; MCP_JSON_BUFFER_SIZE],
+    pub result: [u8; MCP_RESULT_BUFFER_SIZE],
+}
+
+pub struct BufferPool<const N: usize, const RX: usize, const TX: usize> {
+    buffers: ConstStaticCell<[ConnectionBuffers<RX, TX>; N]>,
+}
+
+impl<const N: usize, const RX: usize, const TX: usize> BufferPool<N, RX, TX> {
+    /// Total size of the pool in bytes.
+    pub const SIZE: usize = core::mem::size_of::<[ConnectionBuffers<RX, TX>; N]>();
+
+    pub const fn new() -> Self {
+        Self {
+            buffers: ConstStaticCell::new(
+                [const {
+                    ConnectionBuffers {
+                        rx: [0; RX],
+                        tx: [0; TX],
+                        frame: [0; MCP_FRAME_BUFFER_SIZE],
+                        json: [0; MCP_JSON_BUFFER_SIZE],
+                        result: [0; MCP_RESULT_BUFFER_SIZE],
+                    }
+                }; N],
+            ),
+        }
+    }
+
+    /// Hand out every connection's buffers. Panics if called twice.
+    pub fn take(&'static self) -> &'static mut [ConnectionBuffers<RX, TX>; N] {
+        self.buffers.take()
+    }
+}
+
+impl<const N: usize, const RX: usize, const TX: usize> Default for BufferPool<N, RX, TX> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// The pool as configured at build time.
+pub type McpBufferPool = BufferPool<MCP_CONNECTIONS, MCP_RX_BUFFER_SIZE, MCP_TX_BUFFER_SIZE>;
+
+// build.rs adds up the same buffers as ConnectionBuffers holds
+const _: () = assert!(McpBufferPool::SIZE == MCP_BUFFER_BYTES);
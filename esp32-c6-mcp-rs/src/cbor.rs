@@ -0,0 +1,957 @@
+// Length-prefixed CBOR framing, negotiated during `initialize`.
+//
+// A client that lists the `cborFraming` experimental capability in an
+// initialize request with an id, sent on its own rather than in a batch,
+// gets the same capability back. From the next message on both directions
+// switch from newline-delimited JSON to frames of a 4-byte big-endian length
+// followed by that many bytes of CBOR.
+//
+// The MCP core stays JSON internally: request frames are transcoded to JSON
+// text before dispatch and replies are transcoded from JSON while they are
+// written, in both cases without building a document tree. Objects and
+// arrays become indefinite-length maps and arrays, integers CBOR integers and
+// other numbers decimal fractions (tag 4), so no float is parsed or printed
+// on the way through. A batch reply is a run of frames (array start, one per
+// reply, break) that only forms a complete CBOR item once the last frame
+// arrives. esp32-mcp-bridge uses this module for its side of the link.
+
+use core::fmt;
+
+use embedded_io_async::Write;
+use heapless::Vec;
+use log::error;
+
+use crate::mcp::McpResponse;
+use crate::num::{Decimal, Shortest};
+use crate::output::escape_byte;
+
+/// Experimental capability name offered by clients and echoed by the server.
+pub const CAPABILITY: &str = "cborFraming";
+
+/// Bytes in the big-endian frame length prefix.
+pub const PREFIX_LEN: usize = 4;
+
+/// Start of an indefinite-length array, e.g. the first frame of a batch reply.
+pub const ARRAY_START: u8 = 0x9f;
+/// Ends an indefinite-length container.
+pub const BREAK: u8 = 0xff;
+
+// Deepest nesting decoded; MCP requests need a handful of levels
+const MAX_DEPTH: usize = 16;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum CborError {
+    /// The input ends inside an item.
+    UnexpectedEnd,
+    /// Malformed input at this offset.
+    Invalid(usize),
+    /// Valid CBOR with no JSON equivalent (byte strings, tags other than
+    /// decimal fractions, non-finite floats) at this offset.
+    Unsupported(usize),
+    TooDeep,
+    /// The output sink is full.
+    Write,
+}
+
+impl From<fmt::Error> for CborError {
+    fn from(_: fmt::Error) -> Self {
+        CborError::Write
+    }
+}
+
+const UNSIGNED: u8 = 0;
+const NEGATIVE: u8 = 1;
+const TEXT: u8 = 3;
+const ARRAY: u8 = 4;
+const MAP: u8 = 5;
+const TAG: u8 = 6;
+const SIMPLE: u8 = 7;
+
+const DECIMAL_FRACTION: u64 = 4;
+const INDEFINITE: u8 = 31;
+const MAP_START: u8 = 0xbf;
+const FALSE: u8 = 0xf4;
+const TRUE: u8 = 0xf5;
+const NULL: u8 = 0xf6;
+const NEGATIVE_ZERO: [u8; 3] = [0xf9, 0x80, 0x00];
+
+/// Encode an item head: major type and argument in the shortest form.
+fn head(major: u8, value: u64) -> ([u8; 9], usize) {
+    let mut buf = [0u8; 9];
+    let major = major << 5;
+    let len = if value < 24 {
+        buf[0] = major | value as u8;
+        1
+    } else if value <= u8::MAX as u64 {
+        buf[0] = major | 24;
+        buf[1] = value as u8;
+        2
+    } else if value <= u16::MAX as u64 {
+        buf[0] = major | 25;
+        buf[1..3].copy_from_slice(&(value as u16).to_be_bytes());
+        3
+    } else if value <= u32::MAX as u64 {
+        buf[0] = major | 26;
+        buf[1..5].copy_from_slice(&(value as u32).to_be_bytes());
+        5
+    } else {
+        buf[0] = major | 27;
+        buf[1..9].copy_from_slice(&value.to_be_bytes());
+        9
+    };
+    (buf, len)
+}
+
+fn int_head(negative: bool, magnitude: u64) -> ([u8; 9], usize) {
+    // CBOR negative integers store -1 - n; a zero magnitude is never negative
+    match negative && magnitude > 0 {
+        true => head(NEGATIVE, magnitude - 1),
+        false => head(UNSIGNED, magnitude),
+    }
+}
+
+// Tag 4, a two-element array head and two integers
+const MAX_ENCODED: usize = 20;
+
+/// A chunk of transcoded CBOR: a short encoded item, or a run of string
+/// bytes borrowed from the JSON source.
+pub enum Piece<'a> {
+    Encoded([u8; MAX_ENCODED], u8),
+    Borrowed(&'a [u8]),
+}
+
+impl Piece<'_> {
+    fn encoded(parts: &[&[u8]]) -> Self {
+        let mut buf = [0u8; MAX_ENCODED];
+        let mut len = 0;
+        for part in parts {
+            buf[len..len + part.len()].copy_from_slice(part);
+            len += part.len();
+        }
+        Piece::Encoded(buf, len as u8)
+    }
+
+    pub fn as_bytes(&self) -> &[u8] {
+        match self {
+            Piece::Encoded(buf, len) => &buf[..*len as usize],
+            Piece::Borrowed(bytes) => bytes,
+        }
+    }
+}
+
+/// Streaming JSON to CBOR transcoder over a complete JSON text.
+///
+/// Commas and colons are implied by CBOR's structure and aren't checked, so
+/// the input should already be known to be well-formed JSON.
+pub struct Transcoder<'a> {
+    src: &'a [u8],
+    pos: usize,
+    // End quote of the string currently being copied out
+    string_end: Option<usize>,
+    depth: usize,
+}
+
+impl<'a> Transcoder<'a> {
+    pub fn new(json: &'a str) -> Self {
+        Self {
+            src: json.as_bytes(),
+            pos: 0,
+            string_end: None,
+            depth: 0,
+        }
+    }
+
+    fn string_piece(&mut self, end: usize) -> Result<Piece<'a>, CborError> {
+        if self.src[self.pos] == b'\\' {
+            let (utf8, len, consumed) = unescape(self.src, self.pos)?;
+            self.pos += consumed;
+            return Ok(Piece::encoded(&[&utf8[..len]]));
+        }
+        let start = self.pos;
+        while self.pos < end && self.src[self.pos] != b'\\' {
+            self.pos += 1;
+        }
+        Ok(Piece::Borrowed(&self.src[start..self.pos]))
+    }
+
+    /// Head of the string opening at `self.pos`; its contents follow as
+    /// further pieces.
+    fn string_head(&mut self) -> Result<Piece<'a>, CborError> {
+        let mut pos = self.pos + 1;
+        let mut len = 0u64;
+        loop {
+            match self.src.get(pos) {
+                None => return Err(CborError::UnexpectedEnd),
+                Some(b'"') => break,
+                Some(b'\\') => {
+                    let (_, decoded, consumed) = unescape(self.src, pos)?;
+                    len += decoded as u64;
+                    pos += consumed;
+                }
+                Some(0..=0x1f) => return Err(CborError::Invalid(pos)),
+                Some(_) => {
+                    len += 1;
+                    pos += 1;
+                }
+            }
+        }
+        self.pos += 1;
+        self.string_end = Some(pos);
+        let (buf, head_len) = head(TEXT, len);
+        Ok(Piece::encoded(&[&buf[..head_len]]))
+    }
+
+    fn number(&mut self) -> Result<Piece<'a>, CborError> {
+        let start = self.pos;
+        while let Some(b'0'..=b'9' | b'-' | b'+' | b'.' | b'e' | b'E') = self.src.get(self.pos) {
+            self.pos += 1;
+        }
+        // The scanned bytes are all ASCII
+        let literal = core::str::from_utf8(&self.src[start..self.pos]).unwrap_or("");
+        let decimal = Decimal::scan(literal).ok_or(CborError::Invalid(start))?;
+
+        if decimal.negative && decimal.mantissa == 0 {
+            // Only a float can carry the sign of -0
+            return Ok(Piece::encoded(&[&NEGATIVE_ZERO]));
+        }
+        let (mantissa, mantissa_len) = int_head(decimal.negative, decimal.mantissa);
+        if decimal.integral && decimal.exponent == 0 {
+            return Ok(Piece::encoded(&[&mantissa[..mantissa_len]]));
+        }
+        if decimal.integral {
+            // Past 19 digits, but CBOR integers still hold it exactly
+            if let Ok(magnitude) = literal[decimal.negative as usize..].parse::<u64>() {
+                let (int, int_len) = int_head(decimal.negative, magnitude);
+                return Ok(Piece::encoded(&[&int[..int_len]]));
+            }
+        }
+        // Inexact literals keep 19 significant digits, more than an f64 holds
+        let (exponent, exponent_len) =
+            int_head(decimal.exponent < 0, decimal.exponent.unsigned_abs() as u64);
+        let (tag, tag_len) = head(TAG, DECIMAL_FRACTION);
+        let (pair, pair_len) = head(ARRAY, 2);
+        Ok(Piece::encoded(&[
+            &tag[..tag_len],
+            &pair[..pair_len],
+            &exponent[..exponent_len],
+            &mantissa[..mantissa_len],
+        ]))
+    }
+
+    fn literal(&mut self, word: &[u8], encoded: u8) -> Result<Piece<'a>, CborError> {
+        if !self.src[self.pos..].starts_with(word) {
+            return Err(CborError::Invalid(self.pos));
+        }
+        self.pos += word.len();
+        Ok(Piece::encoded(&[&[encoded]]))
+    }
+}
+
+impl<'a> Iterator for Transcoder<'a> {
+    type Item = Result<Piece<'a>, CborError>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let piece = self.step();
+        if let Some(Err(_)) = piece {
+            // Stop after the first error
+            self.pos = self.src.len();
+            self.string_end = None;
+            self.depth = 0;
+        }
+        piece
+    }
+}
+
+impl<'a> Transcoder<'a> {
+    fn step(&mut self) -> Option<Result<Piece<'a>, CborError>> {
+        if let Some(end) = self.string_end {
+            if self.pos < end {
+                return Some(self.string_piece(end));
+            }
+            self.pos = end + 1;
+            self.string_end = None;
+        }
+
+        while let Some(b' ' | b'\t' | b'\r' | b'\n' | b',' | b':') = self.src.get(self.pos) {
+            self.pos += 1;
+        }
+        let Some(&byte) = self.src.get(self.pos) else {
+            return (self.depth > 0).then_some(Err(CborError::UnexpectedEnd));
+        };
+
+        Some(match byte {
+            b'{' | b'[' => {
+                self.pos += 1;
+                self.depth += 1;
+                Ok(Piece::encoded(&[&[if byte == b'{' {
+                    MAP_START
+                } else {
+                    ARRAY_START
+                }]]))
+            }
+            b'}' | b']' if self.depth > 0 => {
+                self.pos += 1;
+                self.depth -= 1;
+                Ok(Piece::encoded(&[&[BREAK]]))
+            }
+            b'"' => self.string_head(),
+            b'-' | b'0'..=b'9' => self.number(),
+            b't' => self.literal(b"true", TRUE),
+            b'f' => self.literal(b"false", FALSE),
+            b'n' => self.literal(b"null", NULL),
+            _ => Err(CborError::Invalid(self.pos)),
+        })
+    }
+}
+
+/// Decode the JSON escape at `pos` into UTF-8. Returns the bytes, their
+/// length and the length of the escape.
+fn unescape(src: &[u8], pos: usize) -> Result<([u8; 4], usize, usize), CborError> {
+    let mut utf8 = [0u8; 4];
+    let simple = match src.get(pos + 1).ok_or(CborError::UnexpectedEnd)? {
+        b'"' => b'"',
+        b'\\' => b'\\',
+        b'/' => b'/',
+        b'b' => 0x08,
+        b'f' => 0x0c,
+        b'n' => b'\n',
+        b'r' => b'\r',
+        b't' => b'\t',
+        b'u' => {
+            let unit = hex4(src, pos + 2)?;
+            let (code, consumed) = match unit {
+                0xd800..=0xdbff => {
+                    if src.get(pos + 6..pos + 8) != Some(b"\\u") {
+                        return Err(CborError::Invalid(pos));
+                    }
+                    let low = hex4(src, pos + 8)?;
+                    if !(0xdc00..=0xdfff).contains(&low) {
+                        return Err(CborError::Invalid(pos));
+                    }
+                    (0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00), 12)
+                }
+                _ => (unit, 6),
+            };
+            let c = char::from_u32(code).ok_or(CborError::Invalid(pos))?;
+            let len = c.encode_utf8(&mut utf8).len();
+            return Ok((utf8, len, consumed));
+        }
+        _ => return Err(CborError::Invalid(pos)),
+    };
+    utf8[0] = simple;
+    Ok((utf8, 1, 2))
+}
+
+fn hex4(src: &[u8], pos: usize) -> Result<u32, CborError> {
+    let digits = src.get(pos..pos + 4).ok_or(CborError::UnexpectedEnd)?;
+    digits.iter().try_fold(0, |value, &digit| {
+        let nibble = (digit as char)
+            .to_digit(16)
+            .ok_or(CborError::Invalid(pos))?;
+        Ok(value << 4 | nibble)
+    })
+}
+
+/// Transcode a complete JSON text to CBOR, handing each chunk to `sink`.
+/// Returns the CBOR length.
+pub fn encode_json(json: &str, mut sink: impl FnMut(&[u8])) -> Result<usize, CborError> {
+    let mut len = 0;
+    for piece in Transcoder::new(json) {
+        let piece = piece?;
+        sink(piece.as_bytes());
+        len += piece.as_bytes().len();
+    }
+    Ok(len)
+}
+
+/// Write one frame: the length prefix, then `payload`.
+pub async fn write_frame<W: Write>(out: &mut W, payload: &[u8]) -> Result<(), W::Error> {
+    out.write_all(&(payload.len() as u32).to_be_bytes()).await?;
+    out.write_all(payload).await
+}
+
+/// Small CBOR items built in place, e.g. a response envelope.
+struct Encoder(Vec<u8, 256>);
+
+impl Encoder {
+    fn push(&mut self, bytes: &[u8]) {
+        // Sized for the largest envelope: a 128-byte error message
+        let _ = self.0.extend_from_slice(bytes);
+    }
+
+    fn head(&mut self, major: u8, value: u64) {
+        let (buf, len) = head(major, value);
+        self.push(&buf[..len]);
+    }
+
+    fn text(&mut self, text: &str) {
+        self.head(TEXT, text.len() as u64);
+        self.push(text.as_bytes());
+    }
+
+    fn int(&mut self, value: i64) {
+        let (buf, len) = int_head(value < 0, value.unsigned_abs());
+        self.push(&buf[..len]);
+    }
+
+    fn id(&mut self, id: Option<u32>) {
+        self.text("id");
+        match id {
+            Some(id) => self.int(id as i64),
+            None => self.push(&[NULL]),
+        }
+    }
+
+    fn error(&mut self, code: i32, message: &str) {
+        self.text("error");
+        self.head(MAP, 2);
+        self.text("code");
+        self.int(code as i64);
+        self.text("message");
+        self.text(message);
+    }
+}
+
+/// Write a response as one frame, transcoding the handler's JSON result as
+/// it goes.
+pub async fn write_response<W: Write>(
+    out: &mut W,
+    response: &McpResponse<'_>,
+) -> Result<(), W::Error> {
+    let mut envelope = Encoder(Vec::new());
+    envelope.head(MAP, 3);
+    envelope.text("jsonrpc");
+    envelope.text(response.jsonrpc.as_str());
+    envelope.id(response.id);
+
+    let mut result = None;
+    if let Some(json) = response.result {
+        match encode_json(json, |_| ()) {
+            Ok(len) => result = Some((json, len)),
+            Err(e) => {
+                error!("Result isn't valid JSON: {:?}", e);
+                return write_error(out, response.id, -32603, "Internal error").await;
+            }
+        }
+        envelope.text("result");
+    } else if let Some(ref error) = response.error {
+        envelope.error(error.code, error.message.as_str());
+    } else {
+        envelope.text("result");
+        envelope.push(&[NULL]);
+    }
+
+    let len = envelope.0.len() + result.map_or(0, |(_, len)| len);
+    out.write_all(&(len as u32).to_be_bytes()).await?;
+    out.write_all(&envelope.0).await?;
+    if let Some((json, _)) = result {
+        // Already transcoded once to measure it, so every piece is Ok
+        for piece in Transcoder::new(json).flatten() {
+            out.write_all(piece.as_bytes()).await?;
+        }
+    }
+    Ok(())
+}
+
+/// Write a complete error response as one frame.
+pub async fn write_error<W: Write>(
+    out: &mut W,
+    id: Option<u32>,
+    code: i32,
+    message: &str,
+) -> Result<(), W::Error> {
+    let mut envelope = Encoder(Vec::new());
+    envelope.head(MAP, 3);
+    envelope.text("jsonrpc");
+    envelope.text("2.0");
+    envelope.id(id);
+    envelope.error(code, message);
+    write_frame(out, &envelope.0).await
+}
+
+#[derive(Clone, Copy)]
+struct Level {
+    map: bool,
+    /// Items left in a definite-length container; map keys and values count
+    /// separately. `None` for indefinite-length containers.
+    remaining: Option<u64>,
+    items: u64,
+}
+
+struct Reader<'a> {
+    src: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn byte(&mut self) -> Result<u8, CborError> {
+        let byte = *self.src.get(self.pos).ok_or(CborError::UnexpectedEnd)?;
+        self.pos += 1;
+        Ok(byte)
+    }
+
+    fn take(&mut self, len: u64) -> Result<&'a [u8], CborError> {
+        let end = usize::try_from(len)
+            .ok()
+            .and_then(|len| self.pos.checked_add(len))
+            .filter(|&end| end <= self.src.len())
+            .ok_or(CborError::UnexpectedEnd)?;
+        let bytes = &self.src[self.pos..end];
+        self.pos = end;
+        Ok(bytes)
+    }
+
+    /// Major type, additional info and argument of the next item head. The
+    /// argument is the info itself below 24, and 0 for indefinite lengths.
+    fn head(&mut self) -> Result<(u8, u8, u64), CborError> {
+        let start = self.pos;
+        let initial = self.byte()?;
+        let (major, info) = (initial >> 5, initial & 0x1f);
+        let size = match info {
+            0..=23 => return Ok((major, info, info as u64)),
+            24..=27 => 1 << (info - 24),
+            INDEFINITE => return Ok((major, info, 0)),
+            _ => return Err(CborError::Invalid(start)),
+        };
+        let value = self
+            .take(size)?
+            .iter()
+            .fold(0u64, |value, &b| value << 8 | b as u64);
+        Ok((major, info, value))
+    }
+
+    /// A definite-length integer as sign and magnitude.
+    fn int(&mut self) -> Result<(bool, u64), CborError> {
+        let start = self.pos;
+        match self.head()? {
+            (UNSIGNED, info, value) if info != INDEFINITE => Ok((false, value)),
+            (NEGATIVE, info, value) if info != INDEFINITE && value < u64::MAX => {
+                Ok((true, value + 1))
+            }
+            _ => Err(CborError::Unsupported(start)),
+        }
+    }
+}
+
+/// Transcode one CBOR item at the start of `cbor` into JSON text. Returns
+/// the number of bytes it took; `UnexpectedEnd` means it isn't complete yet.
+pub fn decode_json<W: fmt::Write>(cbor: &[u8], out: &mut W) -> Result<usize, CborError> {
+    let mut reader = Reader { src: cbor, pos: 0 };
+    let mut stack: Vec<Level, MAX_DEPTH> = Vec::new();
+    let mut started = false;
+
+    loop {
+        // Close every container that is complete
+        while let Some(level) = stack.last() {
+            let complete = match level.remaining {
+                Some(remaining) => remaining == 0,
+                None if cbor.get(reader.pos) == Some(&BREAK) => {
+                    if level.map && level.items % 2 == 1 {
+                        return Err(CborError::Invalid(reader.pos));
+                    }
+                    reader.pos += 1;
+                    true
+                }
+                None => false,
+            };
+            if !complete {
+                break;
+            }
+            out.write_str(if level.map { "}" } else { "]" })?;
+            stack.pop();
+        }
+        if started && stack.is_empty() {
+            return Ok(reader.pos);
+        }
+        started = true;
+
+        let mut key = false;
+        if let Some(level) = stack.last_mut() {
+            if level.items > 0 {
+                out.write_str(if level.map && level.items % 2 == 1 {
+                    ":"
+                } else {
+                    ","
+                })?;
+            }
+            key = level.map && level.items % 2 == 0;
+            level.items += 1;
+            if let Some(remaining) = level.remaining.as_mut() {
+                *remaining -= 1;
+            }
+        }
+
+        let start = reader.pos;
+        let (major, info, value) = reader.head()?;
+        if key && major != TEXT {
+            // JSON object keys are strings
+            return Err(CborError::Unsupported(start));
+        }
+        match (major, info) {
+            (_, INDEFINITE) if major < TEXT => return Err(CborError::Invalid(start)),
+            (UNSIGNED, _) => write!(out, "{}", value)?,
+            (NEGATIVE, _) => write!(out, "-{}", value as u128 + 1)?,
+            (TEXT, INDEFINITE) => {
+                out.write_str("\"")?;
+                while cbor.get(reader.pos) != Some(&BREAK) {
+                    let chunk = reader.pos;
+                    match reader.head()? {
+                        (TEXT, info, len) if info != INDEFINITE => {
+                            write_text(out, reader.take(len)?, chunk)?
+                        }
+                        _ => return Err(CborError::Invalid(chunk)),
+                    }
+                }
+                reader.pos += 1;
+                out.write_str("\"")?;
+            }
+            (TEXT, _) => {
+                out.write_str("\"")?;
+                write_text(out, reader.take(value)?, start)?;
+                out.write_str("\"")?;
+            }
+            (ARRAY | MAP, _) => {
+                let map = major == MAP;
+                let remaining = match info {
+                    INDEFINITE => None,
+                    _ if map => Some(value.checked_mul(2).ok_or(CborError::Invalid(start))?),
+                    _ => Some(value),
+                };
+                out.write_str(if map { "{" } else { "[" })?;
+                stack
+                    .push(Level {
+                        map,
+                        remaining,
+                        items: 0,
+                    })
+                    .map_err(|_| CborError::TooDeep)?;
+            }
+            (TAG, _) if value == DECIMAL_FRACTION => {
+                if reader.head()? != (ARRAY, 2, 2) {
+                    return Err(CborError::Unsupported(start));
+                }
+                let (negative_exponent, exponent) = reader.int()?;
+                let (negative, mantissa) = reader.int()?;
+                let exponent =
+                    i64::try_from(exponent).map_err(|_| CborError::Unsupported(start))?;
+                let exponent = if negative_exponent {
+                    -exponent
+                } else {
+                    exponent
+                };
+                write_decimal(out, negative, mantissa, exponent)?;
+            }
+            (SIMPLE, 20) => out.write_str("false")?,
+            (SIMPLE, 21) => out.write_str("true")?,
+            (SIMPLE, 22 | 23) => out.write_str("null")?,
+            (SIMPLE, 25..=27) => {
+                let value = float(info, value).ok_or(CborError::Unsupported(start))?;
+                write!(out, "{}", Shortest(value))?;
+            }
+            (SIMPLE, INDEFINITE) => return Err(CborError::Invalid(start)),
+            _ => return Err(CborError::Unsupported(start)),
+        }
+    }
+}
+
+/// A finite CBOR half, single or double that is exact as an f32.
+fn float(info: u8, bits: u64) -> Option<f32> {
+    let value = match info {
+        25 => {
+            let bits = bits as u32;
+            let sign = (bits >> 15) << 31;
+            let exponent = (bits >> 10) & 0x1f;
+            let mantissa = bits & 0x3ff;
+            match exponent {
+                // Subnormal: mantissa × 2^-24, exact in an f32
+                0 => f32::from_bits(sign | (mantissa as f32 / (1 << 24) as f32).to_bits()),
+                0x1f => return None,
+                _ => f32::from_bits(sign | (exponent + 112) << 23 | mantissa << 13),
+            }
+        }
+        26 => f32::from_bits(bits as u32),
+        _ => {
+            let value = f64::from_bits(bits);
+            let narrowed = value as f32;
+            if narrowed as f64 != value {
+                return None;
+            }
+            narrowed
+        }
+    };
+    value.is_finite().then_some(value)
+}
+
+fn write_text<W: fmt::Write>(out: &mut W, bytes: &[u8], pos: usize) -> Result<(), CborError> {
+    let text = core::str::from_utf8(bytes).map_err(|_| CborError::Invalid(pos))?;
+    let mut start = 0;
+    for (i, &b) in text.as_bytes().iter().enumerate() {
+        if let Some((escape, len)) = escape_byte(b) {
+            out.write_str(&text[start..i])?;
+            // Escapes are ASCII
+            out.write_str(core::str::from_utf8(&escape[..len]).unwrap_or(""))?;
+            start = i + 1;
+        }
+    }
+    out.write_str(&text[start..])?;
+    Ok(())
+}
+
+/// Write `±mantissa × 10^exponent` as a JSON number, in plain decimal
+/// notation unless that would need a long run of zeros.
+fn write_decimal<W: fmt::Write>(
+    out: &mut W,
+    negative: bool,
+    mantissa: u64,
+    exponent: i64,
+) -> Result<(), CborError> {
+    let mut buf = [0u8; 20];
+    let mut start = buf.len();
+    let mut n = mantissa;
+    loop {
+        start -= 1;
+        buf[start] = b'0' + (n % 10) as u8;
+        n /= 10;
+        if n == 0 {
+            break;
+        }
+    }
+    let digits = core::str::from_utf8(&buf[start..]).unwrap_or("0");
+    let count = digits.len() as i64;
+
+    if negative {
+        out.write_str("-")?;
+    }
+    match exponent {
+        0 => out.write_str(digits)?,
+        // Digits on both sides of the point
+        _ if exponent < 0 && -exponent < count => {
+            let point = (count + exponent) as usize;
+            write!(out, "{}.{}", &digits[..point], &digits[point..])?
+        }
+        // Only a few zeros after the point
+        _ if exponent < 0 && -exponent - count <= 6 => {
+            out.write_str("0.")?;
+            for _ in 0..-exponent - count {
+                out.write_str("0")?;
+            }
+            out.write_str(digits)?
+        }
+        _ => write!(out, "{}e{}", digits, exponent)?,
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    extern crate std;
+
+    use super::*;
+    use std::string::String;
+    use std::vec::Vec;
+
+    fn encode(json: &str) -> Result<Vec<u8>, CborError> {
+        let mut cbor = Vec::new();
+        let len = encode_json(json, |bytes| cbor.extend_from_slice(bytes))?;
+        assert_eq!(len, cbor.len());
+        Ok(cbor)
+    }
+
+    fn decode(cbor: &[u8]) -> Result<String, CborError> {
+        let mut json = String::new();
+        let len = decode_json(cbor, &mut json)?;
+        assert_eq!(len, cbor.len(), "trailing bytes after {}", json);
+        Ok(json)
+    }
+
+    fn value(json: &str) -> serde_json::Value {
+        serde_json::from_str(json).unwrap_or_else(|e| panic!("invalid JSON {}: {}", json, e))
+    }
+
+    /// Transcode `json` to CBOR and back, and check it means the same.
+    fn round_trip(json: &str) -> String {
+        let cbor = encode(json).unwrap_or_else(|e| panic!("can't encode {}: {:?}", json, e));
+        let back = decode(&cbor).unwrap_or_else(|e| panic!("can't decode {}: {:?}", json, e));
+        assert_eq!(value(json), value(&back), "{} came back as {}", json, back);
+        back
+    }
+
+    #[test]
+    fn encodes_items_as_documented() {
+        assert_eq!(
+            encode(r#"[1,-1,"x",true,false,null,1.5,{"a":[]}]"#).unwrap(),
+            [
+                ARRAY_START,
+                0x01,
+                0x20,
+                0x61,
+                b'x',
+                TRUE,
+                FALSE,
+                NULL,
+                // Tag 4, [-1, 15]
+                0xc4,
+                0x82,
+                0x20,
+                0x0f,
+                MAP_START,
+                0x61,
+                b'a',
+                ARRAY_START,
+                BREAK,
+                BREAK,
+                BREAK,
+            ]
+        );
+    }
+
+    #[test]
+    fn round_trips_nested_containers() {
+        for json in [
+            "{}",
+            "[]",
+            r#"{"a":{"b":{"c":[[],[{}],[[1,[2,[3]]]]]}}}"#,
+            r#"[{"jsonrpc":"2.0","id":1,"method":"tools/call","params":{"name":"compute_batch","arguments":{"op":"dot","a":[1,2,3],"b":[4,5,6]}}}]"#,
+            " { \"spaced\" : [ 1 , 2 ] ,\r\n\t\"out\" : { } } ",
+        ] {
+            round_trip(json);
+        }
+        assert_eq!(
+            round_trip(r#"{"a":[1,{"b":null}],"c":true}"#),
+            r#"{"a":[1,{"b":null}],"c":true}"#
+        );
+    }
+
+    #[test]
+    fn round_trips_strings() {
+        for json in [
+            r#""""#,
+            r#""plain ascii""#,
+            r#""quote \" backslash \\ slash \/""#,
+            r#""\b\f\n\r\t \u0000\u0001\u001f""#,
+            r#""\u00e9\u6e29\ud83c\udf21""#,
+            r#""température – 温度 🌡️""#,
+            r#"{"kéy \"quoted\"":"välue\n"}"#,
+        ] {
+            round_trip(json);
+        }
+        // Escapes are decoded to UTF-8 and written back only where JSON needs them
+        assert_eq!(round_trip(r#""\u00e9\/\n""#), "\"é/\\n\"");
+        // Invalid or lone surrogates have no UTF-8 encoding
+        assert_eq!(encode(r#""\ud83c""#), Err(CborError::Invalid(1)));
+        assert_eq!(encode(r#""\udf21\u0041""#), Err(CborError::Invalid(1)));
+    }
+
+    #[test]
+    fn round_trips_integers_at_the_edges() {
+        for json in [
+            "0",
+            "23",
+            "24",
+            "255",
+            "256",
+            "65535",
+            "65536",
+            "4294967295",
+            "4294967296",
+            "-1",
+            "-24",
+            "-25",
+            "9223372036854775807",
+            "-9223372036854775808",
+            "18446744073709551615",
+            "-18446744073709551615",
+        ] {
+            assert_eq!(round_trip(json), json);
+        }
+        // Beyond 64 bits only 19 significant digits are kept
+        assert_eq!(round_trip("18446744073709551616"), "1844674407370955161e1");
+    }
+
+    #[test]
+    fn round_trips_floats() {
+        for json in [
+            "3.5",
+            "-0.25",
+            "0.004",
+            "1e-45",
+            "3.4028235e38",
+            "-1.25e3",
+            "1E+2",
+            "2.5e-3",
+            "0.30000000000000004",
+            "123456789.123456789",
+            "[0.1,-0.2,1e300,-1e-300]",
+        ] {
+            round_trip(json);
+        }
+        assert_eq!(round_trip("3.5"), "3.5");
+        assert_eq!(round_trip("0.004"), "0.004");
+        // Only a float keeps the sign of zero
+        assert_eq!(encode("-0").unwrap(), NEGATIVE_ZERO);
+        assert_eq!(round_trip("-0.0"), "-0");
+    }
+
+    #[test]
+    fn decodes_other_encoders_items() {
+        // Definite lengths, floats of every width and a chunked string
+        let cbor = [
+            0xa3, 0x61, b'a', 0x82, 0xf9, 0x3e, 0x00, 0xfa, 0x3f, 0xc0, 0x00, 0x00, 0x61, b'b',
+            0xfb, 0x3f, 0xf8, 0, 0, 0, 0, 0, 0, 0x61, b'c', 0x7f, 0x62, b'h', b'i', 0x61, b'!',
+            BREAK,
+        ];
+        assert_eq!(
+            decode(&cbor).unwrap(),
+            r#"{"a":[1.5,1.5],"b":1.5,"c":"hi!"}"#
+        );
+
+        // No JSON for these
+        assert_eq!(decode(&[0x41, 0x00]), Err(CborError::Unsupported(0)));
+        assert_eq!(decode(&[0xa1, 0x01, 0x02]), Err(CborError::Unsupported(1)));
+        assert_eq!(decode(&[0xf9, 0x7e, 0x00]), Err(CborError::Unsupported(0)));
+        assert_eq!(
+            decode(&[ARRAY_START; MAX_DEPTH + 1]),
+            Err(CborError::TooDeep)
+        );
+    }
+
+    #[test]
+    fn round_trips_batches() {
+        let replies = [
+            r#"{"jsonrpc":"2.0","id":1,"result":{"content":[{"type":"text","text":"1 + 2 = 3"}]}}"#,
+            r#"{"jsonrpc":"2.0","id":null,"error":{"code":-32600,"message":"Invalid Request"}}"#,
+            r#"{"jsonrpc":"2.0","id":3,"result":{}}"#,
+        ];
+
+        // As the server writes a batch reply: array start, one frame per
+        // reply, break. Only the whole run is one item
+        let mut frames = Vec::from([ARRAY_START]);
+        for reply in replies {
+            frames.extend(encode(reply).unwrap());
+        }
+        assert_eq!(decode(&frames), Err(CborError::UnexpectedEnd));
+        frames.push(BREAK);
+
+        let batch = std::format!("[{}]", replies.join(","));
+        assert_eq!(value(&decode(&frames).unwrap()), value(&batch));
+        round_trip(&batch);
+    }
+
+    #[test]
+    fn rejects_truncated_input() {
+        let json = r#"{"jsonrpc":"2.0","id":7,"params":{"a":[1.5,-2,"é\n",true,null],"b":{}}}"#;
+        let cbor = encode(json).unwrap();
+        for end in 0..cbor.len() {
+            assert_eq!(
+                decode(&cbor[..end]),
+                Err(CborError::UnexpectedEnd),
+                "{} of {} bytes",
+                end,
+                cbor.len()
+            );
+        }
+        for end in (1..json.len()).filter(|&end| json.is_char_boundary(end)) {
+            assert!(encode(&json[..end]).is_err(), "{}", &json[..end]);
+        }
+    }
+}
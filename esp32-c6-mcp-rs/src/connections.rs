@@ -0,0 +1,169 @@
+// Bookkeeping for a fixed pool of connection listeners.
+//
+// Each listener task owns one socket and one slot here. While every slot
+// is serving a client, the connection that has been idle the longest is
+// asked to close once it has been idle past the pool's limit, so a new
+// client never waits on a stale one. Clients that are still active are left
+// alone: a new client waits until a listener is free rather than take the
+// place of one that's in use.
+//
+// Timestamps are wrapping u32 milliseconds; the target has no 64-bit atomics.
+
+use core::sync::atomic::{AtomicBool, AtomicU32, AtomicUsize, Ordering};
+use embassy_sync::blocking_mutex::raw::CriticalSectionRawMutex;
+use embassy_sync::signal::Signal;
+
+struct Slot {
+    busy: AtomicBool,
+    last_active: AtomicU32,
+    evict: Signal<CriticalSectionRawMutex, ()>,
+}
+
+pub struct Connections<const N: usize> {
+    slots: [Slot; N],
+    active: AtomicUsize,
+    /// How long a connection sits idle before a new client may take its
+    /// listener.
+    idle_limit_ms: u32,
+}
+
+impl<const N: usize> Connections<N> {
+    pub const fn new(idle_limit_ms: u32) -> Self {
+        Self {
+            slots: [const {
+                Slot {
+                    busy: AtomicBool::new(false),
+                    last_active: AtomicU32::new(0),
+                    evict: Signal::new(),
+                }
+            }; N],
+            active: AtomicUsize::new(0),
+            idle_limit_ms,
+        }
+    }
+
+    /// Mark listener `id` as serving a client. Returns the number of active
+    /// connections, including this one.
+    pub fn connected(&self, id: usize, now_ms: u32) -> usize {
+        let slot = &self.slots[id];
+        slot.evict.reset();
+        slot.last_active.store(now_ms, Ordering::Relaxed);
+        slot.busy.store(true, Ordering::Release);
+
+        let active = self.active.fetch_add(1, Ordering::AcqRel) + 1;
+        if active == N {
+            self.evict_idle(now_ms);
+        }
+        active
+    }
+
+    /// Record activity on listener `id`'s connection.
+    pub fn touch(&self, id: usize, now_ms: u32) {
+        self.slots[id].last_active.store(now_ms, Ordering::Relaxed);
+    }
+
+    /// Mark listener `id` as accepting again. Returns the number of
+    /// connections still active.
+    pub fn disconnected(&self, id: usize) -> usize {
+        self.slots[id].busy.store(false, Ordering::Release);
+        self.active.fetch_sub(1, Ordering::AcqRel) - 1
+    }
+
+    /// Resolves when listener `id`'s connection has been chosen for eviction.
+    pub async fn evicted(&self, id: usize) {
+        self.slots[id].evict.wait().await
+    }
+
+    /// While every listener is serving a client, ask the connection idle
+    /// longest to close if it has been idle past the limit. Call it
+    /// periodically, since a full pool has no listener left to notice a
+    /// connection going stale. Returns whether one was asked.
+    pub fn evict_idle(&self, now_ms: u32) -> bool {
+        if self.active.load(Ordering::Acquire) < N {
+            return false;
+        }
+        let idlest = self
+            .slots
+            .iter()
+            .filter(|slot| slot.busy.load(Ordering::Acquire))
+            .map(|slot| {
+                let idle = now_ms.wrapping_sub(slot.last_active.load(Ordering::Relaxed));
+                (idle, slot)
+            })
+            .max_by_key(|&(idle, _)| idle);
+
+        match idlest {
+            Some((idle, slot)) if idle >= self.idle_limit_ms => {
+                slot.evict.signal(());
+                true
+            }
+            _ => false,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const LIMIT: u32 = 30_000;
+
+    fn evicting(pool: &Connections<3>) -> [bool; 3] {
+        core::array::from_fn(|i| pool.slots[i].evict.signaled())
+    }
+
+    #[test]
+    fn keeps_active_clients_when_the_pool_fills() {
+        let pool: Connections<3> = Connections::new(LIMIT);
+        assert_eq!(pool.connected(0, 0), 1);
+        assert_eq!(pool.connected(1, 100), 2);
+        assert_eq!(pool.connected(2, 200), 3);
+        assert_eq!(evicting(&pool), [false; 3]);
+
+        // Still within the limit: a new client waits
+        assert!(!pool.evict_idle(LIMIT - 1));
+        assert_eq!(evicting(&pool), [false; 3]);
+    }
+
+    #[test]
+    fn evicts_the_idlest_past_the_limit() {
+        let pool: Connections<3> = Connections::new(LIMIT);
+        pool.connected(0, 0);
+        pool.connected(1, 100);
+        pool.connected(2, 200);
+        pool.touch(0, 5_000);
+
+        assert!(!pool.evict_idle(LIMIT));
+        assert!(pool.evict_idle(LIMIT + 100));
+        assert_eq!(evicting(&pool), [false, true, false]);
+
+        // Its listener accepts the waiting client, which starts out active
+        assert_eq!(pool.disconnected(1), 2);
+        assert_eq!(pool.connected(1, LIMIT + 150), 3);
+        assert_eq!(evicting(&pool), [false; 3]);
+    }
+
+    #[test]
+    fn leaves_a_pool_with_a_free_listener_alone() {
+        let pool: Connections<3> = Connections::new(LIMIT);
+        pool.connected(0, 0);
+        pool.connected(1, 0);
+        assert!(!pool.evict_idle(10 * LIMIT));
+        assert_eq!(evicting(&pool), [false; 3]);
+    }
+
+    #[test]
+    fn measures_idle_time_across_the_clock_wrapping() {
+        let pool: Connections<3> = Connections::new(LIMIT);
+        let start = u32::MAX - 1_000;
+        pool.connected(0, start);
+        pool.connected(1, start);
+        pool.connected(2, start);
+        pool.touch(0, 500);
+        pool.touch(2, 500);
+
+        assert!(!pool.evict_idle(start.wrapping_add(LIMIT - 1)));
+        assert!(pool.evict_idle(start.wrapping_add(LIMIT)));
+        assert_eq!(evicting(&pool), [false, true, false]);
+    }
+}
@@ -0,0 +1,155 @@
+// Compile-time perfect-hash dispatch table for MCP tools.
+//
+// The seed is searched during const evaluation so that every registered tool
+// name lands in its own slot; a lookup is then one hash of the requested name
+// and one string compare, independent of how many tools are registered.
+
+use crate::json::Arguments;
+use crate::mcp::McpError;
+
+/// Tool handlers write their JSON result into the caller's buffer and return
+/// the written slice, or a `&'static str` for constant results.
+pub type ToolHandler = for<'b> fn(&Arguments, &'b mut [u8]) -> Result<&'b str, McpError>;
+
+pub struct Tool {
+    pub name: &'static str,
+    pub handler: ToolHandler,
+}
+
+const EMPTY: u8 = u8::MAX;
+const MAX_SEED: u32 = 1 << 16;
+
+// FNV-1a, mixed with a seed so the const search can retry on collisions
+const fn hash(name: &[u8], seed: u32) -> u32 {
+    let mut h = 0x811c_9dc5 ^ seed.wrapping_mul(0x9e37_79b9);
+    let mut i = 0;
+    while i < name.len() {
+        h ^= name[i] as u32;
+        h = h.wrapping_mul(0x0100_0193);
+        i += 1;
+    }
+    h ^ (h >> 16)
+}
+
+pub struct ToolTable<const SLOTS: usize> {
+    tools: &'static [Tool],
+    seed: u32,
+    slots: [u8; SLOTS],
+}
+
+impl<const SLOTS: usize> ToolTable<SLOTS> {
+    /// Build the table at compile time. Fails const evaluation if `SLOTS` is
+    /// not a power of two, is too small, or no collision-free seed exists.
+    pub const fn new(tools: &'static [Tool]) -> Self {
+        assert!(SLOTS.is_power_of_two(), "slot count must be a power of two");
+        assert!(tools.len() <= SLOTS && tools.len() < EMPTY as usize);
+
+        let mut seed = 0;
+        while seed < MAX_SEED {
+            if let Some(slots) = Self::place(tools, seed) {
+                return Self { tools, seed, slots };
+            }
+            seed += 1;
+        }
+        panic!("no collision-free seed; increase the slot count");
+    }
+
+    const fn place(tools: &'static [Tool], seed: u32) -> Option<[u8; SLOTS]> {
+        let mut slots = [EMPTY; SLOTS];
+        let mut i = 0;
+        while i < tools.len() {
+            let slot = hash(tools[i].name.as_bytes(), seed) as usize & (SLOTS - 1);
+            if slots[slot] != EMPTY {
+                return None;
+            }
+            slots[slot] = i as u8;
+            i += 1;
+        }
+        Some(slots)
+    }
+
+    pub fn lookup(&self, name: &str) -> Option<&'static Tool> {
+        let slot = hash(name.as_bytes(), self.seed) as usize & (SLOTS - 1);
+        let tool = self.tools.get(self.slots[slot] as usize)?;
+        (tool.name == name).then_some(tool)
+    }
+
+    pub fn tools(&self) -> &'static [Tool] {
+        self.tools
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    extern crate std;
+
+    use super::*;
+    use crate::json::parse_tool_call;
+    use crate::mcp::TOOLS;
+    use std::string::String;
+    use std::vec::Vec;
+
+    /// Call tool `name` through the table, as tools/call does.
+    fn call(name: &str, arguments: &str, out: &mut [u8]) -> String {
+        let raw = std::format!(r#"{{"params":{{"name":"{name}","arguments":{arguments}}}}}"#);
+        let call = parse_tool_call(&raw).unwrap();
+        let tool = TOOLS.lookup(name).unwrap();
+        let result = (tool.handler)(&call.arguments, out);
+        String::from(result.unwrap())
+    }
+
+    #[test]
+    fn finds_every_registered_tool() {
+        for tool in TOOLS.tools() {
+            let found = TOOLS.lookup(tool.name).unwrap();
+            assert!(
+                core::ptr::eq(found, tool),
+                "{} found {}",
+                tool.name,
+                found.name
+            );
+        }
+    }
+
+    #[test]
+    fn dispatches_to_the_named_handler() {
+        let mut out = [0u8; 64];
+        let sum = call("compute_add", r#"{"a":6,"b":3}"#, &mut out);
+        let product = call("compute_multiply", r#"{"a":6,"b":3}"#, &mut out);
+        assert!(sum.contains("6 + 3 = 9"), "{sum}");
+        assert!(product.contains("6 × 3 = 18"), "{product}");
+    }
+
+    #[test]
+    fn misses_names_that_are_not_registered() {
+        for name in [
+            "",
+            "missing",
+            "compute_ad",
+            "compute_add_",
+            "Compute_add",
+            "compute_add\0",
+        ] {
+            assert!(TOOLS.lookup(name).is_none(), "{name:?}");
+        }
+    }
+
+    #[test]
+    fn places_every_tool_in_its_own_slot() {
+        let mut slots: Vec<usize> = TOOLS
+            .tools()
+            .iter()
+            .map(|tool| hash(tool.name.as_bytes(), TOOLS.seed) as usize & (TOOLS.slots.len() - 1))
+            .collect();
+        for (i, &slot) in slots.iter().enumerate() {
+            assert_eq!(TOOLS.slots[slot] as usize, i);
+        }
+        slots.sort_unstable();
+        slots.dedup();
+        assert_eq!(slots.len(), TOOLS.tools().len());
+        assert_eq!(
+            TOOLS.slots.iter().filter(|&&slot| slot != EMPTY).count(),
+            TOOLS.tools().len()
+        );
+    }
+}
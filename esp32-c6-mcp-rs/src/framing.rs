@@ -0,0 +1,301 @@
+// Newline framing over a fixed-capacity byte buffer.
+//
+// Socket reads land directly in the buffer's free space, newlines are found
+// in place, and complete frames are handed out as borrowed slices. Only the
+// partial frame at the tail is ever moved (once per read, to the front), so
+// cost stays linear however many messages arrive in one read. UTF-8 is
+// checked per frame, so a multi-byte character split across reads is fine.
+//
+// A frame that doesn't fit in the buffer is dropped up to its newline and
+// reported once as `Frame::Oversized`; framing resumes with the next line.
+//
+// After a client negotiates CBOR (see `cbor`) the same buffer frames a 4-byte
+// big-endian length followed by that many bytes instead of lines, and hands
+// payloads out as `Frame::Binary`.
+
+use crate::cbor::PREFIX_LEN;
+
+pub enum Frame<'a> {
+    /// A complete, non-empty, whitespace-trimmed message.
+    Message(&'a str),
+    /// The payload of a non-empty length-prefixed frame.
+    Binary(&'a [u8]),
+    InvalidUtf8,
+    Oversized,
+}
+
+pub struct FrameBuffer<'a> {
+    buf: &'a mut [u8],
+    // Unconsumed data is buf[start..end]; buf[start..scanned] has no newline
+    start: usize,
+    end: usize,
+    scanned: usize,
+    // Dropping an oversized frame until its terminating newline
+    discarding: bool,
+    length_prefixed: bool,
+    // Payload bytes of an oversized length-prefixed frame still to drop
+    skip: usize,
+}
+
+impl<'a> FrameBuffer<'a> {
+    pub fn new(buf: &'a mut [u8]) -> Self {
+        Self {
+            buf,
+            start: 0,
+            end: 0,
+            scanned: 0,
+            discarding: false,
+            length_prefixed: false,
+            skip: 0,
+        }
+    }
+
+    /// Frame length-prefixed messages. The first `filled` bytes of `buf` were
+    /// already received.
+    pub fn length_prefixed(buf: &'a mut [u8], filled: usize) -> Self {
+        let end = filled.min(buf.len());
+        Self {
+            end,
+            length_prefixed: true,
+            ..Self::new(buf)
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.buf.len()
+    }
+
+    /// Move the unconsumed bytes to the front of the buffer and return how
+    /// many there are, e.g. to keep them across a change of framing.
+    pub fn into_unconsumed(self) -> usize {
+        self.buf.copy_within(self.start..self.end, 0);
+        self.end - self.start
+    }
+
+    /// Free space for the next read. Always non-empty.
+    pub fn spare(&mut self) -> &mut [u8] {
+        if self.start > 0 {
+            self.buf.copy_within(self.start..self.end, 0);
+            self.end -= self.start;
+            self.scanned -= self.start;
+            self.start = 0;
+        }
+        if self.end == self.buf.len() && !self.length_prefixed {
+            // No newline in a full buffer: the frame can never fit
+            self.discarding = true;
+            self.end = 0;
+            self.scanned = 0;
+        }
+        &mut self.buf[self.end..]
+    }
+
+    /// Mark `n` bytes of `spare()` as filled.
+    pub fn commit(&mut self, n: usize) {
+        self.end = (self.end + n).min(self.buf.len());
+    }
+
+    pub fn next_frame(&mut self) -> Option<Frame<'_>> {
+        if self.length_prefixed {
+            return self.next_length_prefixed();
+        }
+        loop {
+            let Some(offset) = self.buf[self.scanned..self.end]
+                .iter()
+                .position(|&b| b == b'\n')
+            else {
+                self.scanned = self.end;
+                if self.discarding {
+                    self.start = self.end;
+                }
+                return None;
+            };
+
+            let newline = self.scanned + offset;
+            let frame_start = self.start;
+            self.start = newline + 1;
+            self.scanned = self.start;
+
+            if self.discarding {
+                self.discarding = false;
+                return Some(Frame::Oversized);
+            }
+
+            let frame = self.buf[frame_start..newline].trim_ascii();
+            if frame.is_empty() {
+                continue;
+            }
+            return Some(match core::str::from_utf8(frame) {
+                Ok(message) => Frame::Message(message),
+                Err(_) => Frame::InvalidUtf8,
+            });
+        }
+    }
+
+    fn next_length_prefixed(&mut self) -> Option<Frame<'_>> {
+        loop {
+            let available = self.end - self.start;
+            if self.skip > 0 {
+                let dropped = self.skip.min(available);
+                self.start += dropped;
+                self.scanned = self.start;
+                self.skip -= dropped;
+                if self.skip > 0 {
+                    return None;
+                }
+                continue;
+            }
+
+            let prefix = self.buf[self.start..self.end].get(..PREFIX_LEN)?;
+            let len = u32::from_be_bytes([prefix[0], prefix[1], prefix[2], prefix[3]]) as usize;
+            if len > self.buf.len() - PREFIX_LEN {
+                self.start += PREFIX_LEN;
+                self.scanned = self.start;
+                self.skip = len;
+                return Some(Frame::Oversized);
+            }
+            if available < PREFIX_LEN + len {
+                return None;
+            }
+
+            let payload = self.start + PREFIX_LEN..self.start + PREFIX_LEN + len;
+            self.start = payload.end;
+            self.scanned = self.start;
+            if len > 0 {
+                return Some(Frame::Binary(&self.buf[payload]));
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    extern crate std;
+
+    use super::*;
+    use std::string::String;
+    use std::vec::Vec;
+
+    /// A frame copied out of the buffer.
+    #[derive(Debug, PartialEq)]
+    enum Got {
+        Message(String),
+        Binary(Vec<u8>),
+        InvalidUtf8,
+        Oversized,
+    }
+
+    fn message(text: &str) -> Got {
+        Got::Message(String::from(text))
+    }
+
+    /// Feed `reads` as a socket would, at most the free space at a time, and
+    /// collect every frame.
+    fn receive(frames: &mut FrameBuffer, reads: &[&[u8]]) -> Vec<Got> {
+        let mut got = Vec::new();
+        for mut read in reads.iter().copied() {
+            while !read.is_empty() {
+                let spare = frames.spare();
+                let n = spare.len().min(read.len());
+                spare[..n].copy_from_slice(&read[..n]);
+                frames.commit(n);
+                read = &read[n..];
+                while let Some(frame) = frames.next_frame() {
+                    got.push(match frame {
+                        Frame::Message(text) => message(text),
+                        Frame::Binary(payload) => Got::Binary(payload.to_vec()),
+                        Frame::InvalidUtf8 => Got::InvalidUtf8,
+                        Frame::Oversized => Got::Oversized,
+                    });
+                }
+            }
+        }
+        got
+    }
+
+    fn prefixed(payload: &[u8]) -> Vec<u8> {
+        let mut frame = (payload.len() as u32).to_be_bytes().to_vec();
+        frame.extend_from_slice(payload);
+        frame
+    }
+
+    #[test]
+    fn joins_a_line_split_across_reads() {
+        let mut buf = [0u8; 64];
+        let mut frames = FrameBuffer::new(&mut buf);
+        // "é" is split between its two bytes
+        let reads: [&[u8]; 3] = [b"{\"a\":\"caf\xc3", b"\xa9\"}\n{\"b\"", b":1}\n"];
+        assert_eq!(
+            receive(&mut frames, &reads),
+            [message("{\"a\":\"café\"}"), message("{\"b\":1}")]
+        );
+    }
+
+    #[test]
+    fn hands_out_every_line_in_one_read() {
+        let mut buf = [0u8; 64];
+        let mut frames = FrameBuffer::new(&mut buf);
+        let reads: [&[u8]; 1] = [b"{\"a\":1}\n\n  {\"b\":2}\r\n{\"c\":\xff}\n{\"d\":4}\n"];
+        assert_eq!(
+            receive(&mut frames, &reads),
+            [
+                message("{\"a\":1}"),
+                message("{\"b\":2}"),
+                Got::InvalidUtf8,
+                message("{\"d\":4}"),
+            ]
+        );
+    }
+
+    #[test]
+    fn drops_an_oversized_line_up_to_its_newline() {
+        let mut buf = [0u8; 16];
+        let mut frames = FrameBuffer::new(&mut buf);
+        let reads: [&[u8]; 3] = [
+            b"{\"a\":1}\n{\"b\":\"0123456789",
+            b"abcdefghij",
+            b"klm\"}\n{\"c\":3}\n",
+        ];
+        assert_eq!(
+            receive(&mut frames, &reads),
+            [message("{\"a\":1}"), Got::Oversized, message("{\"c\":3}")]
+        );
+
+        // A line that only just fits still gets through
+        let reads: [&[u8]; 1] = [b"{\"d\":\"0123456\"}\n"];
+        assert_eq!(
+            receive(&mut frames, &reads),
+            [message("{\"d\":\"0123456\"}")]
+        );
+    }
+
+    #[test]
+    fn skips_a_frame_longer_than_the_buffer() {
+        let mut buf = [0u8; 16];
+        let mut frames = FrameBuffer::length_prefixed(&mut buf, 0);
+        let oversized = prefixed(&[7; 40]);
+        let (head, tail) = oversized.split_at(10);
+        let next = prefixed(&[1, 2, 3]);
+        let full = prefixed(&[9; 12]);
+        assert_eq!(
+            receive(&mut frames, &[head, tail, &next, &full]),
+            [
+                Got::Oversized,
+                Got::Binary(std::vec![1, 2, 3]),
+                Got::Binary(std::vec![9; 12]),
+            ]
+        );
+    }
+
+    #[test]
+    fn starts_from_bytes_carried_over_a_switch() {
+        let mut buf = [0u8; 16];
+        let carried = prefixed(b"ab");
+        buf[..carried.len()].copy_from_slice(&carried);
+        let mut frames = FrameBuffer::length_prefixed(&mut buf, carried.len());
+        let split = prefixed(b"cdef");
+        assert_eq!(
+            receive(&mut frames, &[&split[..3], &split[3..]]),
+            [Got::Binary(b"ab".to_vec()), Got::Binary(b"cdef".to_vec())]
+        );
+    }
+}
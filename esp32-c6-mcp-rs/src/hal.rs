@@ -0,0 +1,56 @@
+// Hardware the MCP tools talk to, behind traits so the protocol core builds
+// for the host as well as the ESP32-C6.
+//
+// Implementations are registered once at startup as `&'static` references
+// and looked up through an atomic pointer, so the request path takes no lock.
+
+use core::sync::atomic::{AtomicPtr, Ordering};
+use embassy_sync::blocking_mutex::raw::CriticalSectionRawMutex;
+use embassy_sync::channel::Sender;
+
+use crate::mcp::LedCommand;
+use crate::telemetry::{Telemetry, WifiSnapshot};
+
+/// Where `led_control` sends its commands. Must not block.
+pub trait LedSink: Sync {
+    fn send(&self, command: LedCommand) -> Result<(), &'static str>;
+}
+
+/// Where `wifi_status` reads connection state from. Must not block.
+pub trait WifiStatusSource: Sync {
+    fn snapshot(&self) -> WifiSnapshot;
+}
+
+/// The firmware queues commands for its LED hardware task.
+impl<const N: usize> LedSink for Sender<'static, CriticalSectionRawMutex, LedCommand, N> {
+    fn send(&self, command: LedCommand) -> Result<(), &'static str> {
+        self.try_send(command).map_err(|_| "LED command queue full")
+    }
+}
+
+impl WifiStatusSource for Telemetry {
+    fn snapshot(&self) -> WifiSnapshot {
+        self.read()
+    }
+}
+
+static LED_SINK: AtomicPtr<&'static dyn LedSink> = AtomicPtr::new(core::ptr::null_mut());
+static WIFI_SOURCE: AtomicPtr<&'static dyn WifiStatusSource> =
+    AtomicPtr::new(core::ptr::null_mut());
+
+pub fn set_led_sink(sink: &'static &'static dyn LedSink) {
+    LED_SINK.store(sink as *const _ as *mut _, Ordering::Release);
+}
+
+pub fn set_wifi_source(source: &'static &'static dyn WifiStatusSource) {
+    WIFI_SOURCE.store(source as *const _ as *mut _, Ordering::Release);
+}
+
+pub(crate) fn led_sink() -> Option<&'static dyn LedSink> {
+    // Only ever set from a `&'static` reference
+    unsafe { LED_SINK.load(Ordering::Acquire).as_ref().copied() }
+}
+
+pub(crate) fn wifi_source() -> Option<&'static dyn WifiStatusSource> {
+    unsafe { WIFI_SOURCE.load(Ordering::Acquire).as_ref().copied() }
+}
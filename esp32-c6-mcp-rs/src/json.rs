@@ -0,0 +1,540 @@
+// Single-pass, zero-copy JSON scanner for MCP tools/call requests.
+//
+// The request is walked exactly once; `params.name` and every member of
+// `params.arguments` are returned as slices borrowed from the request, so
+// handlers never rescan the raw JSON and keys can't match inside string values.
+// Numbers are checked against JSON's grammar as they're scanned, and arrays
+// and objects that are skipped whole for matching brackets.
+
+use heapless::Vec;
+
+pub const MAX_ARGUMENTS: usize = 8;
+
+// Nesting a skipped array or object may have; one bit of a u64 per level
+const MAX_DEPTH: u32 = 64;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum JsonError {
+    UnexpectedEnd,
+    UnexpectedByte(usize),
+    TooManyArguments,
+    MissingName,
+}
+
+/// A JSON value borrowed from the request. Strings keep their raw (still
+/// escaped) contents; arrays and objects are kept as raw slices including
+/// their brackets.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Value<'a> {
+    Str(&'a str),
+    Num(&'a str),
+    Bool(bool),
+    Null,
+    Array(&'a str),
+    Object(&'a str),
+}
+
+impl<'a> Value<'a> {
+    pub fn as_str(&self) -> Option<&'a str> {
+        match *self {
+            Value::Str(s) => Some(s),
+            _ => None,
+        }
+    }
+
+    pub fn as_bool(&self) -> Option<bool> {
+        match *self {
+            Value::Bool(b) => Some(b),
+            _ => None,
+        }
+    }
+
+    pub fn as_u8(&self) -> Option<u8> {
+        match *self {
+            Value::Num(n) => n.parse::<u8>().ok(),
+            _ => None,
+        }
+    }
+
+    pub fn as_f32(&self) -> Option<f32> {
+        match *self {
+            Value::Num(n) => crate::num::parse_f32(n),
+            _ => None,
+        }
+    }
+}
+
+/// Top-level members of `params.arguments`, in request order.
+#[derive(Debug, Default)]
+pub struct Arguments<'a> {
+    entries: Vec<(&'a str, Value<'a>), MAX_ARGUMENTS>,
+}
+
+impl<'a> Arguments<'a> {
+    pub fn get(&self, key: &str) -> Option<Value<'a>> {
+        self.entries
+            .iter()
+            .find(|(k, _)| *k == key)
+            .map(|(_, v)| *v)
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = (&'a str, Value<'a>)> + '_ {
+        self.entries.iter().copied()
+    }
+}
+
+#[derive(Debug)]
+pub struct ToolCall<'a> {
+    pub name: &'a str,
+    pub arguments: Arguments<'a>,
+}
+
+/// Extract `params.name` and `params.arguments` from a tools/call request.
+pub fn parse_tool_call(raw_json: &str) -> Result<ToolCall<'_>, JsonError> {
+    let mut scanner = Scanner::new(raw_json);
+    let mut name = None;
+    let mut arguments = Arguments::default();
+
+    scanner.object(|s, key| {
+        if key != "params" || s.peek() != Some(b'{') {
+            return s.value().map(|_| ());
+        }
+        s.object(|s, key| match key {
+            "name" => {
+                name = Some(s.string()?);
+                Ok(())
+            }
+            "arguments" if s.peek() == Some(b'{') => s.object(|s, key| {
+                let value = s.value()?;
+                arguments
+                    .entries
+                    .push((key, value))
+                    .map_err(|_| JsonError::TooManyArguments)
+            }),
+            _ => s.value().map(|_| ()),
+        })
+    })?;
+    scanner.end()?;
+
+    Ok(ToolCall {
+        name: name.ok_or(JsonError::MissingName)?,
+        arguments,
+    })
+}
+
+/// Whether `raw_json` is an initialize request listing `name` among the
+/// client's experimental capabilities.
+pub fn initialize_offers(raw_json: &str, name: &str) -> bool {
+    let mut scanner = Scanner::new(raw_json);
+    let mut initialize = false;
+    let mut offered = false;
+
+    // Each level only descends into the one member on the path
+    let walked = scanner.object(|s, key| match key {
+        "method" if s.peek() == Some(b'"') => {
+            initialize = s.string()? == "initialize";
+            // Any other request is rejected without walking the rest
+            match initialize {
+                true => Ok(()),
+                false => Err(JsonError::UnexpectedByte(s.pos)),
+            }
+        }
+        "params" if s.peek() == Some(b'{') => s.object(|s, key| match key {
+            "capabilities" if s.peek() == Some(b'{') => s.object(|s, key| match key {
+                "experimental" if s.peek() == Some(b'{') => s.object(|s, key| {
+                    offered |= key == name;
+                    s.value().map(|_| ())
+                }),
+                _ => s.value().map(|_| ()),
+            }),
+            _ => s.value().map(|_| ()),
+        }),
+        _ => s.value().map(|_| ()),
+    });
+
+    walked.is_ok() && initialize && offered
+}
+
+/// Raw elements of a top-level JSON array, e.g. the requests of a JSON-RPC
+/// batch. Each item is the element's exact slice of the input.
+pub struct Elements<'a> {
+    scanner: Scanner<'a>,
+    first: bool,
+    done: bool,
+}
+
+pub fn array_elements(raw_json: &str) -> Result<Elements<'_>, JsonError> {
+    let mut scanner = Scanner::new(raw_json);
+    scanner.expect(b'[')?;
+    let done = scanner.peek() == Some(b']');
+    if done {
+        scanner.pos += 1;
+        scanner.end()?;
+    }
+    Ok(Elements {
+        scanner,
+        first: true,
+        done,
+    })
+}
+
+impl<'a> Iterator for Elements<'a> {
+    type Item = Result<&'a str, JsonError>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.done {
+            return None;
+        }
+        if !self.first {
+            match self.scanner.peek() {
+                Some(b',') => self.scanner.pos += 1,
+                Some(b']') => {
+                    self.done = true;
+                    self.scanner.pos += 1;
+                    return self.scanner.end().err().map(Err);
+                }
+                Some(_) => {
+                    self.done = true;
+                    return Some(Err(JsonError::UnexpectedByte(self.scanner.pos)));
+                }
+                None => {
+                    self.done = true;
+                    return Some(Err(JsonError::UnexpectedEnd));
+                }
+            }
+        }
+        self.first = false;
+        let element = self.scanner.raw_value();
+        self.done = element.is_err();
+        Some(element)
+    }
+}
+
+/// A JSON array of numbers, validated once and then read lazily from the
+/// request: iterating re-scans the raw slice, so no element is ever stored.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Numbers<'a> {
+    raw: &'a str,
+    len: usize,
+}
+
+impl<'a> Numbers<'a> {
+    /// `None` unless `raw` is an array whose elements are all numbers.
+    pub fn new(raw: &'a str) -> Option<Self> {
+        let mut len = 0;
+        for element in array_elements(raw).ok()? {
+            crate::num::parse_f32(element.ok()?)?;
+            len += 1;
+        }
+        Some(Self { raw, len })
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = f32> + 'a {
+        array_elements(self.raw)
+            .into_iter()
+            .flatten()
+            .filter_map(|element| crate::num::parse_f32(element.ok()?))
+    }
+}
+
+pub(crate) struct Scanner<'a> {
+    src: &'a str,
+    pos: usize,
+}
+
+impl<'a> Scanner<'a> {
+    pub(crate) fn new(src: &'a str) -> Self {
+        Self { src, pos: 0 }
+    }
+
+    fn bytes(&self) -> &'a [u8] {
+        self.src.as_bytes()
+    }
+
+    pub(crate) fn peek(&mut self) -> Option<u8> {
+        self.skip_ws();
+        self.bytes().get(self.pos).copied()
+    }
+
+    fn skip_ws(&mut self) {
+        while let Some(b' ' | b'\t' | b'\r' | b'\n') = self.bytes().get(self.pos) {
+            self.pos += 1;
+        }
+    }
+
+    /// Only whitespace may follow the value just scanned.
+    fn end(&mut self) -> Result<(), JsonError> {
+        match self.peek() {
+            Some(_) => Err(JsonError::UnexpectedByte(self.pos)),
+            None => Ok(()),
+        }
+    }
+
+    fn expect(&mut self, byte: u8) -> Result<(), JsonError> {
+        match self.peek() {
+            Some(b) if b == byte => {
+                self.pos += 1;
+                Ok(())
+            }
+            Some(_) => Err(JsonError::UnexpectedByte(self.pos)),
+            None => Err(JsonError::UnexpectedEnd),
+        }
+    }
+
+    /// Raw contents of the string at the cursor, without the quotes.
+    pub(crate) fn string(&mut self) -> Result<&'a str, JsonError> {
+        self.expect(b'"')?;
+        let start = self.pos;
+        let bytes = self.bytes();
+        while let Some(&b) = bytes.get(self.pos) {
+            match b {
+                b'"' => {
+                    self.pos += 1;
+                    return Ok(&self.src[start..self.pos - 1]);
+                }
+                b'\\' => self.pos += 2,
+                _ => self.pos += 1,
+            }
+        }
+        Err(JsonError::UnexpectedEnd)
+    }
+
+    pub(crate) fn value(&mut self) -> Result<Value<'a>, JsonError> {
+        match self.peek().ok_or(JsonError::UnexpectedEnd)? {
+            b'"' => self.string().map(Value::Str),
+            b'{' => self.container().map(Value::Object),
+            b'[' => self.container().map(Value::Array),
+            b't' => self.literal("true", Value::Bool(true)),
+            b'f' => self.literal("false", Value::Bool(false)),
+            b'n' => self.literal("null", Value::Null),
+            b'-' | b'0'..=b'9' => self.number().map(Value::Num),
+            _ => Err(JsonError::UnexpectedByte(self.pos)),
+        }
+    }
+
+    /// The number at the cursor, as JSON's grammar allows it: a minus sign,
+    /// then a lone zero or digits without a leading zero, then an optional
+    /// fraction and exponent.
+    fn number(&mut self) -> Result<&'a str, JsonError> {
+        let start = self.pos;
+        self.skip(b"-");
+        match self.bytes().get(self.pos) {
+            Some(b'0') => self.pos += 1,
+            _ => self.digits()?,
+        }
+        if self.skip(b".") {
+            self.digits()?;
+        }
+        if self.skip(b"eE") {
+            self.skip(b"+-");
+            self.digits()?;
+        }
+        Ok(&self.src[start..self.pos])
+    }
+
+    /// Step over the byte at the cursor if it's one of `any`.
+    fn skip(&mut self, any: &[u8]) -> bool {
+        let found = self.bytes().get(self.pos).is_some_and(|b| any.contains(b));
+        self.pos += found as usize;
+        found
+    }
+
+    /// One or more digits.
+    fn digits(&mut self) -> Result<(), JsonError> {
+        let start = self.pos;
+        while let Some(b'0'..=b'9') = self.bytes().get(self.pos) {
+            self.pos += 1;
+        }
+        if self.pos > start {
+            return Ok(());
+        }
+        match self.bytes().get(self.pos) {
+            Some(_) => Err(JsonError::UnexpectedByte(self.pos)),
+            None => Err(JsonError::UnexpectedEnd),
+        }
+    }
+
+    /// The exact source slice of the value at the cursor.
+    pub(crate) fn raw_value(&mut self) -> Result<&'a str, JsonError> {
+        self.skip_ws();
+        let start = self.pos;
+        self.value()?;
+        Ok(&self.src[start..self.pos])
+    }
+
+    fn literal(&mut self, word: &str, value: Value<'a>) -> Result<Value<'a>, JsonError> {
+        if self.src[self.pos..].starts_with(word) {
+            self.pos += word.len();
+            Ok(value)
+        } else {
+            Err(JsonError::UnexpectedByte(self.pos))
+        }
+    }
+
+    /// Skip a whole array or object, returning its raw slice. Each closing
+    /// bracket must match the innermost open one.
+    fn container(&mut self) -> Result<&'a str, JsonError> {
+        let start = self.pos;
+        let bytes = self.bytes();
+        // Bit n is set if the nth innermost open level is an object
+        let mut objects = 0u64;
+        let mut depth = 0;
+        while let Some(&b) = bytes.get(self.pos) {
+            match b {
+                b'"' => {
+                    self.string()?;
+                    continue;
+                }
+                b'{' | b'[' if depth < MAX_DEPTH => {
+                    objects = objects << 1 | (b == b'{') as u64;
+                    depth += 1;
+                }
+                b'{' | b'[' => return Err(JsonError::UnexpectedByte(self.pos)),
+                b'}' | b']' => {
+                    if (objects & 1 == 1) != (b == b'}') {
+                        return Err(JsonError::UnexpectedByte(self.pos));
+                    }
+                    objects >>= 1;
+                    depth -= 1;
+                    if depth == 0 {
+                        self.pos += 1;
+                        return Ok(&self.src[start..self.pos]);
+                    }
+                }
+                _ => {}
+            }
+            self.pos += 1;
+        }
+        Err(JsonError::UnexpectedEnd)
+    }
+
+    /// Walk the members of the object at the cursor. `member` is called with
+    /// each key and must consume exactly that member's value.
+    pub(crate) fn object<F>(&mut self, mut member: F) -> Result<(), JsonError>
+    where
+        F: FnMut(&mut Self, &'a str) -> Result<(), JsonError>,
+    {
+        self.expect(b'{')?;
+        if self.peek() == Some(b'}') {
+            self.pos += 1;
+            return Ok(());
+        }
+        loop {
+            let key = self.string()?;
+            self.expect(b':')?;
+            member(self, key)?;
+            match self.peek() {
+                Some(b',') => self.pos += 1,
+                Some(b'}') => {
+                    self.pos += 1;
+                    return Ok(());
+                }
+                Some(_) => return Err(JsonError::UnexpectedByte(self.pos)),
+                None => return Err(JsonError::UnexpectedEnd),
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    extern crate std;
+
+    use super::*;
+    use std::format;
+
+    #[test]
+    fn reads_name_and_arguments() {
+        let raw = r#"{"jsonrpc":"2.0","id":1,"method":"tools/call",
+            "params":{"name":"compute_add","arguments":{"a":2,"b":-3.5e1}}}"#;
+        let call = parse_tool_call(raw).unwrap();
+        assert_eq!(call.name, "compute_add");
+        assert_eq!(call.arguments.get("a"), Some(Value::Num("2")));
+        assert_eq!(call.arguments.get("b"), Some(Value::Num("-3.5e1")));
+    }
+
+    #[test]
+    fn ignores_keys_inside_string_values() {
+        let raw = r#"{"id":"\"name\":\"evil\"","params":{"arguments":{"s":"\"name\":1}"},"name":"real"}}"#;
+        let call = parse_tool_call(raw).unwrap();
+        assert_eq!(call.name, "real");
+        assert_eq!(call.arguments.get("s"), Some(Value::Str(r#"\"name\":1}"#)));
+        assert_eq!(call.arguments.get("name"), None);
+    }
+
+    #[test]
+    fn keeps_escaped_keys_raw() {
+        let raw = r#"{"params":{"name":"t","arguments":{"k\"ey":1,"a\\":2}}}"#;
+        let call = parse_tool_call(raw).unwrap();
+        assert_eq!(call.arguments.get(r#"k\"ey"#), Some(Value::Num("1")));
+        assert_eq!(call.arguments.get(r#"a\\"#), Some(Value::Num("2")));
+    }
+
+    #[test]
+    fn skips_nested_values_whole() {
+        let raw = r#"{"meta":{"a":[1,{"b":["]","}"]}],"c":{}},
+            "params":{"name":"t","arguments":{"o":{"x":[[],{}]},"n":[1,[2]]}}}"#;
+        let call = parse_tool_call(raw).unwrap();
+        assert_eq!(call.name, "t");
+        assert_eq!(
+            call.arguments.get("o"),
+            Some(Value::Object(r#"{"x":[[],{}]}"#))
+        );
+        assert_eq!(call.arguments.get("n"), Some(Value::Array("[1,[2]]")));
+    }
+
+    #[test]
+    fn rejects_mismatched_brackets() {
+        for value in [r#"{"a":[1}]"#, "[1}", r#"{"a":1]"#, "[[]}", r#"[{]}"#] {
+            let raw = format!(r#"{{"params":{{"name":"t","arguments":{{"v":{value}}}}}}}"#);
+            assert!(parse_tool_call(&raw).is_err(), "{raw}");
+        }
+    }
+
+    #[test]
+    fn limits_nesting() {
+        let deep = |depth| format!("{}{}", "[".repeat(depth), "]".repeat(depth));
+        let raw =
+            |value: &str| format!(r#"{{"params":{{"name":"t","arguments":{{"v":{value}}}}}}}"#);
+        assert!(parse_tool_call(&raw(&deep(MAX_DEPTH as usize))).is_ok());
+        assert!(parse_tool_call(&raw(&deep(MAX_DEPTH as usize + 1))).is_err());
+    }
+
+    #[test]
+    fn scans_numbers_by_the_grammar() {
+        for number in ["0", "-0", "12", "-1.5", "1e5", "1E+5", "2.5e-3", "0.0"] {
+            let raw = format!(r#"{{"params":{{"name":"t","arguments":{{"v":{number}}}}}}}"#);
+            assert_eq!(
+                parse_tool_call(&raw).unwrap().arguments.get("v"),
+                Some(Value::Num(number))
+            );
+        }
+        for number in [
+            "-", "--1", "1-2", "1e", "1e+", "1.", ".5", "01", "+1", "1.e5", "1ee5",
+        ] {
+            let raw = format!(r#"{{"params":{{"name":"t","arguments":{{"v":{number}}}}}}}"#);
+            assert!(parse_tool_call(&raw).is_err(), "{number}");
+        }
+    }
+
+    #[test]
+    fn rejects_trailing_garbage() {
+        let raw = r#"{"params":{"name":"t","arguments":{}}}"#;
+        assert!(parse_tool_call(raw).is_ok());
+        assert!(parse_tool_call(&format!("{raw} \n")).is_ok());
+        assert!(parse_tool_call(&format!("{raw}}}")).is_err());
+        assert!(parse_tool_call(&format!("{raw}x")).is_err());
+
+        assert_eq!(array_elements("[1, 2] ").unwrap().count(), 2);
+        assert!(array_elements("[1, 2]]").unwrap().any(|e| e.is_err()));
+        assert!(array_elements("[] x").is_err());
+    }
+}
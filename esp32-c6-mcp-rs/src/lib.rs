@@ -1,3 +1,17 @@
 #![no_std]
 
+pub mod buffers;
+pub mod cbor;
+pub mod connections;
+pub mod dispatch;
+pub mod framing;
+pub mod hal;
+pub mod json;
 pub mod mcp;
+pub mod num;
+pub mod output;
+pub mod registry;
+pub mod rpc;
+pub mod server;
+pub mod telemetry;
+pub mod trace;
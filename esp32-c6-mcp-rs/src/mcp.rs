@@ -1,9 +1,18 @@
+use crate::cbor;
+use crate::hal;
+use crate::json::{initialize_offers, parse_tool_call};
+use crate::num::Shortest;
+use crate::output::{text_content, Series};
+use crate::registry::invalid_params;
+use crate::registry::mcp_tools;
+use crate::telemetry::{Bssid, Ipv4, OrUnknown, Rssi};
 use heapless::String;
 use serde::{Deserialize, Serialize};
 
-pub const MAX_JSON_SIZE: usize = 3072; // Carefully sized for ESP32-C6 memory constraints
+// Sized at build time, see build.rs and `buffers`
+pub const MAX_JSON_SIZE: usize = crate::buffers::MCP_FRAME_BUFFER_SIZE;
 pub const MAX_PARAMS_SIZE: usize = 512;
-pub const MAX_RESULT_SIZE: usize = 1024;
+pub const MAX_RESULT_SIZE: usize = crate::buffers::MCP_RESULT_BUFFER_SIZE;
 
 #[derive(Debug, Serialize, Deserialize)]
 pub struct McpRequest {
@@ -14,15 +23,13 @@ pub struct McpRequest {
     pub params: Option<()>,
 }
 
-extern crate alloc;
-use alloc::string::String as StdString;
-
-// Simple response struct - we'll handle JSON serialization manually
+// Simple response struct - we'll handle JSON serialization manually.
+// `result` borrows either a static string or the caller's result buffer.
 #[derive(Debug)]
-pub struct McpResponse {
+pub struct McpResponse<'b> {
     pub jsonrpc: String<16>,
     pub id: Option<u32>,
-    pub result: Option<StdString>,
+    pub result: Option<&'b str>,
     pub error: Option<McpError>,
 }
 
@@ -32,39 +39,6 @@ pub struct McpError {
     pub message: String<128>,
 }
 
-#[derive(Debug, Serialize, Deserialize)]
-pub struct WifiStatusParams {
-    #[serde(default)]
-    pub detailed: bool,
-}
-
-#[derive(Debug, Serialize, Deserialize)]
-pub struct ToolCallParams {
-    pub name: String<32>,
-    #[serde(default)]
-    pub arguments: Option<WifiStatusParams>,
-}
-
-#[derive(Debug, Serialize, Deserialize)]
-pub struct SmartLedParams {
-    #[serde(default)]
-    pub color: Option<String<16>>, // "red", "green", "blue", "off"
-    #[serde(default)]
-    pub r: Option<u8>,
-    #[serde(default)]
-    pub g: Option<u8>,
-    #[serde(default)]
-    pub b: Option<u8>,
-    #[serde(default)]
-    pub brightness: Option<u8>, // 0-100
-}
-
-#[derive(Debug, Serialize, Deserialize)]
-pub struct ComputeParams {
-    pub a: f32,
-    pub b: f32,
-}
-
 #[derive(Debug, Serialize)]
 pub struct WifiStatusResult {
     pub connected: bool,
@@ -73,11 +47,17 @@ pub struct WifiStatusResult {
     pub ssid: Option<String<32>>,
 }
 
-pub fn handle_mcp_request(request: &McpRequest, raw_json: &str) -> McpResponse {
+/// Handle a request, writing any dynamic result into `out`. Constant results
+/// (initialize, tools/list, fixed tool replies) never touch the buffer.
+pub fn handle_mcp_request<'b>(
+    request: &McpRequest,
+    raw_json: &str,
+    out: &'b mut [u8],
+) -> McpResponse<'b> {
     let result = match request.method.as_str() {
-        "initialize" => handle_initialize(),
+        "initialize" => handle_initialize(raw_json),
         "tools/list" => handle_tools_list(),
-        "tools/call" => handle_tools_call(raw_json),
+        "tools/call" => handle_tools_call(raw_json, out),
         _ => Err(McpError {
             code: -32601,
             message: String::try_from("Method not found").unwrap_or_else(|_| String::new()),
@@ -100,21 +80,50 @@ pub fn handle_mcp_request(request: &McpRequest, raw_json: &str) -> McpResponse {
     }
 }
 
-fn handle_initialize() -> Result<StdString, McpError> {
-    let response = r#"{"protocolVersion":"2024-11-05","capabilities":{"tools":{"listChanged":false}},"serverInfo":{"name":"esp32-c6-mcp","version":"0.1.0"}}"#;
-    Ok(StdString::from(response))
+fn handle_initialize(raw_json: &str) -> Result<&'static str, McpError> {
+    // Accepting CBOR framing switches the connection once this reply is sent,
+    // see `cbor` and `server`
+    if initialize_offers(raw_json, cbor::CAPABILITY) {
+        return Ok(INITIALIZE_CBOR_RESULT);
+    }
+    Ok(INITIALIZE_RESULT)
 }
 
-fn handle_tools_list() -> Result<StdString, McpError> {
-    // Compact JSON response to fit ESP32-C6 memory constraints
-    let response = r#"{"tools":[{"name":"wifi_status","description":"Get WiFi status","inputSchema":{"type":"object","properties":{"detailed":{"type":"boolean"}}}},{"name":"led_control","description":"Control LED","inputSchema":{"type":"object","properties":{"color":{"type":"string","enum":["red","green","blue","yellow","magenta","cyan","white","off"]},"r":{"type":"integer","minimum":0,"maximum":255},"g":{"type":"integer","minimum":0,"maximum":255},"b":{"type":"integer","minimum":0,"maximum":255},"brightness":{"type":"integer","minimum":0,"maximum":100}}}},{"name":"compute_add","description":"Add numbers","inputSchema":{"type":"object","properties":{"a":{"type":"number"},"b":{"type":"number"}},"required":["a","b"]}},{"name":"compute_multiply","description":"Multiply numbers","inputSchema":{"type":"object","properties":{"a":{"type":"number"},"b":{"type":"number"}},"required":["a","b"]}}]}"#;
-    Ok(StdString::from(response))
+/// Whether `response` accepts CBOR framing. The connection switches only
+/// once such a reply has been written.
+pub fn accepts_cbor(response: &McpResponse<'_>) -> bool {
+    response.result == Some(INITIALIZE_CBOR_RESULT)
 }
 
-// Global LED command sender - will be set by main.rs
-use core::sync::atomic::{AtomicPtr, Ordering};
-use embassy_sync::blocking_mutex::raw::CriticalSectionRawMutex;
-use embassy_sync::channel::Sender;
+/// Turn down CBOR framing in `response`, for an initialize the connection
+/// can't switch after.
+pub fn refuse_cbor(response: &mut McpResponse<'_>) {
+    if accepts_cbor(response) {
+        response.result = Some(INITIALIZE_RESULT);
+    }
+}
+
+// The bridge caches initialize and tools/list replies per serverInfo
+// version, so bump the crate version when the tools change
+const INITIALIZE_RESULT: &str = concat!(
+    r#"{"protocolVersion":"2024-11-05","capabilities":{"tools":{"listChanged":false}},"#,
+    r#""serverInfo":{"name":"esp32-c6-mcp","version":""#,
+    env!("CARGO_PKG_VERSION"),
+    r#""}}"#
+);
+// Echoes `cbor::CAPABILITY`
+const INITIALIZE_CBOR_RESULT: &str = concat!(
+    r#"{"protocolVersion":"2024-11-05","capabilities":{"tools":{"listChanged":false},"#,
+    r#""experimental":{"cborFraming":{}}},"#,
+    r#""serverInfo":{"name":"esp32-c6-mcp","version":""#,
+    env!("CARGO_PKG_VERSION"),
+    r#""}}"#
+);
+
+fn handle_tools_list() -> Result<&'static str, McpError> {
+    // Generated at compile time from the tool declarations below
+    Ok(TOOLS_LIST)
+}
 
 #[derive(Debug, Clone)]
 pub enum LedCommand {
@@ -122,152 +131,117 @@ pub enum LedCommand {
     Off,
 }
 
-static LED_SENDER: AtomicPtr<Sender<'static, CriticalSectionRawMutex, LedCommand, 4>> =
-    AtomicPtr::new(core::ptr::null_mut());
-
-pub fn set_led_sender(sender: &'static Sender<'static, CriticalSectionRawMutex, LedCommand, 4>) {
-    LED_SENDER.store(sender as *const _ as *mut _, Ordering::Relaxed);
+fn send_led_command(cmd: LedCommand) -> Result<(), &'static str> {
+    hal::led_sink().ok_or("LED sink not initialized")?.send(cmd)
 }
 
-fn send_led_command(cmd: LedCommand) -> Result<(), &'static str> {
-    let sender_ptr = LED_SENDER.load(Ordering::Relaxed);
-    if sender_ptr.is_null() {
-        return Err("LED sender not initialized");
+fn handle_tools_call<'b>(raw_json: &str, out: &'b mut [u8]) -> Result<&'b str, McpError> {
+    // Walk the request once; handlers read their arguments from this parse
+    let call = parse_tool_call(raw_json).map_err(|_| McpError {
+        code: -32602,
+        message: String::try_from("Invalid params").unwrap_or_else(|_| String::new()),
+    })?;
+
+    match TOOLS.lookup(call.name) {
+        Some(tool) => (tool.handler)(&call.arguments, out),
+        None => Err(McpError {
+            code: -32601,
+            message: String::try_from("Tool not found").unwrap_or_else(|_| String::new()),
+        }),
     }
+}
 
-    let sender =
-        unsafe { &*(sender_ptr as *const Sender<'static, CriticalSectionRawMutex, LedCommand, 4>) };
+// Each tool is declared once; the tools/list schema, argument decoders and
+// dispatch table are all generated from these declarations.
+// Keep SLOTS at least twice the tool count so the seed search stays short.
+mcp_tools! {
+    pub(crate) static TOOLS: ToolTable<16>;
+    const TOOLS_LIST;
 
-    match sender.try_send(cmd) {
-        Ok(()) => Ok(()),
-        Err(_) => Err("LED command queue full"),
+    tool "wifi_status" ("Get WiFi status") [read_only] => handle_wifi_status(WifiStatusArgs) {
+        optional detailed: bool = false,
     }
-}
 
-fn handle_tools_call(raw_json: &str) -> Result<StdString, McpError> {
-    // Look for different tool names in the raw JSON
-
-    if raw_json.contains("\"name\":\"wifi_status\"") {
-        // Check if detailed flag is set
-        let detailed = raw_json.contains("\"detailed\":true");
-
-        let response = if detailed {
-            r#"{"content":[{"type":"text","text":"WiFi Status (Detailed):\n- Connected: true\n- IP: 192.168.32.87\n- RSSI: -45 dBm\n- SSID: MyWiFiNetwork\n- Channel: 6"}]}"#
-        } else {
-            r#"{"content":[{"type":"text","text":"WiFi Status:\n- Connected: true\n- IP: 192.168.32.87"}]}"#
-        };
-
-        Ok(StdString::from(response))
-    } else if raw_json.contains("\"name\":\"led_control\"") {
-        handle_led_control(raw_json)
-    } else if raw_json.contains("\"name\":\"compute_add\"") {
-        handle_compute_add(raw_json)
-    } else if raw_json.contains("\"name\":\"compute_multiply\"") {
-        handle_compute_multiply(raw_json)
-    } else {
-        Err(McpError {
-            code: -32601,
-            message: String::try_from("Tool not found").unwrap_or_else(|_| String::new()),
-        })
+    tool "led_control" ("Control LED") [idempotent] => handle_led_control(LedControlArgs) {
+        optional color: str ["red", "green", "blue", "yellow", "magenta", "cyan", "white", "off"],
+        optional r: u8 [0, 255] = 255,
+        optional g: u8 [0, 255] = 255,
+        optional b: u8 [0, 255] = 255,
+        optional brightness: u8 [0, 100] = 20,
     }
-}
 
-fn handle_led_control(raw_json: &str) -> Result<StdString, McpError> {
-    // Parse LED control parameters from JSON
-    let mut r = 255u8;
-    let mut g = 255u8;
-    let mut b = 255u8;
-    let mut brightness = 20u8; // Default to 20% brightness
-    let mut color_set = false;
-
-    // Check for predefined colors first
-    if raw_json.contains("\"color\":\"red\"") {
-        r = 255;
-        g = 0;
-        b = 0;
-        color_set = true;
-    } else if raw_json.contains("\"color\":\"green\"") {
-        r = 0;
-        g = 255;
-        b = 0;
-        color_set = true;
-    } else if raw_json.contains("\"color\":\"blue\"") {
-        r = 0;
-        g = 0;
-        b = 255;
-        color_set = true;
-    } else if raw_json.contains("\"color\":\"yellow\"") {
-        r = 255;
-        g = 255;
-        b = 0;
-        color_set = true;
-    } else if raw_json.contains("\"color\":\"magenta\"") {
-        r = 255;
-        g = 0;
-        b = 255;
-        color_set = true;
-    } else if raw_json.contains("\"color\":\"cyan\"") {
-        r = 0;
-        g = 255;
-        b = 255;
-        color_set = true;
-    } else if raw_json.contains("\"color\":\"white\"") {
-        r = 255;
-        g = 255;
-        b = 255;
-        color_set = true;
-    } else if raw_json.contains("\"color\":\"off\"") {
-        if let Err(e) = send_led_command(LedCommand::Off) {
-            return Err(McpError {
-                code: -32603,
-                message: String::try_from(e).unwrap_or_else(|_| String::new()),
-            });
-        }
-        return Ok(StdString::from(
-            r#"{"content":[{"type":"text","text":"LED turned off"}]}"#,
-        ));
+    tool "compute_add" ("Add numbers") [read_only] => handle_compute_add(ComputeAddArgs) {
+        required a: number,
+        required b: number,
     }
 
-    // Parse individual RGB components if not using predefined color
-    if !color_set {
-        // Simple regex-free parsing for r, g, b values
-        if let Some(r_start) = raw_json.find("\"r\":") {
-            let r_start = r_start + 4;
-            if let Some(r_end) = raw_json[r_start..].find([',', '}']) {
-                if let Ok(parsed_r) = raw_json[r_start..r_start + r_end].trim().parse::<u8>() {
-                    r = parsed_r;
-                }
-            }
-        }
+    tool "compute_multiply" ("Multiply numbers") [read_only] => handle_compute_multiply(ComputeMultiplyArgs) {
+        required a: number,
+        required b: number,
+    }
 
-        if let Some(g_start) = raw_json.find("\"g\":") {
-            let g_start = g_start + 4;
-            if let Some(g_end) = raw_json[g_start..].find([',', '}']) {
-                if let Ok(parsed_g) = raw_json[g_start..g_start + g_end].trim().parse::<u8>() {
-                    g = parsed_g;
-                }
-            }
-        }
+    tool "compute_batch" ("Vector math over number arrays: add, mul and dot pair a with b; sum, min, max and mean reduce a; scale multiplies a by factor") [read_only] => handle_compute_batch(ComputeBatchArgs) {
+        required op: str ["add", "mul", "dot", "sum", "min", "max", "mean", "scale"],
+        required a: numbers,
+        optional b: numbers,
+        optional factor: f32,
+    }
+}
 
-        if let Some(b_start) = raw_json.find("\"b\":") {
-            let b_start = b_start + 4;
-            if let Some(b_end) = raw_json[b_start..].find([',', '}']) {
-                if let Ok(parsed_b) = raw_json[b_start..b_start + b_end].trim().parse::<u8>() {
-                    b = parsed_b;
-                }
-            }
-        }
+fn handle_wifi_status<'b>(args: &WifiStatusArgs, out: &'b mut [u8]) -> Result<&'b str, McpError> {
+    // A snapshot published by the WiFi task; reading never blocks
+    let wifi = hal::wifi_source()
+        .map(|source| source.snapshot())
+        .unwrap_or_default();
+
+    if !args.detailed {
+        return text_content(
+            out,
+            format_args!(
+                "WiFi Status:\n- Connected: {}\n- IP: {}",
+                wifi.connected,
+                Ipv4(wifi.ipv4)
+            ),
+        );
     }
 
-    // Parse brightness
-    if let Some(br_start) = raw_json.find("\"brightness\":") {
-        let br_start = br_start + 13;
-        if let Some(br_end) = raw_json[br_start..].find([',', '}']) {
-            if let Ok(parsed_br) = raw_json[br_start..br_start + br_end].trim().parse::<u8>() {
-                brightness = parsed_br.min(100);
+    text_content(
+        out,
+        format_args!(
+            "WiFi Status (Detailed):\n- Connected: {}\n- IP: {}\n- RSSI: {}\n- SSID: {}\n- Channel: {}\n- BSSID: {}\n- Reconnects: {}",
+            wifi.connected,
+            Ipv4(wifi.ipv4),
+            Rssi(wifi.rssi),
+            wifi.ssid.as_str(),
+            OrUnknown(wifi.channel),
+            Bssid(wifi.bssid),
+            wifi.reconnects
+        ),
+    )
+}
+
+fn handle_led_control<'b>(args: &LedControlArgs, out: &'b mut [u8]) -> Result<&'b str, McpError> {
+    // Predefined colors take precedence over individual RGB components
+    let (r, g, b) = match args.color {
+        Some("red") => (255, 0, 0),
+        Some("green") => (0, 255, 0),
+        Some("blue") => (0, 0, 255),
+        Some("yellow") => (255, 255, 0),
+        Some("magenta") => (255, 0, 255),
+        Some("cyan") => (0, 255, 255),
+        Some("white") => (255, 255, 255),
+        Some("off") => {
+            if let Err(e) = send_led_command(LedCommand::Off) {
+                return Err(McpError {
+                    code: -32603,
+                    message: String::try_from(e).unwrap_or_else(|_| String::new()),
+                });
             }
+            return Ok(r#"{"content":[{"type":"text","text":"LED turned off"}]}"#);
         }
-    }
+        _ => (args.r, args.g, args.b),
+    };
+    let brightness = args.brightness;
 
     // Send LED command
     if let Err(e) = send_led_command(LedCommand::SetColor {
@@ -282,82 +256,83 @@ fn handle_led_control(raw_json: &str) -> Result<StdString, McpError> {
         });
     }
 
-    let response = alloc::format!(
-        r#"{{"content":[{{"type":"text","text":"LED set to RGB({}, {}, {}) with {}% brightness"}}]}}"#,
-        r,
-        g,
-        b,
-        brightness
-    );
-    Ok(response)
+    text_content(
+        out,
+        format_args!(
+            "LED set to RGB({}, {}, {}) with {}% brightness",
+            r, g, b, brightness
+        ),
+    )
 }
 
-fn handle_compute_add(raw_json: &str) -> Result<StdString, McpError> {
-    // Parse a and b from JSON
-    let mut a = 0.0f32;
-    let mut b = 0.0f32;
-
-    // Parse 'a' parameter
-    if let Some(a_start) = raw_json.find("\"a\":") {
-        let a_start = a_start + 4;
-        if let Some(a_end) = raw_json[a_start..].find([',', '}']) {
-            if let Ok(parsed_a) = raw_json[a_start..a_start + a_end].trim().parse::<f32>() {
-                a = parsed_a;
-            }
-        }
-    }
-
-    // Parse 'b' parameter
-    if let Some(b_start) = raw_json.find("\"b\":") {
-        let b_start = b_start + 4;
-        if let Some(b_end) = raw_json[b_start..].find([',', '}']) {
-            if let Ok(parsed_b) = raw_json[b_start..b_start + b_end].trim().parse::<f32>() {
-                b = parsed_b;
-            }
-        }
-    }
+fn handle_compute_add<'b>(args: &ComputeAddArgs, out: &'b mut [u8]) -> Result<&'b str, McpError> {
+    let result = args.a + args.b;
+    text_content(out, format_args!("{} + {} = {}", args.a, args.b, result))
+}
 
-    let result = a + b;
-    let response = alloc::format!(
-        r#"{{"content":[{{"type":"text","text":"{} + {} = {}"}}]}}"#,
-        a,
-        b,
-        result
-    );
-    Ok(response)
+fn handle_compute_multiply<'b>(
+    args: &ComputeMultiplyArgs,
+    out: &'b mut [u8],
+) -> Result<&'b str, McpError> {
+    let result = args.a * args.b;
+    text_content(out, format_args!("{} × {} = {}", args.a, args.b, result))
 }
 
-fn handle_compute_multiply(raw_json: &str) -> Result<StdString, McpError> {
-    // Parse a and b from JSON
-    let mut a = 0.0f32;
-    let mut b = 0.0f32;
-
-    // Parse 'a' parameter
-    if let Some(a_start) = raw_json.find("\"a\":") {
-        let a_start = a_start + 4;
-        if let Some(a_end) = raw_json[a_start..].find([',', '}']) {
-            if let Ok(parsed_a) = raw_json[a_start..a_start + a_end].trim().parse::<f32>() {
-                a = parsed_a;
-            }
-        }
-    }
+fn handle_compute_batch<'b>(
+    args: &ComputeBatchArgs,
+    out: &'b mut [u8],
+) -> Result<&'b str, McpError> {
+    let a = args.a;
+    // Operands are streamed from the request each time they're iterated
+    let pair = || match args.b {
+        Some(b) if b.len() == a.len() => Ok(b),
+        _ => Err(invalid_params("Invalid params: b")),
+    };
+    let nonempty = || match a.is_empty() {
+        true => Err(invalid_params("Invalid params: a")),
+        false => Ok(a),
+    };
 
-    // Parse 'b' parameter
-    if let Some(b_start) = raw_json.find("\"b\":") {
-        let b_start = b_start + 4;
-        if let Some(b_end) = raw_json[b_start..].find([',', '}']) {
-            if let Ok(parsed_b) = raw_json[b_start..b_start + b_end].trim().parse::<f32>() {
-                b = parsed_b;
-            }
+    match args.op {
+        "add" => {
+            let b = pair()?;
+            let sums = Series(|| a.iter().zip(b.iter()).map(|(x, y)| x + y));
+            text_content(out, format_args!("add = {}", sums))
+        }
+        "mul" => {
+            let b = pair()?;
+            let products = Series(|| a.iter().zip(b.iter()).map(|(x, y)| x * y));
+            text_content(out, format_args!("mul = {}", products))
         }
+        "dot" => {
+            let b = pair()?;
+            let dot = a.iter().zip(b.iter()).fold(0.0, |s, (x, y)| s + x * y);
+            text_content(out, format_args!("dot = {}", Shortest(dot)))
+        }
+        "sum" => {
+            let sum = a.iter().fold(0.0, |s, x| s + x);
+            text_content(out, format_args!("sum = {}", Shortest(sum)))
+        }
+        "min" => {
+            let min = nonempty()?.iter().fold(f32::INFINITY, f32::min);
+            text_content(out, format_args!("min = {}", Shortest(min)))
+        }
+        "max" => {
+            let max = nonempty()?.iter().fold(f32::NEG_INFINITY, f32::max);
+            text_content(out, format_args!("max = {}", Shortest(max)))
+        }
+        "mean" => {
+            let mean = nonempty()?.iter().fold(0.0, |s, x| s + x) / a.len() as f32;
+            text_content(out, format_args!("mean = {}", Shortest(mean)))
+        }
+        "scale" => {
+            let factor = args
+                .factor
+                .ok_or_else(|| invalid_params("Invalid params: factor"))?;
+            let scaled = Series(|| a.iter().map(move |x| x * factor));
+            text_content(out, format_args!("scale = {}", scaled))
+        }
+        // The decoder only accepts the ops above
+        _ => Err(invalid_params("Invalid params: op")),
     }
-
-    let result = a * b;
-    let response = alloc::format!(
-        r#"{{"content":[{{"type":"text","text":"{} × {} = {}"}}]}}"#,
-        a,
-        b,
-        result
-    );
-    Ok(response)
 }
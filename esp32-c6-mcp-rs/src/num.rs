@@ -0,0 +1,610 @@
+// Number codec for the compute tools.
+//
+// The ESP32-C6 has no FPU, so every f32 operation is a soft-float call and
+// core's float parsing and formatting are large and slow. Parsing here takes
+// an exact fast path for the short decimals tools actually receive and only
+// falls back to `str::parse` for long or extreme inputs. Printing uses Ryu,
+// which finds the shortest digits that round-trip using 32/64-bit integer
+// arithmetic only. Integral arguments skip floats entirely: `Number` keeps them
+// as i64, so sums and products of integers are exact.
+
+use core::fmt;
+use core::ops::{Add, Mul};
+
+/// A numeric tool argument. Integer literals stay exact as long as they and
+/// the results computed from them fit in an i64.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum Number {
+    Int(i64),
+    Float(f32),
+}
+
+impl Number {
+    /// Parse a JSON number literal; `None` if `raw` isn't one.
+    pub fn parse(raw: &str) -> Option<Self> {
+        let decimal = Decimal::scan(raw)?;
+        match decimal.integer() {
+            Some(value) => Some(Number::Int(value)),
+            None => decimal.to_f32(raw).map(Number::Float),
+        }
+    }
+
+    pub fn to_f32(self) -> f32 {
+        match self {
+            Number::Int(value) => value as f32,
+            Number::Float(value) => value,
+        }
+    }
+}
+
+impl Add for Number {
+    type Output = Number;
+
+    fn add(self, other: Number) -> Number {
+        match (self, other) {
+            (Number::Int(a), Number::Int(b)) => match a.checked_add(b) {
+                Some(sum) => Number::Int(sum),
+                None => Number::Float(a as f32 + b as f32),
+            },
+            _ => Number::Float(self.to_f32() + other.to_f32()),
+        }
+    }
+}
+
+impl Mul for Number {
+    type Output = Number;
+
+    fn mul(self, other: Number) -> Number {
+        match (self, other) {
+            (Number::Int(a), Number::Int(b)) => match a.checked_mul(b) {
+                Some(product) => Number::Int(product),
+                None => Number::Float(a as f32 * b as f32),
+            },
+            _ => Number::Float(self.to_f32() * other.to_f32()),
+        }
+    }
+}
+
+impl fmt::Display for Number {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match *self {
+            Number::Int(value) => fmt::Display::fmt(&value, f),
+            Number::Float(value) => fmt::Display::fmt(&Shortest(value), f),
+        }
+    }
+}
+
+/// Parse a JSON number literal as an f32, rounded correctly.
+pub fn parse_f32(raw: &str) -> Option<f32> {
+    Decimal::scan(raw)?.to_f32(raw)
+}
+
+// Powers of ten that are exact in an f32 (5^10 < 2^24)
+const EXACT_POWERS_OF_TEN: [f32; 11] = [1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10];
+
+// Largest integer below which every integer is exact in an f32
+const EXACT_MANTISSA: u64 = 1 << 24;
+
+// Digits are accumulated while another one still fits in a u64
+const MANTISSA_LIMIT: u64 = 1_000_000_000_000_000_000;
+
+/// A validated JSON number literal as `mantissa × 10^exponent`. The
+/// mantissa keeps the first 19 significant digits.
+pub(crate) struct Decimal {
+    pub(crate) negative: bool,
+    pub(crate) mantissa: u64,
+    pub(crate) exponent: i32,
+    /// No non-zero digit was dropped from `mantissa`.
+    pub(crate) exact: bool,
+    /// Written without a fraction or exponent.
+    pub(crate) integral: bool,
+}
+
+impl Decimal {
+    pub(crate) fn scan(raw: &str) -> Option<Self> {
+        let bytes = raw.as_bytes();
+        let negative = bytes.first() == Some(&b'-');
+        let mut pos = negative as usize;
+        let mut decimal = Decimal {
+            negative,
+            mantissa: 0,
+            exponent: 0,
+            exact: true,
+            integral: true,
+        };
+
+        // A lone zero or digits without a leading zero
+        match bytes.get(pos) {
+            Some(b'0') => pos += 1,
+            Some(b'1'..=b'9') => {
+                while let Some(&digit @ b'0'..=b'9') = bytes.get(pos) {
+                    decimal.push_digit(digit, false);
+                    pos += 1;
+                }
+            }
+            _ => return None,
+        }
+
+        if bytes.get(pos) == Some(&b'.') {
+            decimal.integral = false;
+            pos += 1;
+            let start = pos;
+            while let Some(&digit @ b'0'..=b'9') = bytes.get(pos) {
+                decimal.push_digit(digit, true);
+                pos += 1;
+            }
+            if pos == start {
+                return None;
+            }
+        }
+
+        if let Some(b'e' | b'E') = bytes.get(pos) {
+            decimal.integral = false;
+            pos += 1;
+            let negative_exponent = match bytes.get(pos) {
+                Some(b'-') => {
+                    pos += 1;
+                    true
+                }
+                Some(b'+') => {
+                    pos += 1;
+                    false
+                }
+                _ => false,
+            };
+            let start = pos;
+            let mut exponent: i32 = 0;
+            while let Some(&digit @ b'0'..=b'9') = bytes.get(pos) {
+                // Anything this large is already zero or infinite
+                exponent = (exponent * 10 + (digit - b'0') as i32).min(100_000);
+                pos += 1;
+            }
+            if pos == start {
+                return None;
+            }
+            decimal.exponent += if negative_exponent {
+                -exponent
+            } else {
+                exponent
+            };
+        }
+
+        (pos == bytes.len()).then_some(decimal)
+    }
+
+    fn push_digit(&mut self, digit: u8, fraction: bool) {
+        if self.mantissa < MANTISSA_LIMIT {
+            self.mantissa = self.mantissa * 10 + (digit - b'0') as u64;
+            if fraction {
+                self.exponent -= 1;
+            }
+        } else {
+            self.exact &= digit == b'0';
+            if !fraction {
+                self.exponent += 1;
+            }
+        }
+    }
+
+    fn integer(&self) -> Option<i64> {
+        // -0 is kept as a float so its sign survives
+        if !self.integral || self.exponent != 0 || (self.negative && self.mantissa == 0) {
+            return None;
+        }
+        // i64::MIN has no positive counterpart, so negatives count down
+        if self.negative {
+            0i64.checked_sub_unsigned(self.mantissa)
+        } else {
+            i64::try_from(self.mantissa).ok()
+        }
+    }
+
+    /// `raw` is the literal this was scanned from, for the slow path.
+    fn to_f32(&self, raw: &str) -> Option<f32> {
+        let magnitude = if self.mantissa == 0 {
+            0.0
+        } else if self.exact
+            && self.mantissa <= EXACT_MANTISSA
+            && (-10..=10).contains(&self.exponent)
+        {
+            // Both operands are exact, so the single rounding step of one
+            // multiply or divide gives the correctly rounded result
+            let mantissa = self.mantissa as f32;
+            let scale = EXACT_POWERS_OF_TEN[self.exponent.unsigned_abs() as usize];
+            if self.exponent < 0 {
+                mantissa / scale
+            } else {
+                mantissa * scale
+            }
+        } else {
+            return raw.parse().ok();
+        };
+        Some(if self.negative { -magnitude } else { magnitude })
+    }
+}
+
+/// Formats an f32 exactly as core's `Display` does (shortest round-trip
+/// digits, no exponent) without core's float formatting machinery.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Shortest(pub f32);
+
+// "-0." and up to 46 zeros before the digits is 49 bytes at most
+const MAX_SHORTEST_LEN: usize = 64;
+
+impl fmt::Display for Shortest {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let mut buf = [0u8; MAX_SHORTEST_LEN];
+        let len = write_shortest(self.0, &mut buf);
+        // Only ASCII is ever written
+        f.write_str(core::str::from_utf8(&buf[..len]).unwrap_or(""))
+    }
+}
+
+fn write_shortest(value: f32, buf: &mut [u8; MAX_SHORTEST_LEN]) -> usize {
+    let bits = value.to_bits();
+    let negative = bits >> 31 != 0;
+    let ieee_exponent = (bits >> FLOAT_MANTISSA_BITS) & 0xff;
+    let ieee_mantissa = bits & ((1 << FLOAT_MANTISSA_BITS) - 1);
+
+    let special: Option<&[u8]> = match (ieee_exponent, ieee_mantissa) {
+        (0xff, 0) if negative => Some(b"-inf"),
+        (0xff, 0) => Some(b"inf"),
+        (0xff, _) => Some(b"NaN"),
+        (0, 0) if negative => Some(b"-0"),
+        (0, 0) => Some(b"0"),
+        _ => None,
+    };
+    if let Some(text) = special {
+        buf[..text.len()].copy_from_slice(text);
+        return text.len();
+    }
+
+    let (mut digits, mut exponent) = shortest_decimal(ieee_mantissa, ieee_exponent);
+    while digits % 10 == 0 {
+        digits /= 10;
+        exponent += 1;
+    }
+
+    let mut len = 0;
+    if negative {
+        buf[0] = b'-';
+        len = 1;
+    }
+    let mut ascii = [0u8; 10];
+    let count = digits_to_ascii(digits, &mut ascii);
+    let digits = &ascii[ascii.len() - count..];
+    let mut push = |bytes: &[u8]| {
+        buf[len..len + bytes.len()].copy_from_slice(bytes);
+        len += bytes.len();
+    };
+
+    // Position of the decimal point relative to the first digit
+    let point = count as i32 + exponent;
+    if exponent >= 0 {
+        push(digits);
+        for _ in 0..exponent {
+            push(b"0");
+        }
+    } else if point > 0 {
+        push(&digits[..point as usize]);
+        push(b".");
+        push(&digits[point as usize..]);
+    } else {
+        push(b"0.");
+        for _ in 0..-point {
+            push(b"0");
+        }
+        push(digits);
+    }
+    len
+}
+
+/// Writes `value` right-aligned into `out`, returning the digit count.
+fn digits_to_ascii(mut value: u32, out: &mut [u8; 10]) -> usize {
+    let mut count = 0;
+    loop {
+        count += 1;
+        out[out.len() - count] = b'0' + (value % 10) as u8;
+        value /= 10;
+        if value == 0 {
+            return count;
+        }
+    }
+}
+
+// Ryu for f32 (Ulf Adams, PLDI 2018), after the reference f2s.c. The power
+// of five tables are generated at compile time instead of pasted in.
+
+const FLOAT_MANTISSA_BITS: u32 = 23;
+const FLOAT_BIAS: i32 = 127;
+const FLOAT_POW5_INV_BITCOUNT: i32 = 59;
+const FLOAT_POW5_BITCOUNT: i32 = 61;
+
+/// floor(2^k / 5^i) + 1 with k = pow5bits(i) - 1 + FLOAT_POW5_INV_BITCOUNT.
+const FLOAT_POW5_INV_SPLIT: [u64; 31] = {
+    let mut table = [0; 31];
+    let mut pow5: u128 = 1;
+    let mut i = 0;
+    while i < table.len() {
+        // 2^k reaches 2^128, so divide 2^k - 1 and correct the quotient
+        let k = pow5bits(i as i32) - 1 + FLOAT_POW5_INV_BITCOUNT;
+        let below = if k == 128 { u128::MAX } else { (1 << k) - 1 };
+        let quotient = below / pow5 + (below % pow5 + 1 == pow5) as u128;
+        table[i] = quotient as u64 + 1;
+        pow5 *= 5;
+        i += 1;
+    }
+    table
+};
+
+/// The top FLOAT_POW5_BITCOUNT bits of 5^i.
+const FLOAT_POW5_SPLIT: [u64; 48] = {
+    let mut table = [0; 48];
+    let mut pow5: u128 = 1;
+    let mut i = 0;
+    while i < table.len() {
+        let shift = pow5bits(i as i32) - FLOAT_POW5_BITCOUNT;
+        table[i] = if shift >= 0 {
+            (pow5 >> shift) as u64
+        } else {
+            (pow5 << -shift) as u64
+        };
+        pow5 *= 5;
+        i += 1;
+    }
+    table
+};
+
+/// Bit length of 5^e, for 0 <= e <= 3528.
+const fn pow5bits(e: i32) -> i32 {
+    ((e as u32 * 1217359) >> 19) as i32 + 1
+}
+
+/// floor(log10(2^e)), for 0 <= e <= 1650.
+fn log10_pow2(e: i32) -> u32 {
+    (e as u32 * 78913) >> 18
+}
+
+/// floor(log10(5^e)), for 0 <= e <= 2620.
+fn log10_pow5(e: i32) -> u32 {
+    (e as u32 * 732923) >> 20
+}
+
+fn pow5_factor(mut value: u32) -> u32 {
+    let mut count = 0;
+    while value % 5 == 0 {
+        value /= 5;
+        count += 1;
+    }
+    count
+}
+
+fn multiple_of_power_of_5(value: u32, p: u32) -> bool {
+    pow5_factor(value) >= p
+}
+
+/// (m × factor) >> shift, for shift > 32, without a 128-bit multiply.
+fn mul_shift(m: u32, factor: u64, shift: i32) -> u32 {
+    let low = m as u64 * (factor as u32) as u64;
+    let high = m as u64 * (factor >> 32);
+    (((low >> 32) + high) >> (shift - 32)) as u32
+}
+
+fn mul_pow5_inv_div_pow2(m: u32, q: u32, j: i32) -> u32 {
+    mul_shift(m, FLOAT_POW5_INV_SPLIT[q as usize], j)
+}
+
+fn mul_pow5_div_pow2(m: u32, i: u32, j: i32) -> u32 {
+    mul_shift(m, FLOAT_POW5_SPLIT[i as usize], j)
+}
+
+/// Shortest `(digits, exponent)` with digits × 10^exponent rounding back to
+/// the finite, non-zero f32 with these IEEE fields.
+fn shortest_decimal(ieee_mantissa: u32, ieee_exponent: u32) -> (u32, i32) {
+    // Two extra bits for the bounds computation
+    let (e2, m2) = if ieee_exponent == 0 {
+        (
+            1 - FLOAT_BIAS - FLOAT_MANTISSA_BITS as i32 - 2,
+            ieee_mantissa,
+        )
+    } else {
+        (
+            ieee_exponent as i32 - FLOAT_BIAS - FLOAT_MANTISSA_BITS as i32 - 2,
+            (1 << FLOAT_MANTISSA_BITS) | ieee_mantissa,
+        )
+    };
+    let accept_bounds = m2 & 1 == 0;
+
+    // The interval of decimals that round to this float
+    let mv = 4 * m2;
+    let mp = 4 * m2 + 2;
+    let mm_shift = (ieee_mantissa != 0 || ieee_exponent <= 1) as u32;
+    let mm = 4 * m2 - 1 - mm_shift;
+
+    let mut vr;
+    let mut vp;
+    let mut vm;
+    let e10;
+    let mut vm_is_trailing_zeros = false;
+    let mut last_removed_digit = 0u32;
+    if e2 >= 0 {
+        let q = log10_pow2(e2);
+        e10 = q as i32;
+        let k = FLOAT_POW5_INV_BITCOUNT + pow5bits(q as i32) - 1;
+        let i = -e2 + q as i32 + k;
+        vr = mul_pow5_inv_div_pow2(mv, q, i);
+        vp = mul_pow5_inv_div_pow2(mp, q, i);
+        vm = mul_pow5_inv_div_pow2(mm, q, i);
+        if q != 0 && (vp - 1) / 10 <= vm / 10 {
+            // One removed digit is needed even when the loop below won't run
+            let l = FLOAT_POW5_INV_BITCOUNT + pow5bits(q as i32 - 1) - 1;
+            last_removed_digit = mul_pow5_inv_div_pow2(mv, q - 1, -e2 + q as i32 - 1 + l) % 10;
+        }
+        // Only one of mp, mv and mm can be a multiple of 5, if any
+        if q <= 9 && mv % 5 != 0 {
+            if accept_bounds {
+                vm_is_trailing_zeros = multiple_of_power_of_5(mm, q);
+            } else {
+                vp -= multiple_of_power_of_5(mp, q) as u32;
+            }
+        }
+    } else {
+        let q = log10_pow5(-e2);
+        e10 = q as i32 + e2;
+        let i = -e2 - q as i32;
+        let k = pow5bits(i) - FLOAT_POW5_BITCOUNT;
+        let j = q as i32 - k;
+        vr = mul_pow5_div_pow2(mv, i as u32, j);
+        vp = mul_pow5_div_pow2(mp, i as u32, j);
+        vm = mul_pow5_div_pow2(mm, i as u32, j);
+        if q != 0 && (vp - 1) / 10 <= vm / 10 {
+            let j = q as i32 - 1 - (pow5bits(i + 1) - FLOAT_POW5_BITCOUNT);
+            last_removed_digit = mul_pow5_div_pow2(mv, (i + 1) as u32, j) % 10;
+        }
+        if q <= 1 {
+            // mm has a trailing zero bit iff mm_shift is 1; mp always has one
+            if accept_bounds {
+                vm_is_trailing_zeros = mm_shift == 1;
+            } else {
+                vp -= 1;
+            }
+        }
+    }
+
+    // Drop digits while the interval still holds a shorter decimal. Unlike
+    // the reference, exact ties round up rather than to even, as core does
+    let mut removed = 0;
+    while vp / 10 > vm / 10 {
+        vm_is_trailing_zeros &= vm % 10 == 0;
+        last_removed_digit = vr % 10;
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed += 1;
+    }
+    if vm_is_trailing_zeros {
+        // The lower bound itself is exact and may be shorter still
+        while vm % 10 == 0 {
+            last_removed_digit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed += 1;
+        }
+    }
+    let round_up =
+        (vr == vm && (!accept_bounds || !vm_is_trailing_zeros)) || last_removed_digit >= 5;
+    (vr + round_up as u32, e10 + removed)
+}
+
+#[cfg(test)]
+mod tests {
+    extern crate std;
+
+    use super::*;
+    use std::string::ToString;
+
+    fn assert_round_trips(value: f32) {
+        let text = Shortest(value).to_string();
+        assert_eq!(text, value.to_string(), "bits {:#010x}", value.to_bits());
+        let parsed = parse_f32(&text).unwrap();
+        assert_eq!(parsed.to_bits(), value.to_bits(), "{text}");
+    }
+
+    fn assert_parses_like_core(raw: &str) {
+        let expected: f32 = raw.parse().unwrap();
+        let parsed = parse_f32(raw).unwrap();
+        assert_eq!(parsed.to_bits(), expected.to_bits(), "{raw}");
+    }
+
+    #[test]
+    fn prints_edge_floats_like_core() {
+        for value in [
+            f32::MAX,
+            f32::MIN,
+            f32::MIN_POSITIVE,
+            -f32::MIN_POSITIVE,
+            f32::from_bits(1),
+            f32::from_bits(0x007f_ffff),
+            f32::EPSILON,
+            0.1,
+            0.3,
+            1.0 / 3.0,
+            2.5,
+            16_777_216.0,
+            16_777_218.0,
+            1e10,
+            1e-10,
+        ] {
+            assert_round_trips(value);
+        }
+        assert_eq!(Shortest(0.0).to_string(), "0");
+        assert_eq!(Shortest(-0.0).to_string(), "-0");
+    }
+
+    #[test]
+    fn prints_floats_across_the_range_like_core() {
+        // Every exponent, with mantissas spread across each binade
+        for bits in (0..0x7f80_0000u32).step_by(4099) {
+            assert_round_trips(f32::from_bits(bits));
+            assert_round_trips(-f32::from_bits(bits | 1));
+        }
+    }
+
+    #[test]
+    fn parses_like_core() {
+        for raw in [
+            // Ties between neighbouring floats round to even
+            "16777217",
+            "16777219",
+            "0.5",
+            "1.5e-45",
+            "7e-46",
+            "1e-46",
+            "1.1754942e-38",
+            "1.17549435e-38",
+            "3.4028235e38",
+            "3.40282357e38",
+            "3.4028236e38",
+            "1e39",
+            "-1e39",
+            "0.1",
+            "-0.0",
+            "123456789012345678901234567890",
+            "0.000000000000000000000000000000000000000000001",
+            "1e-10",
+            "9999999999e10",
+        ] {
+            assert_parses_like_core(raw);
+        }
+    }
+
+    #[test]
+    fn keeps_integers_exact_to_the_edges_of_i64() {
+        let cases = [
+            ("0", Number::Int(0)),
+            ("9223372036854775807", Number::Int(i64::MAX)),
+            ("-9223372036854775807", Number::Int(-i64::MAX)),
+            ("-9223372036854775808", Number::Int(i64::MIN)),
+            ("9223372036854775808", Number::Float(9.223372e18)),
+            ("-9223372036854775809", Number::Float(-9.223372e18)),
+            ("18446744073709551616", Number::Float(1.8446744e19)),
+            ("1e3", Number::Float(1000.0)),
+            ("1.0", Number::Float(1.0)),
+        ];
+        for (raw, expected) in cases {
+            assert_eq!(Number::parse(raw), Some(expected), "{raw}");
+        }
+        let zero = Number::parse("-0").unwrap();
+        assert!(matches!(zero, Number::Float(z) if z == 0.0 && z.is_sign_negative()));
+    }
+
+    #[test]
+    fn rejects_what_json_does_not_allow() {
+        for raw in [
+            "", "-", "+1", "01", "-01", "1.", ".5", "1e", "1e+", "--1", "1-2", "0x10", "1 ",
+        ] {
+            assert_eq!(Number::parse(raw), None, "{raw:?}");
+        }
+    }
+}
@@ -0,0 +1,138 @@
+// Allocation-free tool output.
+//
+// Handlers write their result into a caller-supplied byte buffer instead of
+// building an alloc::String. Text content goes through `Escaped`, which
+// JSON-escapes everything formatted into it, so handlers can use plain
+// `format_args!` without worrying about quotes or control characters.
+
+use core::fmt::{self, Write};
+
+use crate::mcp::McpError;
+use crate::num::Shortest;
+use heapless::String;
+
+const TEXT_PREFIX: &[u8] = br#"{"content":[{"type":"text","text":""#;
+const TEXT_SUFFIX: &[u8] = br#""}]}"#;
+
+/// JSON escape sequence for `byte`, or `None` if it can be written as-is.
+pub(crate) fn escape_byte(byte: u8) -> Option<([u8; 6], usize)> {
+    const HEX: &[u8; 16] = b"0123456789abcdef";
+    let short = |c: u8| Some(([b'\\', c, 0, 0, 0, 0], 2));
+    match byte {
+        b'"' => short(b'"'),
+        b'\\' => short(b'\\'),
+        b'\n' => short(b'n'),
+        b'\r' => short(b'r'),
+        b'\t' => short(b't'),
+        0..=0x1f => Some((
+            [
+                b'\\',
+                b'u',
+                b'0',
+                b'0',
+                HEX[(byte >> 4) as usize],
+                HEX[(byte & 0xf) as usize],
+            ],
+            6,
+        )),
+        _ => None,
+    }
+}
+
+/// Fixed-capacity writer over a borrowed byte buffer.
+pub struct SliceWriter<'b> {
+    buf: &'b mut [u8],
+    len: usize,
+}
+
+impl<'b> SliceWriter<'b> {
+    pub fn new(buf: &'b mut [u8]) -> Self {
+        Self { buf, len: 0 }
+    }
+
+    pub fn push(&mut self, bytes: &[u8]) -> fmt::Result {
+        let end = self.len + bytes.len();
+        if end > self.buf.len() {
+            return Err(fmt::Error);
+        }
+        self.buf[self.len..end].copy_from_slice(bytes);
+        self.len = end;
+        Ok(())
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    pub fn into_str(self) -> &'b str {
+        // Only whole `str`s and ASCII escapes are ever pushed
+        core::str::from_utf8(&self.buf[..self.len]).unwrap_or("")
+    }
+}
+
+impl Write for SliceWriter<'_> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        self.push(s.as_bytes())
+    }
+}
+
+/// Writes JSON string contents, escaping as it goes.
+pub struct Escaped<'w, 'b>(pub &'w mut SliceWriter<'b>);
+
+impl Write for Escaped<'_, '_> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        let bytes = s.as_bytes();
+        let mut start = 0;
+        for (i, &b) in bytes.iter().enumerate() {
+            if let Some((escape, len)) = escape_byte(b) {
+                self.0.push(&bytes[start..i])?;
+                self.0.push(&escape[..len])?;
+                start = i + 1;
+            }
+        }
+        self.0.push(&bytes[start..])
+    }
+}
+
+pub fn result_too_large() -> McpError {
+    McpError {
+        code: -32603,
+        message: String::try_from("Result too large").unwrap_or_else(|_| String::new()),
+    }
+}
+
+/// Formats a lazily computed series as a JSON array. `F` is called for a
+/// fresh iterator each time the series is formatted.
+pub struct Series<F>(pub F);
+
+impl<F, I> fmt::Display for Series<F>
+where
+    F: Fn() -> I,
+    I: Iterator<Item = f32>,
+{
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str("[")?;
+        for (i, value) in (self.0)().enumerate() {
+            if i > 0 {
+                f.write_str(",")?;
+            }
+            write!(f, "{}", Shortest(value))?;
+        }
+        f.write_str("]")
+    }
+}
+
+/// Write an MCP text content result into `out` and return it as JSON.
+pub fn text_content<'b>(out: &'b mut [u8], text: fmt::Arguments) -> Result<&'b str, McpError> {
+    let mut writer = SliceWriter::new(out);
+    writer
+        .push(TEXT_PREFIX)
+        .and_then(|_| Escaped(&mut writer).write_fmt(text))
+        .and_then(|_| writer.push(TEXT_SUFFIX))
+        .map_err(|_| result_too_large())?;
+    Ok(writer.into_str())
+}
@@ -0,0 +1,246 @@
+// Declarative MCP tool registry.
+//
+// Each tool is declared once with its name, description, typed arguments and
+// handler. `mcp_tools!` expands that into:
+//  - a `&'static str` with the complete `tools/list` result, built by `concat!`
+//  - one argument struct per tool with a borrowed-slice decoder that enforces
+//    the same types, ranges, enums and required fields as the schema
+//  - the perfect-hash dispatch table routing each name to its handler
+//
+// Field syntax: `required name: kind [params]` or
+// `optional name: kind [params] = default`. Kinds are `bool`, `u8`, `f32`,
+// `number` (an f32, or an exact i64 when written as an integer: `num::Number`),
+// `str` and `numbers` (an array of numbers, read lazily as `json::Numbers`);
+// params are `[min, max]` for `u8` and an enum list for `str`. An optional
+// field without a default decodes to `Option<T>`.
+//
+// A tool may list MCP annotations after its description: `[read_only]` or
+// `[idempotent]`. Clients such as the bridge use them to decide whether a
+// call is safe to send again.
+
+use crate::json::{Arguments, Numbers, Value};
+use crate::mcp::McpError;
+use crate::num::Number;
+use heapless::String;
+
+/// Conversion from a borrowed JSON value into a typed tool argument.
+pub trait ArgValue<'a>: Sized {
+    fn from_value(value: Value<'a>) -> Option<Self>;
+}
+
+impl<'a> ArgValue<'a> for bool {
+    fn from_value(value: Value<'a>) -> Option<Self> {
+        value.as_bool()
+    }
+}
+
+impl<'a> ArgValue<'a> for u8 {
+    fn from_value(value: Value<'a>) -> Option<Self> {
+        value.as_u8()
+    }
+}
+
+impl<'a> ArgValue<'a> for f32 {
+    fn from_value(value: Value<'a>) -> Option<Self> {
+        value.as_f32()
+    }
+}
+
+impl<'a> ArgValue<'a> for Number {
+    fn from_value(value: Value<'a>) -> Option<Self> {
+        match value {
+            Value::Num(n) => Number::parse(n),
+            _ => None,
+        }
+    }
+}
+
+impl<'a> ArgValue<'a> for &'a str {
+    fn from_value(value: Value<'a>) -> Option<Self> {
+        value.as_str()
+    }
+}
+
+impl<'a> ArgValue<'a> for Numbers<'a> {
+    fn from_value(value: Value<'a>) -> Option<Self> {
+        match value {
+            Value::Array(raw) => Numbers::new(raw),
+            _ => None,
+        }
+    }
+}
+
+pub fn invalid_params(message: &str) -> McpError {
+    McpError {
+        code: -32602,
+        message: String::try_from(message).unwrap_or_else(|_| String::new()),
+    }
+}
+
+pub fn optional<'a, T: ArgValue<'a>>(
+    args: &Arguments<'a>,
+    key: &str,
+    valid: impl Fn(&T) -> bool,
+    error: &str,
+) -> Result<Option<T>, McpError> {
+    match args.get(key) {
+        None | Some(Value::Null) => Ok(None),
+        Some(value) => match T::from_value(value) {
+            Some(v) if valid(&v) => Ok(Some(v)),
+            _ => Err(invalid_params(error)),
+        },
+    }
+}
+
+pub fn required<'a, T: ArgValue<'a>>(
+    args: &Arguments<'a>,
+    key: &str,
+    valid: impl Fn(&T) -> bool,
+    error: &str,
+) -> Result<T, McpError> {
+    optional(args, key, valid, error)?.ok_or_else(|| invalid_params(error))
+}
+
+macro_rules! mcp_tools {
+    (
+        $vis:vis static $table:ident: ToolTable<$slots:literal>;
+        $list_vis:vis const $list:ident;
+        $(
+            tool $name:literal ($desc:literal) $([$($hint:ident),+])? => $handler:ident($args:ident) {
+                $(
+                    $mode:ident $field:ident: $kind:ident $([$($param:tt),*])? $(= $default:expr)?
+                ),* $(,)?
+            }
+        )+
+    ) => {
+        $(
+            pub struct $args<'a> {
+                $(pub $field: mcp_tools!(@field_ty 'a, $mode $kind $(= $default)?),)*
+                _marker: core::marker::PhantomData<&'a ()>,
+            }
+
+            impl<'a> $args<'a> {
+                pub fn decode(
+                    args: &$crate::json::Arguments<'a>,
+                ) -> Result<Self, $crate::mcp::McpError> {
+                    Ok(Self {
+                        $(
+                            $field: mcp_tools!(
+                                @decode args, $field, $mode $kind [$($($param),*)?] $(= $default)?
+                            ),
+                        )*
+                        _marker: core::marker::PhantomData,
+                    })
+                }
+
+                fn dispatch<'b>(
+                    args: &$crate::json::Arguments,
+                    out: &'b mut [u8],
+                ) -> Result<&'b str, $crate::mcp::McpError> {
+                    $handler(&$args::decode(args)?, out)
+                }
+            }
+        )+
+
+        $vis static $table: $crate::dispatch::ToolTable<$slots> =
+            $crate::dispatch::ToolTable::new(&[
+                $($crate::dispatch::Tool {
+                    name: $name,
+                    handler: $args::dispatch,
+                },)+
+            ]);
+
+        $list_vis const $list: &str = concat!(
+            r#"{"tools":["#,
+            mcp_tools!(@tools $({ $name $desc [$($($hint),+)?] { $({ $mode $field $kind [$($($param),*)?] })* } })+),
+            "]}"
+        );
+    };
+
+    (@field_ty $lt:lifetime, optional $kind:ident = $default:expr) => { mcp_tools!(@ty $lt, $kind) };
+    (@field_ty $lt:lifetime, optional $kind:ident) => { Option<mcp_tools!(@ty $lt, $kind)> };
+    (@field_ty $lt:lifetime, required $kind:ident) => { mcp_tools!(@ty $lt, $kind) };
+
+    (@ty $lt:lifetime, str) => { &$lt str };
+    (@ty $lt:lifetime, number) => { $crate::num::Number };
+    (@ty $lt:lifetime, numbers) => { $crate::json::Numbers<$lt> };
+    (@ty $lt:lifetime, $kind:ident) => { $kind };
+
+    (@decode $args:ident, $field:ident, optional $kind:ident $params:tt = $default:expr) => {
+        mcp_tools!(@decode $args, $field, optional $kind $params).unwrap_or($default)
+    };
+    (@decode $args:ident, $field:ident, $mode:ident $kind:ident $params:tt) => {
+        $crate::registry::$mode(
+            $args,
+            stringify!($field),
+            |v| mcp_tools!(@check v, $kind $params),
+            concat!("Invalid params: ", stringify!($field)),
+        )?
+    };
+
+    (@check $v:ident, u8 [$min:literal, $max:literal]) => { ($min..=$max).contains($v) };
+    (@check $v:ident, str [$($variant:literal),+]) => { matches!(*$v, $($variant)|+) };
+    (@check $v:ident, $kind:ident $params:tt) => { { let _ = $v; true } };
+
+    (@tools $first:tt $($rest:tt)*) => {
+        concat!(mcp_tools!(@tool $first) $(, ",", mcp_tools!(@tool $rest))*)
+    };
+    (@tool { $name:literal $desc:literal $hints:tt { $($fields:tt)* } }) => {
+        concat!(
+            r#"{"name":""#, $name,
+            r#"","description":""#, $desc,
+            r#"","inputSchema":{"type":"object","properties":{"#,
+            mcp_tools!(@props $($fields)*),
+            "}",
+            mcp_tools!(@required [] $($fields)*),
+            "}",
+            mcp_tools!(@annotations $hints),
+            "}"
+        )
+    };
+
+    (@annotations []) => { "" };
+    (@annotations [$first:ident $(, $rest:ident)*]) => {
+        concat!(
+            r#","annotations":{"#,
+            mcp_tools!(@hint $first) $(, ",", mcp_tools!(@hint $rest))*,
+            "}"
+        )
+    };
+    (@hint read_only) => { r#""readOnlyHint":true"# };
+    (@hint idempotent) => { r#""idempotentHint":true"# };
+
+    (@props) => { "" };
+    (@props $first:tt $($rest:tt)*) => {
+        concat!(mcp_tools!(@prop $first) $(, ",", mcp_tools!(@prop $rest))*)
+    };
+    (@prop { $mode:ident $field:ident $kind:ident $params:tt }) => {
+        concat!("\"", stringify!($field), "\":", mcp_tools!(@schema $kind $params))
+    };
+
+    (@schema bool []) => { r#"{"type":"boolean"}"# };
+    (@schema f32 []) => { r#"{"type":"number"}"# };
+    (@schema number []) => { r#"{"type":"number"}"# };
+    (@schema u8 []) => { mcp_tools!(@schema u8 [0, 255]) };
+    (@schema u8 [$min:literal, $max:literal]) => {
+        concat!(r#"{"type":"integer","minimum":"#, $min, r#","maximum":"#, $max, "}")
+    };
+    (@schema str []) => { r#"{"type":"string"}"# };
+    (@schema numbers []) => { r#"{"type":"array","items":{"type":"number"}}"# };
+    (@schema str [$first:literal $(, $rest:literal)*]) => {
+        concat!(r#"{"type":"string","enum":[""#, $first, "\"", $(",\"", $rest, "\"",)* "]}")
+    };
+
+    (@required []) => { "" };
+    (@required [$first:ident $($rest:ident)*]) => {
+        concat!(r#","required":[""#, stringify!($first), "\"", $(",\"", stringify!($rest), "\"",)* "]")
+    };
+    (@required [$($acc:ident)*] { required $field:ident $($ignored:tt)* } $($rest:tt)*) => {
+        mcp_tools!(@required [$($acc)* $field] $($rest)*)
+    };
+    (@required [$($acc:ident)*] { optional $($ignored:tt)* } $($rest:tt)*) => {
+        mcp_tools!(@required [$($acc)*] $($rest)*)
+    };
+}
+
+pub(crate) use mcp_tools;
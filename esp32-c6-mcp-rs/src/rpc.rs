@@ -0,0 +1,94 @@
+// JSON-RPC envelope serialization straight into an `embedded_io_async::Write`.
+//
+// Responses are written without a trailing newline so callers can frame them
+// individually or join several into a batch array.
+//
+// Every piece of the response (envelope, handler result, error) is written
+// directly to the sink, so with a TCP socket the bytes go into its tx buffer
+// without an intermediate String or stack copy and without a size cap.
+
+use embedded_io_async::Write;
+
+use crate::mcp::McpResponse;
+use crate::output::escape_byte;
+
+pub async fn write_response<W: Write>(
+    out: &mut W,
+    response: &McpResponse<'_>,
+) -> Result<(), W::Error> {
+    out.write_all(b"{\"jsonrpc\":\"").await?;
+    out.write_all(response.jsonrpc.as_bytes()).await?;
+    out.write_all(b"\",\"id\":").await?;
+    match response.id {
+        Some(id) => write_int(out, id as i64).await?,
+        None => out.write_all(b"null").await?,
+    }
+
+    if let Some(result) = response.result {
+        // Handler results are already JSON; write them as-is
+        out.write_all(b",\"result\":").await?;
+        out.write_all(result.as_bytes()).await?;
+    } else if let Some(ref error) = response.error {
+        write_error_body(out, error.code, error.message.as_str()).await?;
+    } else {
+        out.write_all(b",\"result\":null").await?;
+    }
+
+    out.write_all(b"}").await
+}
+
+/// Write a complete error response, e.g. for requests that failed to parse.
+pub async fn write_error<W: Write>(
+    out: &mut W,
+    id: Option<u32>,
+    code: i32,
+    message: &str,
+) -> Result<(), W::Error> {
+    out.write_all(b"{\"jsonrpc\":\"2.0\",\"id\":").await?;
+    match id {
+        Some(id) => write_int(out, id as i64).await?,
+        None => out.write_all(b"null").await?,
+    }
+    write_error_body(out, code, message).await?;
+    out.write_all(b"}").await
+}
+
+async fn write_error_body<W: Write>(out: &mut W, code: i32, message: &str) -> Result<(), W::Error> {
+    out.write_all(b",\"error\":{\"code\":").await?;
+    write_int(out, code as i64).await?;
+    out.write_all(b",\"message\":\"").await?;
+    write_escaped(out, message).await?;
+    out.write_all(b"\"}").await
+}
+
+async fn write_int<W: Write>(out: &mut W, value: i64) -> Result<(), W::Error> {
+    let mut digits = [0u8; 20];
+    let mut pos = digits.len();
+    let mut n = value.unsigned_abs();
+    loop {
+        pos -= 1;
+        digits[pos] = b'0' + (n % 10) as u8;
+        n /= 10;
+        if n == 0 {
+            break;
+        }
+    }
+    if value < 0 {
+        pos -= 1;
+        digits[pos] = b'-';
+    }
+    out.write_all(&digits[pos..]).await
+}
+
+async fn write_escaped<W: Write>(out: &mut W, text: &str) -> Result<(), W::Error> {
+    let bytes = text.as_bytes();
+    let mut start = 0;
+    for (i, &b) in bytes.iter().enumerate() {
+        if let Some((escape, len)) = escape_byte(b) {
+            out.write_all(&bytes[start..i]).await?;
+            out.write_all(&escape[..len]).await?;
+            start = i + 1;
+        }
+    }
+    out.write_all(&bytes[start..]).await
+}
@@ -0,0 +1,395 @@
+// Transport-independent MCP connection handling.
+//
+// Everything between the socket and `handle_mcp_request` lives here: newline
+// framing and the switch to CBOR frames, JSON-RPC batches, notifications and
+// error replies. It only needs
+// `embedded_io_async::{Read, Write}`, so the firmware serves it over
+// embassy-net sockets and the host build (../esp32-mcp-host) over tokio.
+
+use crate::cbor::{self, CborError};
+use crate::framing::{Frame, FrameBuffer};
+use crate::json::array_elements;
+use crate::mcp::{accepts_cbor, handle_mcp_request, refuse_cbor, McpRequest, McpResponse};
+use crate::output::SliceWriter;
+use crate::rpc::{write_error, write_response};
+use crate::trace::{self, Event};
+use embedded_io_async::{Read, Write};
+use log::{error, info, warn};
+
+/// How messages are framed and replies encoded on a connection.
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Encoding {
+    /// Newline-delimited JSON, until the client negotiates otherwise.
+    Json,
+    /// Length-prefixed CBOR frames (see `cbor`).
+    Cbor,
+}
+
+/// What handling a message wrote to the socket.
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Written {
+    /// Nothing, e.g. for a notification.
+    Nothing,
+    Reply,
+    /// A reply accepting CBOR framing to an initialize request on its own;
+    /// the connection switches once it's flushed.
+    CborAccepted,
+}
+
+/// Serve one client until it disconnects. `frame_buf` holds partially
+/// received requests, `json_buf` CBOR requests transcoded to JSON for
+/// dispatch, and `result_buf` tool results.
+pub async fn handle_mcp_connection<T: Read + Write>(
+    socket: &mut T,
+    frame_buf: &mut [u8],
+    json_buf: &mut [u8],
+    result_buf: &mut [u8],
+) -> Result<(), T::Error>
+where
+    T::Error: core::fmt::Debug,
+{
+    let frames = FrameBuffer::new(frame_buf);
+    let Some(carried) = serve(socket, frames, &mut [], result_buf, Encoding::Json).await? else {
+        return Ok(());
+    };
+
+    // Bytes pipelined after the switch are already at the front of the
+    // buffer, which keeps its full size for frames
+    let frames = FrameBuffer::length_prefixed(frame_buf, carried);
+    serve(socket, frames, json_buf, result_buf, Encoding::Cbor)
+        .await
+        .map(|_| ())
+}
+
+/// Serve framed messages until the client disconnects, which returns `None`,
+/// or a JSON client negotiates CBOR framing. The switch happens once the
+/// initialize reply is flushed and returns the number of bytes received
+/// after the request, moved to the front of the frame buffer.
+async fn serve<T: Read + Write>(
+    socket: &mut T,
+    mut frames: FrameBuffer<'_>,
+    json_buf: &mut [u8],
+    result_buf: &mut [u8],
+    encoding: Encoding,
+) -> Result<Option<usize>, T::Error>
+where
+    T::Error: core::fmt::Debug,
+{
+    let frame_size = frames.capacity();
+
+    loop {
+        // Read new data straight into the framer's free space
+        match socket.read(frames.spare()).await {
+            Ok(0) => {
+                info!("MCP connection closed by client (no data received)");
+                return Ok(None);
+            }
+            Ok(n) => {
+                trace::record(Event::BytesReceived, n as u32);
+                frames.commit(n);
+
+                // Process all complete messages back to back; their replies
+                // accumulate in the socket's tx buffer
+                let mut responded = false;
+                let mut negotiated = false;
+                while let Some(frame) = frames.next_frame() {
+                    let replied = match frame {
+                        Frame::Message(message) => {
+                            trace::record(Event::MessageReceived, message.len() as u32);
+                            #[cfg(feature = "log-payloads")]
+                            info!("Message payload: {}", message);
+                            process_mcp_message(socket, encoding, result_buf, message).await
+                        }
+                        Frame::Binary(payload) => {
+                            trace::record(Event::MessageReceived, payload.len() as u32);
+                            let mut json = SliceWriter::new(&mut *json_buf);
+                            match cbor::decode_json(payload, &mut json) {
+                                Ok(_) => {
+                                    let message = json.into_str();
+                                    #[cfg(feature = "log-payloads")]
+                                    info!("Message payload: {}", message);
+                                    process_mcp_message(socket, encoding, result_buf, message).await
+                                }
+                                Err(CborError::Write) => {
+                                    trace::record(Event::FrameTooLarge, json_buf.len() as u32);
+                                    reply_error(socket, encoding, REQUEST_TOO_LARGE).await
+                                }
+                                Err(_) => {
+                                    trace::record(Event::ParseFailed, payload.len() as u32);
+                                    reply_error(socket, encoding, PARSE_ERROR).await
+                                }
+                            }
+                        }
+                        Frame::InvalidUtf8 => {
+                            trace::record(Event::InvalidUtf8, 0);
+                            reply_error(socket, encoding, PARSE_ERROR).await
+                        }
+                        Frame::Oversized => {
+                            trace::record(Event::FrameTooLarge, frame_size as u32);
+                            reply_error(socket, encoding, REQUEST_TOO_LARGE).await
+                        }
+                    };
+
+                    match replied {
+                        Ok(written) => {
+                            responded |= written != Written::Nothing;
+                            negotiated =
+                                encoding == Encoding::Json && written == Written::CborAccepted;
+                        }
+                        Err(e) => {
+                            error!("Error processing message: {:?}", e);
+                            return Err(e);
+                        }
+                    }
+
+                    // Anything after the initialize request is already CBOR
+                    if negotiated {
+                        break;
+                    }
+                }
+
+                // One flush per read so pipelined replies share TCP segments
+                if responded {
+                    if let Err(e) = socket.flush().await {
+                        error!("Flush error: {:?}", e);
+                        return Err(e);
+                    }
+                    trace::record(Event::ResponsesFlushed, 0);
+                }
+
+                if negotiated {
+                    let carried = frames.into_unconsumed();
+                    trace::record(Event::CborNegotiated, carried as u32);
+                    return Ok(Some(carried));
+                }
+            }
+            Err(e) => {
+                error!("Socket read error: {:?}", e);
+                return Err(e);
+            }
+        }
+    }
+}
+
+async fn reply_error<T: Write>(
+    socket: &mut T,
+    encoding: Encoding,
+    error: (i32, &str),
+) -> Result<Written, T::Error> {
+    write_error_reply(socket, encoding, error).await?;
+    if encoding == Encoding::Json {
+        socket.write_all(b"\n").await?;
+    }
+    Ok(Written::Reply)
+}
+
+async fn write_reply<T: Write>(
+    socket: &mut T,
+    encoding: Encoding,
+    response: &McpResponse<'_>,
+) -> Result<(), T::Error> {
+    match encoding {
+        Encoding::Json => write_response(socket, response).await,
+        Encoding::Cbor => cbor::write_response(socket, response).await,
+    }
+}
+
+async fn write_error_reply<T: Write>(
+    socket: &mut T,
+    encoding: Encoding,
+    error: (i32, &str),
+) -> Result<(), T::Error> {
+    match encoding {
+        Encoding::Json => write_error(socket, None, error.0, error.1).await,
+        Encoding::Cbor => cbor::write_error(socket, None, error.0, error.1).await,
+    }
+}
+
+const PARSE_ERROR: (i32, &str) = (-32700, "Parse error");
+const INVALID_REQUEST: (i32, &str) = (-32600, "Invalid Request");
+const REQUEST_TOO_LARGE: (i32, &str) = (-32600, "Request too large");
+
+/// Where a reply goes: on its own, or first or later in a batch reply.
+#[derive(Clone, Copy)]
+enum Slot {
+    Single,
+    First,
+    Next,
+}
+
+/// Write what precedes a reply in `slot`. A CBOR batch reply is a frame that
+/// opens an indefinite-length array, a frame per reply and a closing frame.
+async fn open_slot<T: Write>(
+    socket: &mut T,
+    encoding: Encoding,
+    slot: Slot,
+) -> Result<(), T::Error> {
+    match (encoding, slot) {
+        (_, Slot::Single) => Ok(()),
+        (Encoding::Json, Slot::First) => socket.write_all(b"[").await,
+        (Encoding::Json, Slot::Next) => socket.write_all(b",").await,
+        (Encoding::Cbor, Slot::First) => cbor::write_frame(socket, &[cbor::ARRAY_START]).await,
+        (Encoding::Cbor, Slot::Next) => Ok(()),
+    }
+}
+
+/// Handle one framed message and write its reply, if any, without flushing.
+async fn process_mcp_message<T: Write>(
+    socket: &mut T,
+    encoding: Encoding,
+    result_buf: &mut [u8],
+    request_str: &str,
+) -> Result<Written, T::Error>
+where
+    T::Error: core::fmt::Debug,
+{
+    let written = if request_str.starts_with('[') {
+        match process_batch(socket, encoding, result_buf, request_str).await? {
+            true => Written::Reply,
+            false => Written::Nothing,
+        }
+    } else {
+        process_request(
+            socket,
+            encoding,
+            result_buf,
+            request_str,
+            Slot::Single,
+            PARSE_ERROR,
+        )
+        .await?
+    };
+
+    // Notifications (and all-notification batches) get no reply, and CBOR
+    // frames carry their own length
+    if written != Written::Nothing && encoding == Encoding::Json {
+        if let Err(e) = socket.write_all(b"\n").await {
+            error!("Write error: {:?}", e);
+            return Err(e);
+        }
+    }
+    Ok(written)
+}
+
+/// Handle a JSON-RPC batch: every element is processed in order and the
+/// replies are written as one array.
+async fn process_batch<T: Write>(
+    socket: &mut T,
+    encoding: Encoding,
+    result_buf: &mut [u8],
+    batch_str: &str,
+) -> Result<bool, T::Error>
+where
+    T::Error: core::fmt::Debug,
+{
+    // Validate the array shape first so a malformed batch gets a single
+    // parse error instead of a truncated array
+    let count = array_elements(batch_str)
+        .and_then(|mut elements| elements.try_fold(0usize, |n, element| element.map(|_| n + 1)));
+
+    let count = match count {
+        Ok(0) => {
+            warn!("Empty batch received");
+            return write_error_reply(socket, encoding, INVALID_REQUEST)
+                .await
+                .map(|_| true);
+        }
+        Ok(count) => count,
+        Err(e) => {
+            error!("Batch parse failed: {:?}", e);
+            return write_error_reply(socket, encoding, PARSE_ERROR)
+                .await
+                .map(|_| true);
+        }
+    };
+
+    trace::record(Event::BatchReceived, count as u32);
+
+    let mut responded = false;
+    for element in array_elements(batch_str).into_iter().flatten().flatten() {
+        let slot = if responded { Slot::Next } else { Slot::First };
+        // The batch already parsed as JSON, so a bad element is an invalid request
+        let written =
+            process_request(socket, encoding, result_buf, element, slot, INVALID_REQUEST).await?;
+        responded |= written != Written::Nothing;
+    }
+
+    if responded {
+        match encoding {
+            Encoding::Json => socket.write_all(b"]").await?,
+            Encoding::Cbor => cbor::write_frame(socket, &[cbor::BREAK]).await?,
+        }
+    }
+    Ok(responded)
+}
+
+/// Handle one request object. `slot` places the reply, if any, and
+/// `invalid` is the error sent when the request can't be deserialized.
+async fn process_request<T: Write>(
+    socket: &mut T,
+    encoding: Encoding,
+    result_buf: &mut [u8],
+    request_str: &str,
+    slot: Slot,
+    invalid: (i32, &str),
+) -> Result<Written, T::Error>
+where
+    T::Error: core::fmt::Debug,
+{
+    // Parse and handle MCP request
+    match serde_json_core::from_str::<McpRequest>(request_str) {
+        Ok((request, _)) => {
+            let method = trace::method_id(request.method.as_str());
+
+            // Check if this is a notification (no id field)
+            if request.id.is_none() {
+                // For notifications, just record them but don't send a response;
+                // unknown methods show up as "<unknown>" when the log is drained
+                trace::record(Event::NotificationReceived, method);
+                #[cfg(feature = "log-payloads")]
+                info!("Notification: {}", request.method.as_str());
+
+                // Return without sending a response for notifications
+                return Ok(Written::Nothing);
+            }
+
+            trace::record(Event::RequestParsed, method);
+
+            // Tool handlers write dynamic results into the connection's
+            // result buffer instead of allocating
+            let mut response = handle_mcp_request(&request, request_str, result_buf);
+
+            // Framing can only switch after a reply that is the whole message
+            let switch = match slot {
+                Slot::Single => accepts_cbor(&response),
+                Slot::First | Slot::Next => {
+                    refuse_cbor(&mut response);
+                    false
+                }
+            };
+
+            // Stream the envelope and result straight into the socket's tx buffer
+            open_slot(socket, encoding, slot).await?;
+            if let Err(e) = write_reply(socket, encoding, &response).await {
+                error!("Write error: {:?}", e);
+                return Err(e);
+            }
+            if switch {
+                return Ok(Written::CborAccepted);
+            }
+        }
+        Err(_e) => {
+            trace::record(Event::ParseFailed, request_str.len() as u32);
+            #[cfg(feature = "log-payloads")]
+            error!("JSON parse failed: {:?}, raw request: {}", _e, request_str);
+
+            // Send error response
+            open_slot(socket, encoding, slot).await?;
+            if let Err(e) = write_error_reply(socket, encoding, invalid).await {
+                error!("Write error: {:?}", e);
+                return Err(e);
+            }
+        }
+    }
+    Ok(Written::Reply)
+}
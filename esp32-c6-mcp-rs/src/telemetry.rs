@@ -0,0 +1,214 @@
+// Live WiFi telemetry shared between the connection task and tool handlers.
+//
+// The connection task is the only writer; it publishes a `WifiSnapshot`
+// into a seqlock of atomic words. Readers copy the words out and retry if a
+// publish overlapped, so `wifi_status` never waits on the WiFi driver and
+// never enters a critical section. Publishing never awaits, so on the
+// single-core target a reader on the same executor can't observe a torn
+// snapshot and never retries.
+
+use core::fmt;
+use core::sync::atomic::{fence, AtomicU32, Ordering};
+use heapless::String;
+
+pub const MAX_SSID_LEN: usize = 32;
+
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct WifiSnapshot {
+    pub connected: bool,
+    pub ipv4: Option<[u8; 4]>,
+    pub rssi: Option<i8>,
+    pub channel: Option<u8>,
+    pub bssid: Option<[u8; 6]>,
+    pub ssid: String<MAX_SSID_LEN>,
+    /// Successful connections after the first one.
+    pub reconnects: u32,
+}
+
+// Word layout: flags/rssi/channel/ssid length, ipv4, bssid (2), reconnects, ssid
+const SSID_WORDS: usize = MAX_SSID_LEN / 4;
+const WORDS: usize = 5 + SSID_WORDS;
+
+const CONNECTED: u32 = 1 << 0;
+const HAS_IP: u32 = 1 << 1;
+const HAS_RSSI: u32 = 1 << 2;
+const HAS_CHANNEL: u32 = 1 << 3;
+const HAS_BSSID: u32 = 1 << 4;
+
+impl WifiSnapshot {
+    fn encode(&self) -> [u32; WORDS] {
+        let mut words = [0u32; WORDS];
+        let mut flags = 0;
+        if self.connected {
+            flags |= CONNECTED;
+        }
+        if let Some(ip) = self.ipv4 {
+            flags |= HAS_IP;
+            words[1] = u32::from_le_bytes(ip);
+        }
+        if let Some(rssi) = self.rssi {
+            flags |= HAS_RSSI | (rssi as u8 as u32) << 8;
+        }
+        if let Some(channel) = self.channel {
+            flags |= HAS_CHANNEL | (channel as u32) << 16;
+        }
+        if let Some(bssid) = self.bssid {
+            flags |= HAS_BSSID;
+            words[2] = u32::from_le_bytes([bssid[0], bssid[1], bssid[2], bssid[3]]);
+            words[3] = u32::from_le_bytes([bssid[4], bssid[5], 0, 0]);
+        }
+        words[0] = flags | (self.ssid.len() as u32) << 24;
+        words[4] = self.reconnects;
+
+        let mut ssid = [0u8; MAX_SSID_LEN];
+        ssid[..self.ssid.len()].copy_from_slice(self.ssid.as_bytes());
+        for (word, bytes) in words[5..].iter_mut().zip(ssid.chunks_exact(4)) {
+            *word = u32::from_le_bytes([bytes[0], bytes[1], bytes[2], bytes[3]]);
+        }
+        words
+    }
+
+    fn decode(words: &[u32; WORDS]) -> Self {
+        let flags = words[0];
+        let has = |flag: u32| flags & flag != 0;
+
+        let mut ssid = [0u8; MAX_SSID_LEN];
+        for (bytes, word) in ssid.chunks_exact_mut(4).zip(&words[5..]) {
+            bytes.copy_from_slice(&word.to_le_bytes());
+        }
+        let ssid_len = ((flags >> 24) as usize).min(MAX_SSID_LEN);
+        let ssid = core::str::from_utf8(&ssid[..ssid_len])
+            .ok()
+            .and_then(|s| String::try_from(s).ok())
+            .unwrap_or_default();
+
+        let bssid_lo = words[2].to_le_bytes();
+        let bssid_hi = words[3].to_le_bytes();
+
+        Self {
+            connected: has(CONNECTED),
+            ipv4: has(HAS_IP).then(|| words[1].to_le_bytes()),
+            rssi: has(HAS_RSSI).then(|| (flags >> 8) as u8 as i8),
+            channel: has(HAS_CHANNEL).then(|| (flags >> 16) as u8),
+            bssid: has(HAS_BSSID).then(|| {
+                [
+                    bssid_lo[0],
+                    bssid_lo[1],
+                    bssid_lo[2],
+                    bssid_lo[3],
+                    bssid_hi[0],
+                    bssid_hi[1],
+                ]
+            }),
+            ssid,
+            reconnects: words[4],
+        }
+    }
+}
+
+pub struct Telemetry {
+    seq: AtomicU32,
+    words: [AtomicU32; WORDS],
+}
+
+impl Telemetry {
+    pub const fn new() -> Self {
+        Self {
+            seq: AtomicU32::new(0),
+            words: [const { AtomicU32::new(0) }; WORDS],
+        }
+    }
+
+    /// Publish a new snapshot. Only one task may publish to a given instance.
+    pub fn publish(&self, snapshot: &WifiSnapshot) {
+        let words = snapshot.encode();
+        let seq = self.seq.load(Ordering::Relaxed);
+
+        // Odd sequence marks a publish in progress
+        self.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+        fence(Ordering::Release);
+        for (slot, word) in self.words.iter().zip(words) {
+            slot.store(word, Ordering::Relaxed);
+        }
+        self.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
+
+    /// The most recently published snapshot.
+    pub fn read(&self) -> WifiSnapshot {
+        loop {
+            let seq = self.seq.load(Ordering::Acquire);
+            if seq & 1 != 0 {
+                core::hint::spin_loop();
+                continue;
+            }
+
+            let words = core::array::from_fn(|i| self.words[i].load(Ordering::Relaxed));
+            fence(Ordering::Acquire);
+            if self.seq.load(Ordering::Relaxed) == seq {
+                return WifiSnapshot::decode(&words);
+            }
+        }
+    }
+}
+
+impl Default for Telemetry {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+pub static WIFI: Telemetry = Telemetry::new();
+
+/// `a.b.c.d`, or `none` before DHCP has assigned an address.
+pub struct Ipv4(pub Option<[u8; 4]>);
+
+impl fmt::Display for Ipv4 {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self.0 {
+            Some([a, b, c, d]) => write!(f, "{}.{}.{}.{}", a, b, c, d),
+            None => f.write_str("none"),
+        }
+    }
+}
+
+/// `aa:bb:cc:dd:ee:ff`, or `unknown`.
+pub struct Bssid(pub Option<[u8; 6]>);
+
+impl fmt::Display for Bssid {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let Some(bssid) = self.0 else {
+            return f.write_str("unknown");
+        };
+        for (i, byte) in bssid.iter().enumerate() {
+            if i > 0 {
+                f.write_str(":")?;
+            }
+            write!(f, "{:02x}", byte)?;
+        }
+        Ok(())
+    }
+}
+
+/// `-45 dBm`, or `unknown`.
+pub struct Rssi(pub Option<i8>);
+
+impl fmt::Display for Rssi {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self.0 {
+            Some(rssi) => write!(f, "{} dBm", rssi),
+            None => f.write_str("unknown"),
+        }
+    }
+}
+
+/// The value, or `unknown`.
+pub struct OrUnknown<T>(pub Option<T>);
+
+impl<T: fmt::Display> fmt::Display for OrUnknown<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match &self.0 {
+            Some(value) => value.fmt(f),
+            None => f.write_str("unknown"),
+        }
+    }
+}
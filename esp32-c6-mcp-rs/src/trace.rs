@@ -0,0 +1,207 @@
+// Deferred binary event log for the request hot path.
+//
+// Recording an event stores an interned event id and a u32 argument in a
+// lock-free ring; nothing is formatted and nothing touches the UART. A
+// low-priority task (or anything else holding the ring) drains entries later
+// and formats them through `Entry`'s Display impl.
+//
+// The ring is a bounded MPSC queue with per-slot sequence numbers, so any
+// task may record without a critical section. When it is full new events are
+// dropped and counted rather than blocking the caller.
+
+use core::fmt;
+use core::sync::atomic::{AtomicU32, Ordering};
+
+/// Interned log formats. The discriminant is what gets stored in the ring.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+pub enum Event {
+    /// a = bytes read
+    BytesReceived,
+    /// a = message length
+    MessageReceived,
+    /// a = method id
+    RequestParsed,
+    /// a = method id
+    NotificationReceived,
+    /// a = message length
+    ParseFailed,
+    /// a = request count
+    BatchReceived,
+    /// a = frame buffer capacity
+    FrameTooLarge,
+    InvalidUtf8,
+    ResponsesFlushed,
+    /// a = bytes received after the initialize request
+    CborNegotiated,
+}
+
+impl Event {
+    const ALL: [Event; 10] = [
+        Event::BytesReceived,
+        Event::MessageReceived,
+        Event::RequestParsed,
+        Event::NotificationReceived,
+        Event::ParseFailed,
+        Event::BatchReceived,
+        Event::FrameTooLarge,
+        Event::InvalidUtf8,
+        Event::ResponsesFlushed,
+        Event::CborNegotiated,
+    ];
+
+    fn from_id(id: u32) -> Option<Self> {
+        Self::ALL.get(id as usize).copied()
+    }
+}
+
+const METHODS: [&str; 4] = [
+    "initialize",
+    "tools/list",
+    "tools/call",
+    "notifications/initialized",
+];
+const UNKNOWN_METHOD: u32 = u32::MAX;
+
+/// Intern a JSON-RPC method name for logging.
+pub fn method_id(method: &str) -> u32 {
+    METHODS
+        .iter()
+        .position(|m| *m == method)
+        .map_or(UNKNOWN_METHOD, |i| i as u32)
+}
+
+fn method_name(id: u32) -> &'static str {
+    METHODS.get(id as usize).copied().unwrap_or("<unknown>")
+}
+
+#[derive(Debug, Clone, Copy)]
+pub struct Entry {
+    pub event: Event,
+    pub a: u32,
+}
+
+impl fmt::Display for Entry {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self.event {
+            Event::BytesReceived => write!(f, "Received {} bytes of data", self.a),
+            Event::MessageReceived => write!(f, "Processing message ({}bytes)", self.a),
+            Event::RequestParsed => write!(f, "Parsed MCP request: method={}", method_name(self.a)),
+            Event::NotificationReceived => {
+                write!(f, "Processed notification: {}", method_name(self.a))
+            }
+            Event::ParseFailed => write!(f, "JSON parse failed ({}bytes)", self.a),
+            Event::BatchReceived => write!(f, "Processing batch of {} requests", self.a),
+            Event::FrameTooLarge => write!(f, "Message exceeds {} byte frame buffer", self.a),
+            Event::InvalidUtf8 => write!(f, "Invalid UTF-8 in received message"),
+            Event::ResponsesFlushed => write!(f, "Responses sent and flushed"),
+            Event::CborNegotiated => {
+                write!(
+                    f,
+                    "Switched to CBOR framing ({} bytes carried over)",
+                    self.a
+                )
+            }
+        }
+    }
+}
+
+struct Slot {
+    seq: AtomicU32,
+    event: AtomicU32,
+    a: AtomicU32,
+}
+
+pub struct EventLog<const N: usize> {
+    slots: [Slot; N],
+    head: AtomicU32,
+    tail: AtomicU32,
+    dropped: AtomicU32,
+}
+
+impl<const N: usize> EventLog<N> {
+    pub const fn new() -> Self {
+        assert!(N.is_power_of_two(), "event log size must be a power of two");
+        let mut slots = [const {
+            Slot {
+                seq: AtomicU32::new(0),
+                event: AtomicU32::new(0),
+                a: AtomicU32::new(0),
+            }
+        }; N];
+        let mut i = 0;
+        while i < N {
+            slots[i].seq = AtomicU32::new(i as u32);
+            i += 1;
+        }
+        Self {
+            slots,
+            head: AtomicU32::new(0),
+            tail: AtomicU32::new(0),
+            dropped: AtomicU32::new(0),
+        }
+    }
+
+    pub fn record(&self, event: Event, a: u32) {
+        let mut pos = self.head.load(Ordering::Relaxed);
+        loop {
+            let slot = &self.slots[pos as usize & (N - 1)];
+            let seq = slot.seq.load(Ordering::Acquire);
+            match seq.wrapping_sub(pos) as i32 {
+                0 => match self.head.compare_exchange_weak(
+                    pos,
+                    pos.wrapping_add(1),
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => {
+                        slot.event.store(event as u32, Ordering::Relaxed);
+                        slot.a.store(a, Ordering::Relaxed);
+                        slot.seq.store(pos.wrapping_add(1), Ordering::Release);
+                        return;
+                    }
+                    Err(current) => pos = current,
+                },
+                d if d < 0 => {
+                    self.dropped.fetch_add(1, Ordering::Relaxed);
+                    return;
+                }
+                _ => pos = self.head.load(Ordering::Relaxed),
+            }
+        }
+    }
+
+    /// Take the oldest entry. Only one task may drain a given log.
+    pub fn pop(&self) -> Option<Entry> {
+        let pos = self.tail.load(Ordering::Relaxed);
+        let slot = &self.slots[pos as usize & (N - 1)];
+        if slot.seq.load(Ordering::Acquire) != pos.wrapping_add(1) {
+            return None;
+        }
+        let event = slot.event.load(Ordering::Relaxed);
+        let a = slot.a.load(Ordering::Relaxed);
+        slot.seq
+            .store(pos.wrapping_add(N as u32), Ordering::Release);
+        self.tail.store(pos.wrapping_add(1), Ordering::Relaxed);
+
+        // Ids only ever come from `Event`, so this can't fail in practice
+        Event::from_id(event).map(|event| Entry { event, a })
+    }
+
+    /// Number of events dropped because the ring was full, since last call.
+    pub fn take_dropped(&self) -> u32 {
+        self.dropped.swap(0, Ordering::Relaxed)
+    }
+}
+
+impl<const N: usize> Default for EventLog<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+pub static EVENTS: EventLog<64> = EventLog::new();
+
+pub fn record(event: Event, a: u32) {
+    EVENTS.record(event, a);
+}
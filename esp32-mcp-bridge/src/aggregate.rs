@@ -0,0 +1,230 @@
+// Several ESP32s behind one MCP endpoint.
+//
+// Each device's tools are listed as `<device>__<tool>`, and a tools/call is
+// sent to the device named by its prefix with the prefix removed. The bridge
+// answers initialize and ping itself and passes the handshake on to every
+// device. tools/list is asked of every device under the bridge's own ids and
+// the lists are merged once all of them have answered.
+
+use crate::codec;
+use crate::error_response;
+use crate::link::BRIDGE_INIT_ID;
+use crate::message::Message;
+use crate::remap::{REMAP_BASE, RESERVED_BASE};
+use bytes::Bytes;
+use serde_json::value::RawValue;
+use serde_json::{json, Value};
+use std::collections::HashMap;
+use tracing::warn;
+
+/// Between a device name and its tool names. Device names can't contain it.
+pub const SEPARATOR: &str = "__";
+
+// The bridge's ids for tools/list requests, below the stand-ins for Warp's
+const LIST_ID_BASE: u32 = RESERVED_BASE;
+
+/// Where a line goes.
+pub enum Route {
+    Device(usize, Bytes),
+    Warp(Bytes),
+}
+
+/// A merged tools/list waiting on devices.
+struct Listing {
+    id: Box<RawValue>,
+    waiting: usize,
+    /// Each device's tools, so they're listed in device order.
+    tools: Vec<Vec<Value>>,
+}
+
+pub struct Aggregate {
+    names: Vec<String>,
+    up: Vec<bool>,
+    next_id: u32,
+    /// The bridge's tools/list ids, to the listing and device they're for.
+    asked: HashMap<u32, (u32, usize)>,
+    /// Listings by the first id asked for them.
+    listings: HashMap<u32, Listing>,
+}
+
+impl Aggregate {
+    pub fn new(names: Vec<String>) -> Self {
+        Self {
+            up: vec![true; names.len()],
+            names,
+            next_id: LIST_ID_BASE,
+            asked: HashMap::new(),
+            listings: HashMap::new(),
+        }
+    }
+
+    /// Where each part of Warp's `line` goes.
+    pub fn route(&mut self, line: &Bytes) -> Vec<Route> {
+        let request = match Message::parse(line) {
+            Ok(request) => request,
+            Err(e) => {
+                warn!("Invalid JSON from Warp, skipping: {}", e);
+                let response = error_response(&Value::Null, -32700, "Parse error");
+                return vec![Route::Warp(codec::line(response.to_string()))];
+            }
+        };
+        let Some(envelope) = request.single() else {
+            let response = error_response(
+                &Value::Null,
+                -32600,
+                "Batches aren't supported with several devices",
+            );
+            return vec![Route::Warp(codec::line(response.to_string()))];
+        };
+
+        let Some(id) = envelope.id else {
+            // Notifications go to every device as they are
+            return self.broadcast(line);
+        };
+        let reply = |result: Value| {
+            let reply = json!({ "jsonrpc": "2.0", "id": id, "result": result });
+            Route::Warp(codec::line(reply.to_string()))
+        };
+        match envelope.method.as_deref().unwrap_or("") {
+            "initialize" => {
+                let mut init = serde_json::from_slice::<Value>(line).unwrap_or_default();
+                init["id"] = json!(BRIDGE_INIT_ID);
+                let mut routes = self.broadcast(&codec::line(init.to_string()));
+                routes.push(reply(json!({
+                    "protocolVersion": "2024-11-05",
+                    "capabilities": { "tools": { "listChanged": false } },
+                    "serverInfo": {
+                        "name": "esp32-mcp-bridge",
+                        "version": env!("CARGO_PKG_VERSION")
+                    }
+                })));
+                routes
+            }
+            "ping" => vec![reply(json!({}))],
+            "tools/list" => self.list(id.to_owned()),
+            "tools/call" => vec![self.call(line, id, request.tool().unwrap_or(""))],
+            _ => {
+                let response = error_response(id, -32601, "Method not found");
+                vec![Route::Warp(codec::line(response.to_string()))]
+            }
+        }
+    }
+
+    fn broadcast(&self, line: &Bytes) -> Vec<Route> {
+        (0..self.names.len())
+            .filter(|&device| self.up[device])
+            .map(|device| Route::Device(device, line.clone()))
+            .collect()
+    }
+
+    fn list(&mut self, id: Box<RawValue>) -> Vec<Route> {
+        let devices: Vec<usize> = (0..self.names.len()).filter(|&d| self.up[d]).collect();
+        if devices.is_empty() {
+            let reply = json!({ "jsonrpc": "2.0", "id": id, "result": { "tools": [] } });
+            return vec![Route::Warp(codec::line(reply.to_string()))];
+        }
+
+        let listing = self.next_id;
+        self.listings.insert(
+            listing,
+            Listing {
+                id,
+                waiting: devices.len(),
+                tools: vec![Vec::new(); self.names.len()],
+            },
+        );
+        devices
+            .into_iter()
+            .map(|device| {
+                let list_id = self.next_id;
+                self.next_id = match self.next_id + 1 {
+                    REMAP_BASE => LIST_ID_BASE,
+                    next => next,
+                };
+                self.asked.insert(list_id, (listing, device));
+                let request = json!({ "jsonrpc": "2.0", "id": list_id, "method": "tools/list" });
+                Route::Device(device, codec::line(request.to_string()))
+            })
+            .collect()
+    }
+
+    fn call(&self, line: &Bytes, id: &RawValue, name: &str) -> Route {
+        let target = name.split_once(SEPARATOR).and_then(|(device, tool)| {
+            let device = self.names.iter().position(|n| n == device)?;
+            Some((device, tool))
+        });
+        let Some((device, tool)) = target else {
+            let response = error_response(id, -32602, &format!("Unknown tool: {}", name));
+            return Route::Warp(codec::line(response.to_string()));
+        };
+        if !self.up[device] {
+            let response = error_response(id, -32000, "ESP32 unreachable");
+            return Route::Warp(codec::line(response.to_string()));
+        }
+
+        // Renaming the tool is the one rewrite a forwarded call needs; the
+        // line already parsed, so this can't fail
+        let mut request = serde_json::from_slice::<Value>(line).unwrap_or_default();
+        request["params"]["name"] = json!(tool);
+        Route::Device(device, codec::line(request.to_string()))
+    }
+
+    /// A reply from a device. Returns what to send Warp: the reply itself, a
+    /// merged tools/list once it's complete, or nothing.
+    pub fn reply(&mut self, line: Bytes) -> Option<Bytes> {
+        // Anything but a reply to the bridge's own tools/list passes through
+        if self.asked.is_empty() {
+            return Some(line);
+        }
+        let asked = Message::parse(&line).ok().and_then(|reply| {
+            let id = reply.single()?.id?.get().parse().ok()?;
+            self.asked.remove(&id)
+        });
+        let Some((listing, device)) = asked else {
+            return Some(line);
+        };
+        let reply = serde_json::from_slice::<Value>(&line).unwrap_or_default();
+
+        let name = &self.names[device];
+        let entry = self.listings.get_mut(&listing)?;
+        entry.waiting -= 1;
+        match reply.pointer("/result/tools").and_then(Value::as_array) {
+            Some(tools) => {
+                entry.tools[device] = tools
+                    .iter()
+                    .cloned()
+                    .map(|mut tool| {
+                        if let Some(tool_name) = tool.get("name").and_then(Value::as_str) {
+                            tool["name"] = json!(format!("{}{}{}", name, SEPARATOR, tool_name));
+                        }
+                        tool
+                    })
+                    .collect()
+            }
+            None => warn!(
+                "Leaving {}'s tools out of tools/list: {}",
+                name,
+                String::from_utf8_lossy(&line).trim_end()
+            ),
+        }
+
+        if entry.waiting > 0 {
+            return None;
+        }
+        let entry = self.listings.remove(&listing)?;
+        let reply = json!({
+            "jsonrpc": "2.0",
+            "id": entry.id,
+            "result": { "tools": entry.tools.concat() }
+        });
+        Some(codec::line(reply.to_string()))
+    }
+
+    /// `device` stopped for good; it's left out from now on. Returns whether
+    /// any device is left.
+    pub fn closed(&mut self, device: usize) -> bool {
+        self.up[device] = false;
+        warn!("Leaving out ESP32 '{}' from now on", self.names[device]);
+        self.up.contains(&true)
+    }
+}
@@ -0,0 +1,569 @@
+// Load generator for an ESP32, or for the host build standing in for one.
+//
+// `esp32-mcp-bridge bench` leaves Warp and stdin out: it opens connections
+// of its own, does the MCP handshake on each as a link would, CBOR framing
+// included, then sends a weighted mix of tools/call requests. Pacing is
+// closed-loop, a fixed number of requests outstanding per connection, or
+// open-loop at a fixed rate. Open-loop latency is measured from when a
+// request was due rather than when it went out, so a device that falls
+// behind can't hide the queueing it causes. The report is JSON.
+
+use crate::codec::{self, DeviceCodec};
+use crate::link::{self, LinkConfig};
+use crate::metrics::{Histogram, Metrics, Peer};
+use crate::BridgeError;
+use bytes::{Bytes, BytesMut};
+use futures::StreamExt;
+use serde::de::IgnoredAny;
+use serde::Deserialize;
+use serde_json::{json, Value};
+use std::collections::HashMap;
+use std::path::PathBuf;
+use std::sync::Arc;
+use tokio::io::{AsyncWriteExt, BufWriter};
+use tokio::net::tcp::{OwnedReadHalf, OwnedWriteHalf};
+use tokio::time::{Duration, Instant, Interval, MissedTickBehavior};
+use tokio_util::codec::FramedRead;
+use tracing::{info, warn};
+
+// How long a run lasts given neither --duration nor --requests
+const DEFAULT_DURATION: Duration = Duration::from_secs(10);
+
+#[derive(clap::Args, Debug)]
+pub struct BenchArgs {
+    /// Connections to open, spread over the devices given
+    #[arg(short = 'n', long, default_value = "4")]
+    connections: usize,
+
+    /// A tool to call, as NAME[:WEIGHT][=ARGUMENTS], e.g.
+    /// compute_add:3={"a":2,"b":3}; repeat for a mix, picked at random by
+    /// weight. Defaults to compute_add
+    #[arg(long = "call", value_parser = parse_call)]
+    calls: Vec<Call>,
+
+    /// Requests per second over all connections, sent on schedule whether
+    /// replies keep up or not. Without it, each connection keeps
+    /// --concurrency requests outstanding
+    #[arg(long)]
+    rate: Option<f64>,
+
+    /// Requests outstanding per connection without --rate
+    #[arg(long, default_value = "1")]
+    concurrency: usize,
+
+    /// Seconds to send for; 10 unless --requests is given
+    #[arg(long, value_parser = crate::parse_seconds)]
+    duration: Option<Duration>,
+
+    /// Requests to send over all connections
+    #[arg(long)]
+    requests: Option<u64>,
+
+    /// Write the report to this file instead of stdout
+    #[arg(long)]
+    output: Option<PathBuf>,
+}
+
+/// One tool in the mix.
+#[derive(Clone, Debug)]
+pub struct Call {
+    name: String,
+    weight: u32,
+    arguments: Value,
+}
+
+fn parse_call(arg: &str) -> Result<Call, String> {
+    let (head, arguments) = match arg.split_once('=') {
+        Some((head, arguments)) => (
+            head,
+            serde_json::from_str(arguments)
+                .map_err(|e| format!("invalid arguments '{}': {}", arguments, e))?,
+        ),
+        None => (arg, json!({})),
+    };
+    if !matches!(arguments, Value::Object(_)) {
+        return Err(format!(
+            "arguments must be a JSON object, got '{}'",
+            arguments
+        ));
+    }
+    let (name, weight) = match head.rsplit_once(':') {
+        Some((name, weight)) => (
+            name,
+            weight
+                .parse()
+                .ok()
+                .filter(|&weight| weight > 0)
+                .ok_or_else(|| format!("invalid weight '{}'", weight))?,
+        ),
+        None => (head, 1),
+    };
+    Ok(Call {
+        name: name.to_string(),
+        weight,
+        arguments,
+    })
+}
+
+/// What every connection sends, and when.
+struct Plan {
+    calls: Vec<Call>,
+    // Each call's request line, up to its id
+    prefixes: Vec<String>,
+    weights: u32,
+    /// Between requests on one connection, when paced by rate.
+    interval: Option<Duration>,
+    concurrency: usize,
+    until: Option<Instant>,
+    /// How long replies are waited for once sending stops.
+    wait: Duration,
+}
+
+impl Plan {
+    /// A call picked by weight.
+    fn pick(&self) -> usize {
+        let mut n = fastrand::u32(..self.weights);
+        self.calls
+            .iter()
+            .position(|call| {
+                let picked = n < call.weight;
+                n = n.saturating_sub(call.weight);
+                picked
+            })
+            .unwrap_or(0)
+    }
+
+    fn line(&self, call: usize, id: u64) -> Bytes {
+        codec::line(format!("{}{}}}", self.prefixes[call], id))
+    }
+}
+
+/// The parts of a reply the report counts.
+#[derive(Deserialize)]
+struct Reply {
+    #[serde(default)]
+    id: Option<u64>,
+    #[serde(default)]
+    error: Option<IgnoredAny>,
+    #[serde(default)]
+    result: Option<Outcome>,
+}
+
+#[derive(Deserialize)]
+struct Outcome {
+    /// A tool that ran and failed.
+    #[serde(default, rename = "isError")]
+    is_error: bool,
+}
+
+/// What one connection saw.
+struct Tally {
+    sent: u64,
+    latency: Histogram,
+    /// Per call, in the order given.
+    calls: Vec<(Histogram, u64)>,
+    rpc_errors: u64,
+    tool_errors: u64,
+    no_reply: u64,
+    connection_errors: u64,
+}
+
+impl Tally {
+    fn new(calls: usize) -> Self {
+        Self {
+            sent: 0,
+            latency: Histogram::default(),
+            calls: (0..calls).map(|_| (Histogram::default(), 0)).collect(),
+            rpc_errors: 0,
+            tool_errors: 0,
+            no_reply: 0,
+            connection_errors: 0,
+        }
+    }
+
+    fn merge(&mut self, other: &Tally) {
+        self.sent += other.sent;
+        self.latency.merge(&other.latency);
+        for ((latency, errors), (other_latency, other_errors)) in
+            self.calls.iter_mut().zip(&other.calls)
+        {
+            latency.merge(other_latency);
+            *errors += other_errors;
+        }
+        self.rpc_errors += other.rpc_errors;
+        self.tool_errors += other.tool_errors;
+        self.no_reply += other.no_reply;
+        self.connection_errors += other.connection_errors;
+    }
+}
+
+/// One connection to the ESP32, past the handshake.
+struct Connection {
+    frames: FramedRead<OwnedReadHalf, DeviceCodec>,
+    writer: BufWriter<OwnedWriteHalf>,
+    frame: BytesMut,
+    peer: Arc<Peer>,
+    /// When each request was due, and its call.
+    outstanding: HashMap<u64, (Instant, usize)>,
+    next_id: u64,
+}
+
+impl Connection {
+    async fn open(config: &LinkConfig, peer: Arc<Peer>) -> Result<Self, BridgeError> {
+        let (reader, writer) = link::connect(config.addr, config.timeout)
+            .await?
+            .into_split();
+        let mut connection = Self {
+            frames: FramedRead::new(reader, DeviceCodec::new(peer.clone())),
+            writer: BufWriter::new(writer),
+            frame: BytesMut::new(),
+            peer,
+            outstanding: HashMap::new(),
+            next_id: 1,
+        };
+
+        let mut initialize = json!({
+            "jsonrpc": "2.0",
+            "id": 0,
+            "method": "initialize",
+            "params": {
+                "protocolVersion": "2024-11-05",
+                "capabilities": {},
+                "clientInfo": {
+                    "name": "esp32-mcp-bridge-bench",
+                    "version": env!("CARGO_PKG_VERSION")
+                }
+            }
+        });
+        if config.negotiate_cbor {
+            link::offer_cbor(&mut initialize);
+        }
+        connection
+            .write(codec::line(initialize.to_string()))
+            .await?;
+
+        let reply = match tokio::time::timeout(config.timeout, connection.frames.next()).await {
+            Ok(Some(reply)) => reply?,
+            Ok(None) => {
+                return Err(BridgeError::Connection(
+                    "Closed during the handshake".to_string(),
+                ))
+            }
+            Err(_) => {
+                return Err(BridgeError::Connection(
+                    "No reply to initialize".to_string(),
+                ))
+            }
+        };
+        let mut reply = serde_json::from_slice::<Value>(&reply)?;
+        if let Some(error) = reply.get("error") {
+            return Err(BridgeError::InvalidResponse(format!(
+                "initialize failed: {}",
+                error
+            )));
+        }
+        if link::accept_cbor(&mut reply) {
+            connection.frames.decoder_mut().cbor = true;
+        }
+
+        let initialized = json!({"jsonrpc": "2.0", "method": "notifications/initialized"});
+        connection
+            .write(codec::line(initialized.to_string()))
+            .await?;
+        Ok(connection)
+    }
+
+    /// Write a request line, as a CBOR frame once that's negotiated.
+    async fn write(&mut self, line: Bytes) -> Result<(), BridgeError> {
+        if self.frames.decoder().cbor {
+            let frame = link::encode_frame(&mut self.frame, &line).map_err(|e| {
+                std::io::Error::new(
+                    std::io::ErrorKind::InvalidData,
+                    format!("Can't encode request: {:?}", e),
+                )
+            })?;
+            self.writer.write_all(&frame).await?;
+            self.peer.sent.record(1, frame.len());
+        } else {
+            self.writer.write_all(&line).await?;
+            self.peer.sent.record(1, line.len());
+        }
+        self.writer.flush().await?;
+        Ok(())
+    }
+
+    async fn send(
+        &mut self,
+        plan: &Plan,
+        due: Instant,
+        tally: &mut Tally,
+    ) -> Result<(), BridgeError> {
+        let call = plan.pick();
+        let id = self.next_id;
+        self.next_id += 1;
+        self.outstanding.insert(id, (due, call));
+        tally.sent += 1;
+        self.write(plan.line(call, id)).await
+    }
+
+    fn received(&mut self, line: &[u8], tally: &mut Tally) {
+        let reply = match serde_json::from_slice::<Reply>(line) {
+            Ok(reply) => reply,
+            Err(e) => {
+                warn!("Invalid reply from ESP32: {}", e);
+                return;
+            }
+        };
+        let Some((due, call)) = reply.id.and_then(|id| self.outstanding.remove(&id)) else {
+            return;
+        };
+
+        let elapsed = due.elapsed();
+        tally.latency.record(elapsed);
+        let (latency, errors) = &mut tally.calls[call];
+        latency.record(elapsed);
+        if reply.error.is_some() {
+            tally.rpc_errors += 1;
+            *errors += 1;
+        } else if reply.result.is_some_and(|result| result.is_error) {
+            tally.tool_errors += 1;
+            *errors += 1;
+        }
+    }
+}
+
+async fn tick(ticks: &mut Option<Interval>) -> Instant {
+    match ticks {
+        Some(ticks) => ticks.tick().await,
+        None => std::future::pending().await,
+    }
+}
+
+/// Send up to `budget` requests on `connection` as planned, then wait for
+/// the replies still due.
+async fn load(
+    connection: &mut Connection,
+    plan: &Plan,
+    budget: u64,
+    tally: &mut Tally,
+) -> Result<(), BridgeError> {
+    let mut ticks = plan.interval.map(|interval| {
+        let mut ticks = tokio::time::interval(interval);
+        // A late tick is sent at once, and its latency counted from when it
+        // was due
+        ticks.set_missed_tick_behavior(MissedTickBehavior::Burst);
+        ticks
+    });
+    if ticks.is_none() {
+        for _ in 0..budget.min(plan.concurrency as u64) {
+            connection.send(plan, Instant::now(), tally).await?;
+        }
+    }
+
+    let mut stopped = None;
+    loop {
+        let sending = stopped.is_none();
+        if sending && (tally.sent >= budget || plan.until.is_some_and(|t| t <= Instant::now())) {
+            stopped = Some(Instant::now() + plan.wait);
+            continue;
+        }
+        if !sending && connection.outstanding.is_empty() {
+            return Ok(());
+        }
+
+        tokio::select! {
+            due = tick(&mut ticks), if sending => {
+                connection.send(plan, due, tally).await?;
+            }
+
+            frame = connection.frames.next() => {
+                match frame {
+                    Some(Ok(line)) => {
+                        connection.received(&line, tally);
+                        if sending && ticks.is_none() {
+                            connection.send(plan, Instant::now(), tally).await?;
+                        }
+                    }
+                    Some(Err(e)) => return Err(e),
+                    None => {
+                        return Err(BridgeError::Connection(
+                            "ESP32 closed the connection".to_string(),
+                        ))
+                    }
+                }
+            }
+
+            _ = tokio::time::sleep_until(plan.until.unwrap_or_else(Instant::now)), if sending && plan.until.is_some() => {}
+
+            _ = tokio::time::sleep_until(stopped.unwrap_or_else(Instant::now)), if !sending => {
+                return Ok(());
+            }
+        }
+    }
+}
+
+async fn connection(config: &LinkConfig, plan: &Plan, budget: u64, peer: Arc<Peer>) -> Tally {
+    let mut tally = Tally::new(plan.calls.len());
+    let mut connection = match Connection::open(config, peer).await {
+        Ok(connection) => connection,
+        Err(e) => {
+            warn!("Can't open a connection to {}: {}", config.addr, e);
+            tally.connection_errors += 1;
+            return tally;
+        }
+    };
+    if let Err(e) = load(&mut connection, plan, budget, &mut tally).await {
+        warn!("Connection to {} failed: {}", config.addr, e);
+        tally.connection_errors += 1;
+    }
+    tally.no_reply += connection.outstanding.len() as u64;
+    tally
+}
+
+fn latency_ms(histogram: &Histogram) -> Value {
+    if histogram.count() == 0 {
+        return Value::Null;
+    }
+    let ms = |micros: f64| micros.round() / 1e3;
+    json!({
+        "p50": ms(histogram.quantile(0.5) as f64),
+        "p90": ms(histogram.quantile(0.9) as f64),
+        "p99": ms(histogram.quantile(0.99) as f64),
+        "max": ms(histogram.quantile(1.0) as f64),
+        "mean": ms(histogram.mean()),
+    })
+}
+
+/// Load the ESP32s in `configs` as `args` asks, and report on it.
+pub async fn run(configs: Vec<LinkConfig>, args: &BenchArgs) -> Result<(), BridgeError> {
+    let calls = if args.calls.is_empty() {
+        vec![Call {
+            name: "compute_add".to_string(),
+            weight: 1,
+            arguments: json!({"a": 2, "b": 3}),
+        }]
+    } else {
+        args.calls.clone()
+    };
+    let connections = args.connections.max(1);
+    let prefixes = calls
+        .iter()
+        .map(|call| {
+            let mut line = json!({
+                "jsonrpc": "2.0",
+                "method": "tools/call",
+                "params": {"name": call.name, "arguments": call.arguments}
+            })
+            .to_string();
+            line.pop();
+            line + ",\"id\":"
+        })
+        .collect();
+    let duration = match (args.duration, args.requests) {
+        (None, Some(_)) => None,
+        (duration, _) => Some(duration.unwrap_or(DEFAULT_DURATION)),
+    };
+    let start = Instant::now();
+    let plan = Arc::new(Plan {
+        weights: calls.iter().map(|call| call.weight).sum(),
+        calls,
+        prefixes,
+        interval: args
+            .rate
+            .filter(|&rate| rate > 0.0)
+            .map(|rate| Duration::from_secs_f64(connections as f64 / rate)),
+        concurrency: args.concurrency.max(1),
+        until: duration.map(|duration| start + duration),
+        wait: configs[0].deadlines.default,
+    });
+
+    info!(
+        "Benchmarking {} with {} connections",
+        configs
+            .iter()
+            .map(|config| config.addr.to_string())
+            .collect::<Vec<_>>()
+            .join(", "),
+        connections
+    );
+    let metrics = Metrics::new();
+    let peers: Vec<_> = configs
+        .iter()
+        .map(|config| metrics.device(&config.addr.to_string()))
+        .collect();
+    let configs = Arc::new(configs);
+    let tasks: Vec<_> = (0..connections)
+        .map(|i| {
+            // The requests are shared out evenly
+            let budget = args.requests.map_or(u64::MAX, |requests| {
+                requests / connections as u64
+                    + u64::from((i as u64) < requests % connections as u64)
+            });
+            let (configs, plan) = (configs.clone(), plan.clone());
+            let peer = peers[i % peers.len()].clone();
+            tokio::spawn(async move {
+                connection(&configs[i % configs.len()], &plan, budget, peer).await
+            })
+        })
+        .collect();
+
+    let mut tally = Tally::new(plan.calls.len());
+    for task in futures::future::join_all(tasks).await {
+        match task {
+            Ok(connection) => tally.merge(&connection),
+            Err(_) => tally.connection_errors += 1,
+        }
+    }
+    let seconds = start.elapsed().as_secs_f64();
+
+    let completed = tally.latency.count();
+    let (mut bytes_sent, mut bytes_received) = (0, 0);
+    for peer in &peers {
+        bytes_sent += peer.sent.totals().1;
+        bytes_received += peer.received.totals().1;
+    }
+    let report = json!({
+        "targets": configs.iter().map(|config| config.addr.to_string()).collect::<Vec<_>>(),
+        "connections": connections,
+        "pacing": if plan.interval.is_some() { "open" } else { "closed" },
+        "rate": args.rate,
+        "concurrency": plan.interval.is_none().then_some(plan.concurrency),
+        "seconds": seconds,
+        "sent": tally.sent,
+        "completed": completed,
+        "throughput": completed as f64 / seconds,
+        "bytes_sent": bytes_sent,
+        "bytes_received": bytes_received,
+        "latency_ms": latency_ms(&tally.latency),
+        "errors": {
+            "rpc": tally.rpc_errors,
+            "tool": tally.tool_errors,
+            "no_reply": tally.no_reply,
+            "connection": tally.connection_errors,
+        },
+        "calls": plan.calls.iter().zip(&tally.calls).map(|(call, (latency, errors))| json!({
+            "name": call.name,
+            "weight": call.weight,
+            "completed": latency.count(),
+            "errors": errors,
+            "latency_ms": latency_ms(latency),
+        })).collect::<Vec<_>>(),
+    });
+    info!(
+        "{} requests completed in {:.1}s, {:.0}/s",
+        completed,
+        seconds,
+        completed as f64 / seconds
+    );
+
+    let report = serde_json::to_string_pretty(&report)? + "\n";
+    match &args.output {
+        Some(path) => tokio::fs::write(path, report).await?,
+        None => {
+            let mut stdout = tokio::io::stdout();
+            stdout.write_all(report.as_bytes()).await?;
+            stdout.flush().await?;
+        }
+    }
+    Ok(())
+}
@@ -0,0 +1,170 @@
+// Replies the ESP32 gives identically every session, kept so repeat requests
+// are answered without a round trip.
+//
+// The firmware advertises `"listChanged":false`, so its initialize and
+// tools/list results only change with the firmware. Entries are kept per
+// device and tagged with the firmware's `serverInfo`; an initialize reply
+// with a different `serverInfo` replaces the entry. With a cache directory,
+// each device's entry is also saved to `<dir>/<address>.json` and loaded on
+// the next start.
+//
+// The tools a tools/list annotates as safe to call twice are kept apart from
+// the entry, from every page the device sends, so reconnects can retry calls
+// to them with or without a cache directory.
+
+use crate::message::Message;
+use serde::{Deserialize, Serialize};
+use serde_json::{json, Value};
+use std::collections::HashSet;
+use std::fs;
+use std::net::SocketAddr;
+use std::path::{Path, PathBuf};
+use tracing::{debug, warn};
+
+#[derive(Serialize, Deserialize)]
+struct Entry {
+    initialize: Value,
+    #[serde(rename = "tools/list")]
+    tools_list: Option<Value>,
+}
+
+pub struct ResponseCache {
+    path: Option<PathBuf>,
+    entry: Option<Entry>,
+    /// Tools annotated read-only or idempotent by the current firmware.
+    retry_safe: HashSet<String>,
+}
+
+/// The tools `result`, a tools/list page, annotates as read-only or
+/// idempotent, so calling them twice does no harm.
+fn retry_safe_tools(result: &Value) -> impl Iterator<Item = &str> {
+    let tools = result.get("tools").and_then(Value::as_array);
+    tools.into_iter().flatten().filter_map(|tool| {
+        let hints = tool.get("annotations")?;
+        ["readOnlyHint", "idempotentHint"]
+            .iter()
+            .any(|hint| hints.get(hint) == Some(&Value::Bool(true)))
+            .then(|| tool.get("name")?.as_str())
+            .flatten()
+    })
+}
+
+impl ResponseCache {
+    /// The cache for one device, loaded from `dir` if given.
+    pub fn open(dir: Option<&Path>, device: SocketAddr) -> Self {
+        let path = dir.map(|dir| {
+            let name: String = device
+                .to_string()
+                .chars()
+                .map(|c| {
+                    if c.is_ascii_alphanumeric() || c == '.' {
+                        c
+                    } else {
+                        '_'
+                    }
+                })
+                .collect();
+            dir.join(name + ".json")
+        });
+
+        let entry: Option<Entry> = path.as_deref().and_then(|path| {
+            let data = fs::read(path).ok()?;
+            match serde_json::from_slice(&data) {
+                Ok(entry) => {
+                    debug!("Loaded cached responses from {}", path.display());
+                    Some(entry)
+                }
+                Err(e) => {
+                    warn!("Ignoring unreadable cache {}: {}", path.display(), e);
+                    None
+                }
+            }
+        });
+
+        let retry_safe = entry
+            .as_ref()
+            .and_then(|entry| entry.tools_list.as_ref())
+            .map(|result| retry_safe_tools(result).map(String::from).collect())
+            .unwrap_or_default();
+        Self {
+            path,
+            entry,
+            retry_safe,
+        }
+    }
+
+    /// The cached reply to `request`, with its id, if it's a request the
+    /// cache answers and has a result for.
+    pub fn reply(&self, request: &Message) -> Option<String> {
+        let entry = self.entry.as_ref()?;
+        let request = request.single()?;
+        let result = match request.method.as_deref()? {
+            "initialize" => &entry.initialize,
+            // Pages past the first aren't cached
+            "tools/list" if request.params.as_ref().map_or(true, |p| p.cursor.is_none()) => {
+                entry.tools_list.as_ref()?
+            }
+            _ => return None,
+        };
+        let reply = json!({ "jsonrpc": "2.0", "id": request.id?, "result": result });
+        Some(reply.to_string())
+    }
+
+    /// Whether a tools/list from this firmware, live or cached, annotates
+    /// `tool` as read-only or idempotent.
+    pub fn retry_safe(&self, tool: &str) -> bool {
+        self.retry_safe.contains(tool)
+    }
+
+    /// Record the device's initialize result. Returns whether it replaced
+    /// responses cached for other firmware.
+    pub fn store_initialize(&mut self, result: &Value) -> bool {
+        let same_firmware = self
+            .entry
+            .as_ref()
+            .is_some_and(|entry| entry.initialize.get("serverInfo") == result.get("serverInfo"));
+        if same_firmware {
+            return false;
+        }
+
+        let replaced = self.entry.is_some();
+        self.retry_safe.clear();
+        self.entry = Some(Entry {
+            initialize: result.clone(),
+            tools_list: None,
+        });
+        self.save();
+        replaced
+    }
+
+    /// Record the tools a tools/list page annotates as safe to retry, and
+    /// the whole result if it's a single page. That is only kept alongside
+    /// the initialize result of the same firmware.
+    pub fn store_tools_list(&mut self, result: &Value) {
+        self.retry_safe
+            .extend(retry_safe_tools(result).map(String::from));
+        if let Some(entry) = &mut self.entry {
+            if result.get("nextCursor").is_none() && entry.tools_list.as_ref() != Some(result) {
+                entry.tools_list = Some(result.clone());
+                self.save();
+            }
+        }
+    }
+
+    fn save(&self) {
+        let (Some(path), Some(entry)) = (&self.path, &self.entry) else {
+            return;
+        };
+        // Write a sibling file and rename it so a crash never leaves a torn cache
+        let tmp = path.with_extension("json.tmp");
+        let written = path
+            .parent()
+            .map_or(Ok(()), fs::create_dir_all)
+            .and_then(|_| fs::write(&tmp, serde_json::to_vec_pretty(entry).unwrap_or_default()))
+            .and_then(|_| fs::rename(&tmp, path));
+        match written {
+            Ok(()) => debug!("Saved cached responses to {}", path.display()),
+            Err(e) => warn!("Failed to save cache {}: {}", path.display(), e),
+        }
+    }
+}
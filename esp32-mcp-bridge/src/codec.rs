@@ -0,0 +1,169 @@
+// Framing for both sides of the bridge.
+//
+// Lines are split off the read buffer with their newline, so a line that's
+// forwarded as it came goes out in one write without being copied.
+
+use crate::metrics::Peer;
+use crate::BridgeError;
+use bytes::{Buf, Bytes, BytesMut};
+use esp32_c6_mcp_rs::cbor;
+use std::sync::Arc;
+use tokio_util::codec::Decoder;
+use tracing::warn;
+
+/// Longest line or frame either side may send. Far more than any MCP message
+/// the firmware's buffers hold, and far less than a corrupt length prefix, or
+/// a peer that never sends a newline, can make the bridge buffer.
+pub const MAX_FRAME: usize = 1 << 20;
+
+/// Newline-delimited JSON, as Warp and the ESP32 speak it.
+#[derive(Default)]
+pub struct LineCodec {
+    // Bytes already searched for a newline
+    searched: usize,
+}
+
+impl Decoder for LineCodec {
+    type Item = Bytes;
+    type Error = BridgeError;
+
+    fn decode(&mut self, src: &mut BytesMut) -> Result<Option<Bytes>, BridgeError> {
+        match memchr::memchr(b'\n', &src[self.searched..]) {
+            // The newline isn't counted
+            Some(i) if self.searched + i > MAX_FRAME => Err(line_too_long()),
+            Some(i) => {
+                let end = self.searched + i + 1;
+                self.searched = 0;
+                Ok(Some(src.split_to(end).freeze()))
+            }
+            None if src.len() > MAX_FRAME => Err(line_too_long()),
+            None => {
+                self.searched = src.len();
+                Ok(None)
+            }
+        }
+    }
+
+    fn decode_eof(&mut self, src: &mut BytesMut) -> Result<Option<Bytes>, BridgeError> {
+        if let Some(line) = self.decode(src)? {
+            return Ok(Some(line));
+        }
+        // A last line without its newline
+        self.searched = 0;
+        if src.iter().all(u8::is_ascii_whitespace) {
+            src.clear();
+            return Ok(None);
+        }
+        let mut line = src.split();
+        line.extend_from_slice(b"\n");
+        Ok(Some(line.freeze()))
+    }
+}
+
+fn line_too_long() -> BridgeError {
+    BridgeError::Io(std::io::Error::new(
+        std::io::ErrorKind::InvalidData,
+        format!("line over the {}-byte limit", MAX_FRAME),
+    ))
+}
+
+/// A JSON text as a line to forward.
+pub fn line(mut json: String) -> Bytes {
+    json.push('\n');
+    json.into()
+}
+
+pub fn is_blank(line: &[u8]) -> bool {
+    line.iter().all(u8::is_ascii_whitespace)
+}
+
+/// Splits what the ESP32 sends into JSON lines: as they come until CBOR
+/// framing is negotiated, then length-prefixed CBOR frames transcoded back
+/// to JSON. What it reads is counted as received from `peer` as it was on
+/// the wire.
+pub struct DeviceCodec {
+    pub cbor: bool,
+    lines: LineCodec,
+    // JSON of a batch reply whose frames are still arriving
+    batch: Option<String>,
+    peer: Arc<Peer>,
+}
+
+impl DeviceCodec {
+    pub fn new(peer: Arc<Peer>) -> Self {
+        Self {
+            cbor: false,
+            lines: LineCodec::default(),
+            batch: None,
+            peer,
+        }
+    }
+}
+
+impl Decoder for DeviceCodec {
+    type Item = Bytes;
+    type Error = BridgeError;
+
+    fn decode(&mut self, src: &mut BytesMut) -> Result<Option<Bytes>, BridgeError> {
+        if !self.cbor {
+            let line = self.lines.decode(src)?;
+            if let Some(line) = &line {
+                self.peer.received.record(1, line.len());
+            }
+            return Ok(line);
+        }
+
+        loop {
+            let Some(prefix) = src.get(..cbor::PREFIX_LEN) else {
+                return Ok(None);
+            };
+            let len = u32::from_be_bytes([prefix[0], prefix[1], prefix[2], prefix[3]]) as usize;
+            if len > MAX_FRAME {
+                return Err(BridgeError::InvalidResponse(format!(
+                    "{}-byte CBOR frame, over the {}-byte limit",
+                    len, MAX_FRAME
+                )));
+            }
+            if src.len() < cbor::PREFIX_LEN + len {
+                src.reserve(cbor::PREFIX_LEN + len - src.len());
+                return Ok(None);
+            }
+            src.advance(cbor::PREFIX_LEN);
+            let frame = src.split_to(len);
+            self.peer.received.record(0, cbor::PREFIX_LEN + len);
+
+            // A batch reply is a run of frames: the array start, one complete
+            // reply each, and the break. Each is transcoded once, as it comes
+            match (self.batch.as_mut(), &frame[..]) {
+                (_, []) => warn!("Skipping empty CBOR frame from ESP32"),
+                (None, [cbor::ARRAY_START]) => self.batch = Some(String::from("[")),
+                (Some(_), [cbor::BREAK]) => {
+                    let mut json = self.batch.take().unwrap_or_default();
+                    json.push(']');
+                    self.peer.received.record(1, 0);
+                    return Ok(Some(line(json)));
+                }
+                (Some(json), frame) => {
+                    let start = json.len();
+                    if start > 1 {
+                        json.push(',');
+                    }
+                    if let Err(e) = cbor::decode_json(frame, json) {
+                        warn!("Invalid CBOR in batch reply from ESP32: {:?}", e);
+                        json.truncate(start);
+                    }
+                }
+                (None, frame) => {
+                    let mut json = String::new();
+                    match cbor::decode_json(frame, &mut json) {
+                        Ok(_) => {
+                            self.peer.received.record(1, 0);
+                            return Ok(Some(line(json)));
+                        }
+                        Err(e) => warn!("Invalid CBOR from ESP32: {:?}", e),
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,174 @@
+// Requests forwarded to the ESP32 that haven't been answered yet.
+//
+// Replies are matched by id. A batch is one entry holding all its ids, and
+// its reply array is matched by the first id it carries.
+//
+// A request the ESP32 couldn't parse is answered with a null id. The ESP32
+// answers in order, so that reply goes to the oldest single request Warp
+// still waits for.
+//
+// Each request from Warp has a deadline. Once it passes, Warp is answered
+// with a timeout error, and the request stays for a while so a late reply
+// can be dropped rather than answer the same id twice.
+
+use crate::message::Message;
+use bytes::Bytes;
+use serde_json::value::RawValue;
+use std::collections::HashMap;
+use std::time::{Duration, Instant};
+
+/// How long a request Warp was told timed out waits for its late reply.
+const LATE_REPLY_GRACE: Duration = Duration::from_secs(30);
+
+pub struct Request {
+    /// Ids the reply answers: one, or every id in a batch. Empty for
+    /// notifications, which get no reply.
+    pub ids: Vec<Box<RawValue>>,
+    /// Method of a single request.
+    pub method: Option<String>,
+    /// Tool of a single tools/call.
+    pub tool: Option<String>,
+    pub batch: bool,
+    /// The request as Warp sent it, newline included.
+    pub line: Bytes,
+    /// Safe to send again after the connection drops.
+    pub retry: bool,
+    /// When it was last written to the ESP32.
+    pub sent: Option<Instant>,
+    /// When Warp stops waiting. None for the bridge's own requests.
+    pub deadline: Option<Instant>,
+    /// Warp was answered with a timeout error; the reply is read but dropped.
+    pub answered: bool,
+}
+
+impl Request {
+    pub fn new(request: &Message, line: Bytes, retry: bool) -> Self {
+        let single = request.single();
+        Self {
+            ids: request.ids().map(RawValue::to_owned).collect(),
+            method: single.and_then(|r| r.method.as_deref()).map(String::from),
+            tool: request
+                .is_method("tools/call")
+                .then(|| request.tool())
+                .flatten()
+                .map(String::from),
+            batch: single.is_none(),
+            line,
+            retry,
+            sent: None,
+            deadline: None,
+            answered: false,
+        }
+    }
+
+    pub fn is_method(&self, method: &str) -> bool {
+        self.method.as_deref() == Some(method)
+    }
+
+    /// Warp is still waiting for it.
+    pub fn waiting(&self) -> bool {
+        self.deadline.is_some() && !self.answered
+    }
+
+    /// When it stops being tracked: at its deadline while Warp waits, and
+    /// once a late reply is unlikely after that.
+    fn due(&self) -> Option<Instant> {
+        let deadline = self.deadline?;
+        Some(match self.answered {
+            false => deadline,
+            true => deadline + LATE_REPLY_GRACE,
+        })
+    }
+}
+
+/// How long Warp waits for each kind of request.
+#[derive(Clone)]
+pub struct Deadlines {
+    pub default: Duration,
+    /// By method, or by tool name for tools/call.
+    pub methods: HashMap<String, Duration>,
+}
+
+impl Deadlines {
+    /// The deadline for `request`, from its tool, then its method. A batch
+    /// gets the default.
+    pub fn get(&self, request: &Message) -> Duration {
+        let tool = request
+            .is_method("tools/call")
+            .then(|| request.tool())
+            .flatten();
+        let method = request
+            .single()
+            .and_then(|envelope| envelope.method.as_deref());
+        [tool, method]
+            .into_iter()
+            .flatten()
+            .find_map(|name| self.methods.get(name))
+            .copied()
+            .unwrap_or(self.default)
+    }
+
+    pub fn longest(&self) -> Duration {
+        self.methods
+            .values()
+            .copied()
+            .fold(self.default, Duration::max)
+    }
+}
+
+#[derive(Default)]
+pub struct InFlight(Vec<Request>);
+
+impl InFlight {
+    pub fn insert(&mut self, request: Request) {
+        self.0.push(request);
+    }
+
+    /// Remove and return the request `reply` answers.
+    pub fn complete(&mut self, reply: &Message) -> Option<Request> {
+        let i = match reply.ids().next() {
+            Some(id) => self
+                .0
+                .iter()
+                .position(|request| request.ids.iter().any(|r| r.get() == id.get()))?,
+            // Not a notification, so an error about a request it couldn't
+            // parse
+            None if reply.single().is_some_and(|r| r.method.is_none()) => self
+                .0
+                .iter()
+                .position(|request| !request.batch && request.waiting())?,
+            None => return None,
+        };
+        Some(self.0.remove(i))
+    }
+
+    /// Drop the requests whose late reply didn't come in time, mark the
+    /// requests Warp waits for past `now` as answered, and return those.
+    pub fn expire(&mut self, now: Instant) -> impl Iterator<Item = &Request> + '_ {
+        self.0
+            .retain(|request| !(request.answered && request.due() <= Some(now)));
+        self.0
+            .iter_mut()
+            .filter(move |request| request.waiting() && request.deadline <= Some(now))
+            .map(|request| {
+                request.answered = true;
+                &*request
+            })
+    }
+
+    /// When the next request Warp waits for runs out of time, or one it was
+    /// told timed out stops waiting for its reply.
+    pub fn next_deadline(&self) -> Option<Instant> {
+        self.0.iter().filter_map(Request::due).min()
+    }
+
+    /// Whether Warp waits for any reply.
+    pub fn waiting(&self) -> bool {
+        self.0.iter().any(Request::waiting)
+    }
+
+    /// Remove every request, oldest first.
+    pub fn drain(&mut self) -> impl Iterator<Item = Request> + '_ {
+        self.0.drain(..)
+    }
+}
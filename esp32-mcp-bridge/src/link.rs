@@ -0,0 +1,871 @@
+// The bridge's side of one ESP32: its connection, framing negotiation,
+// reconnects and the requests in flight on it.
+//
+// Each link runs as its own task. The session queues request lines from
+// Warp for it; the link queues replies, and the errors it answers itself,
+// straight for Warp's stdout. Writes to the ESP32 go through a queue to a
+// writer task of their own. The link only takes a request while that queue
+// has room and stops reading the ESP32 while a reply waits for room in
+// Warp's, so a slow side holds up just the direction going to it.
+
+use crate::aggregate::Aggregate;
+use crate::cache::ResponseCache;
+use crate::codec::{self, DeviceCodec};
+use crate::inflight::{Deadlines, InFlight, Request};
+use crate::message::{id_is, Message};
+use crate::metrics::{Metrics, Peer};
+use crate::queue::{self, Permit, Queue, Stats};
+use crate::remap::Remap;
+use crate::{error_response, BridgeError};
+use bytes::{Bytes, BytesMut};
+use esp32_c6_mcp_rs::cbor::{self, CborError};
+use futures::StreamExt;
+use serde_json::{json, Value};
+use std::collections::VecDeque;
+use std::net::SocketAddr;
+use std::sync::{Arc, Mutex};
+use std::time::Instant;
+use tokio::net::tcp::OwnedReadHalf;
+use tokio::net::TcpStream;
+use tokio::sync::mpsc;
+use tokio::task::JoinHandle;
+use tokio::time::Duration;
+use tokio_util::codec::FramedRead;
+use tracing::{debug, error, info, warn};
+
+/// Id of initialize requests the bridge sends itself: after answering Warp's
+/// from the cache, and to replay the handshake after a reconnect. Their
+/// replies aren't forwarded. The firmware only takes numeric ids, so Warp's
+/// requests with this id or near it go on under stand-ins (`remap`).
+pub const BRIDGE_INIT_ID: u32 = u32::MAX;
+
+// Reconnect delays double from the base up to the cap
+const BACKOFF_BASE: Duration = Duration::from_millis(100);
+const BACKOFF_MAX: Duration = Duration::from_secs(5);
+
+/// Tells the session a link stopped for good, because it couldn't connect,
+/// with the error, or gave up reconnecting. Everything sent to it has been
+/// answered by then.
+pub type Closed = mpsc::UnboundedSender<(usize, Option<BridgeError>)>;
+
+pub struct LinkConfig {
+    pub addr: SocketAddr,
+    pub timeout: Duration,
+    pub reconnect_attempts: u32,
+    pub negotiate_cbor: bool,
+    pub queue_depth: usize,
+    pub deadlines: Deadlines,
+}
+
+/// Where replies for Warp go: its stdout queue, by way of the tools/list
+/// merging when several devices are served and with Warp's own ids back.
+#[derive(Clone)]
+pub struct Replies {
+    pub queue: Queue<Bytes>,
+    pub aggregate: Option<Arc<Mutex<Aggregate>>>,
+    pub remap: Arc<Mutex<Remap>>,
+}
+
+impl Replies {
+    /// What of a reply from a device goes on to Warp.
+    fn filter(&self, line: Bytes) -> Option<Bytes> {
+        let line = match &self.aggregate {
+            Some(aggregate) => aggregate.lock().unwrap().reply(line)?,
+            None => line,
+        };
+        Some(self.remap.lock().unwrap().reply(line))
+    }
+
+    pub async fn send(&self, line: Bytes) -> Result<(), BridgeError> {
+        match self.filter(line) {
+            Some(line) => self
+                .queue
+                .send(line)
+                .await
+                .map_err(|_| BridgeError::SessionClosed),
+            None => Ok(()),
+        }
+    }
+}
+
+/// Start the link task for one ESP32. Returns where to queue it request
+/// lines, and the task, which ends once that queue is closed and drained.
+pub fn spawn(
+    index: usize,
+    config: LinkConfig,
+    cache: ResponseCache,
+    replies: Replies,
+    closed: Closed,
+    metrics: &Metrics,
+) -> (Queue<Bytes>, JoinHandle<()>) {
+    let request_stats = Stats::new(format!("requests to {}", config.addr), config.queue_depth);
+    let frame_stats = Stats::new(format!("frames to {}", config.addr), config.queue_depth);
+    let (requests, queue) = queue::bounded(request_stats.clone());
+    let link = Link {
+        index,
+        closed,
+        replies,
+        request_stats,
+        frame_stats,
+        metrics: metrics.device(&config.addr.to_string()),
+        config,
+        cache,
+        device: None,
+        reconnecting: None,
+        gave_up: false,
+        handshake: None,
+        initialized_notification: false,
+        inflight: InFlight::default(),
+        held: VecDeque::new(),
+        reply: None,
+        frame: BytesMut::new(),
+    };
+    (requests, tokio::spawn(run(link, queue)))
+}
+
+/// The reply answering each id in `request` with the same error, if it has
+/// any: one error, or an array of them for a batch.
+pub fn failure(request: &Request, code: i32, message: &str) -> Option<Bytes> {
+    let errors: Vec<Value> = request
+        .ids
+        .iter()
+        .map(|id| error_response(id, code, message))
+        .collect();
+    let response = match (request.batch, errors.as_slice()) {
+        (_, []) => return None,
+        (false, [error]) => error.clone(),
+        _ => Value::Array(errors),
+    };
+    Some(codec::line(response.to_string()))
+}
+
+/// Ask the ESP32 for CBOR framing in Warp's initialize request. Returns the
+/// request id if `request` is one.
+pub fn offer_cbor(request: &mut Value) -> Option<Value> {
+    if request.get("method")?.as_str()? != "initialize" {
+        return None;
+    }
+    let id = request.get("id")?.clone();
+    request
+        .get_mut("params")?
+        .as_object_mut()?
+        .entry("capabilities")
+        .or_insert_with(|| json!({}))
+        .as_object_mut()?
+        .entry("experimental")
+        .or_insert_with(|| json!({}))
+        .as_object_mut()?
+        .insert(cbor::CAPABILITY.to_string(), json!({}));
+    Some(id)
+}
+
+/// Whether the ESP32 accepted CBOR framing in its initialize reply. Warp
+/// didn't offer it, so the capability is removed before the reply goes on.
+pub fn accept_cbor(response: &mut Value) -> bool {
+    let Some(capabilities) = response
+        .pointer_mut("/result/capabilities")
+        .and_then(Value::as_object_mut)
+    else {
+        return false;
+    };
+    let Some(experimental) = capabilities
+        .get_mut("experimental")
+        .and_then(Value::as_object_mut)
+    else {
+        return false;
+    };
+    let accepted = experimental.remove(cbor::CAPABILITY).is_some();
+    if experimental.is_empty() {
+        capabilities.remove("experimental");
+    }
+    accepted
+}
+
+/// Frame one JSON request line as length-prefixed CBOR.
+pub fn encode_frame(frame: &mut BytesMut, line: &[u8]) -> Result<Bytes, CborError> {
+    let json = std::str::from_utf8(line).map_err(|e| CborError::Invalid(e.valid_up_to()))?;
+    frame.clear();
+    frame.extend_from_slice(&[0; cbor::PREFIX_LEN]);
+    let len = cbor::encode_json(json.trim_end(), |b| frame.extend_from_slice(b))? as u32;
+    frame[..cbor::PREFIX_LEN].copy_from_slice(&len.to_be_bytes());
+    Ok(frame.split().freeze())
+}
+
+pub async fn connect(esp32_addr: SocketAddr, timeout: Duration) -> Result<TcpStream, BridgeError> {
+    let esp32_stream = tokio::time::timeout(timeout, TcpStream::connect(esp32_addr))
+        .await
+        .map_err(|_| {
+            BridgeError::Connection(format!(
+                "Connection timeout after {} seconds",
+                timeout.as_secs()
+            ))
+        })?
+        .map_err(|e| BridgeError::Connection(format!("Failed to connect: {}", e)))?;
+
+    // Set TCP_NODELAY to reduce latency
+    if let Err(e) = esp32_stream.set_nodelay(true) {
+        warn!("Failed to set TCP_NODELAY: {}", e);
+    }
+    Ok(esp32_stream)
+}
+
+/// Connect again after the connection dropped, backing off exponentially
+/// with full jitter so bridges that lost the same device don't retry in
+/// step. Gives up after `attempts` failures.
+async fn reconnect(esp32_addr: SocketAddr, timeout: Duration, attempts: u32) -> Option<TcpStream> {
+    for attempt in 0..attempts {
+        let cap = BACKOFF_BASE
+            .saturating_mul(1 << attempt.min(16))
+            .min(BACKOFF_MAX);
+        tokio::time::sleep(cap.mul_f64(fastrand::f64())).await;
+
+        match connect(esp32_addr, timeout).await {
+            Ok(stream) => return Some(stream),
+            Err(e) => warn!(
+                "Reconnect attempt {}/{} to {} failed: {}",
+                attempt + 1,
+                attempts,
+                esp32_addr,
+                e
+            ),
+        }
+    }
+    None
+}
+
+/// One connection to the ESP32.
+struct Device {
+    frames: FramedRead<OwnedReadHalf, DeviceCodec>,
+    /// Frames for the writer task, which ends if a write fails.
+    writer: Queue<Bytes>,
+    writing: JoinHandle<std::io::Result<()>>,
+    /// An initialize was sent on this connection.
+    initialized: bool,
+    /// That initialize offered CBOR framing and awaits its reply; later
+    /// requests are held until then.
+    negotiating: bool,
+}
+
+impl Device {
+    fn new(stream: TcpStream, stats: Arc<Stats>, peer: Arc<Peer>) -> Self {
+        let (reader, writer) = stream.into_split();
+        let (queue, frames) = queue::bounded(stats);
+        Self {
+            frames: FramedRead::new(reader, DeviceCodec::new(peer.clone())),
+            writer: queue,
+            writing: queue::spawn_writer(writer, frames, peer),
+            initialized: false,
+            negotiating: false,
+        }
+    }
+}
+
+/// One ESP32 in Warp's MCP session, which outlives connections to it.
+struct Link {
+    index: usize,
+    closed: Closed,
+    replies: Replies,
+    request_stats: Arc<Stats>,
+    frame_stats: Arc<Stats>,
+    metrics: Arc<Peer>,
+    config: LinkConfig,
+    cache: ResponseCache,
+    device: Option<Device>,
+    reconnecting: Option<JoinHandle<Option<TcpStream>>>,
+    /// A write found the connection gone with reconnecting off; the serve
+    /// loop gives up before taking anything else.
+    gave_up: bool,
+    /// Warp's initialize and whether it sent notifications/initialized, for
+    /// replaying the handshake on a new connection.
+    handshake: Option<Value>,
+    initialized_notification: bool,
+    inflight: InFlight,
+    /// Requests waiting for a connection or the end of a negotiation.
+    held: VecDeque<Request>,
+    /// A reply read from the ESP32 that waits for room in Warp's queue; the
+    /// ESP32 isn't read meanwhile.
+    reply: Option<Bytes>,
+    frame: BytesMut,
+}
+
+impl Link {
+    async fn to_warp(&mut self, line: Bytes) -> Result<(), BridgeError> {
+        self.replies.send(line).await
+    }
+
+    /// Answer each id in `request` with the same error.
+    async fn fail(&mut self, request: &Request, message: &str) -> Result<(), BridgeError> {
+        match failure(request, -32000, message) {
+            Some(response) => self.to_warp(response).await,
+            None => Ok(()),
+        }
+    }
+
+    /// A request may be sent again after a reconnect if the firmware serves
+    /// it without side effects, or the tool is annotated as idempotent.
+    fn retry_safe(&self, request: &Message) -> bool {
+        let envelopes = match request {
+            Message::Single(envelope) => std::slice::from_ref(envelope),
+            Message::Batch(envelopes) => envelopes.as_slice(),
+        };
+        envelopes.iter().all(|envelope| {
+            envelope.method.as_deref() != Some("tools/call")
+                || envelope
+                    .params
+                    .as_ref()
+                    .and_then(|params| params.name.as_deref())
+                    .is_some_and(|tool| self.cache.retry_safe(tool))
+        })
+    }
+
+    async fn from_warp(&mut self, line: Bytes) -> Result<(), BridgeError> {
+        if codec::is_blank(&line) {
+            return Ok(());
+        }
+
+        debug!(
+            "Received from Warp: {}",
+            String::from_utf8_lossy(&line).trim_end()
+        );
+
+        // Validate JSON before forwarding
+        let request = match Message::parse(&line) {
+            Ok(request) => request,
+            Err(e) => {
+                warn!("Invalid JSON from Warp, skipping: {}", e);
+
+                // Send error response back to Warp
+                let response = error_response(&Value::Null, -32700, "Parse error");
+                return self.to_warp(codec::line(response.to_string())).await;
+            }
+        };
+
+        let retry = self.retry_safe(&request);
+        if let Some(reply) = self.cache.reply(&request) {
+            // The session's own initialize only primes the link
+            if !request.ids().any(|id| id_is(id, BRIDGE_INIT_ID)) {
+                debug!("Answered from cache: {}", reply);
+                self.to_warp(codec::line(reply)).await?;
+            }
+
+            // The first initialize still goes to the ESP32, under the bridge's
+            // own id, to check the firmware version and negotiate framing
+            if self.handshake.is_some() || !request.is_method("initialize") {
+                return Ok(());
+            }
+            let mut handshake = serde_json::from_slice::<Value>(&line)?;
+            handshake["id"] = json!(BRIDGE_INIT_ID);
+            let line = codec::line(handshake.to_string());
+            self.handshake = Some(handshake);
+            let request = Message::parse(&line)?;
+            return self.send(Request::new(&request, line.clone(), retry)).await;
+        }
+
+        if request.is_method("initialize") && self.handshake.is_none() {
+            self.handshake = Some(serde_json::from_slice(&line)?);
+        } else if request.is_method("notifications/initialized") {
+            self.initialized_notification = true;
+        }
+
+        // Warp doesn't wait on the handshake passed on under the bridge's id,
+        // so it never times out
+        let deadline = Instant::now() + self.config.deadlines.get(&request);
+        let mut request = Request::new(&request, line.clone(), retry);
+        if !request.ids.is_empty() && !request.ids.iter().any(|id| id_is(id, BRIDGE_INIT_ID)) {
+            request.deadline = Some(deadline);
+        }
+        self.send(request).await
+    }
+
+    /// When the next request Warp waits for runs out of time, or one it was
+    /// told timed out stops being tracked.
+    fn next_deadline(&self) -> Option<Instant> {
+        let held = self.held.iter().filter_map(|request| request.deadline);
+        self.inflight.next_deadline().into_iter().chain(held).min()
+    }
+
+    /// Whether Warp waits for any reply from this link.
+    fn waiting(&self) -> bool {
+        self.inflight.waiting() || self.held.iter().any(Request::waiting) || self.reply.is_some()
+    }
+
+    /// Answer Warp for each request that ran out of time. One sent to the
+    /// ESP32 stays tracked so its late reply is dropped; one still held is
+    /// never sent.
+    async fn expire(&mut self) -> Result<(), BridgeError> {
+        let now = Instant::now();
+        let (expired, held): (VecDeque<_>, _) = self
+            .held
+            .drain(..)
+            .partition(|request| request.deadline.is_some_and(|d| d <= now));
+        self.held = held;
+
+        let mut timeouts = Vec::new();
+        for request in self.inflight.expire(now).chain(&expired) {
+            warn!(
+                "ESP32 at {} didn't answer in time: {}",
+                self.config.addr,
+                String::from_utf8_lossy(&request.line).trim_end()
+            );
+            self.metrics.timed_out(request);
+            timeouts.extend(failure(request, -32001, "Request timed out"));
+        }
+        for response in timeouts {
+            self.to_warp(response).await?;
+        }
+        Ok(())
+    }
+
+    /// Pass a reply from the ESP32 on to Warp, in the room kept for it.
+    fn forward(&self, line: Bytes, permit: Option<Permit<'_, Bytes>>) -> Result<(), BridgeError> {
+        match (self.replies.filter(line), permit) {
+            (Some(line), Some(permit)) => {
+                debug!(
+                    "Forwarded to Warp: {}",
+                    String::from_utf8_lossy(&line).trim_end()
+                );
+                permit.send(line);
+                Ok(())
+            }
+            (None, _) => Ok(()),
+            (Some(_), None) => Err(BridgeError::SessionClosed),
+        }
+    }
+
+    async fn from_device(
+        &mut self,
+        line: Bytes,
+        permit: Option<Permit<'_, Bytes>>,
+    ) -> Result<(), BridgeError> {
+        if codec::is_blank(&line) {
+            return Ok(());
+        }
+
+        debug!(
+            "Received from ESP32 at {}: {}",
+            self.config.addr,
+            String::from_utf8_lossy(&line).trim_end()
+        );
+
+        // Validate JSON before forwarding
+        let response = match Message::parse(&line) {
+            Ok(response) => response,
+            Err(e) => {
+                warn!(
+                    "Invalid JSON from ESP32: {} - Raw: {}",
+                    e,
+                    String::from_utf8_lossy(&line).trim_end()
+                );
+                return Ok(());
+            }
+        };
+
+        // Only the replies the bridge reads into are parsed in full
+        let Some(request) = self.inflight.complete(&response) else {
+            // A notification, or an error with no id and no request to go to
+            if response.ids().next().is_none() {
+                return self.forward(line.clone(), permit);
+            }
+            warn!(
+                "Dropping reply to no request in flight: {}",
+                String::from_utf8_lossy(&line).trim_end()
+            );
+            return Ok(());
+        };
+        if let Some(sent) = request.sent {
+            self.metrics.replied(&request, sent.elapsed());
+        }
+        // An error about a request the ESP32 couldn't read has no id; Warp
+        // gets it under the request's
+        let line = match request.ids.first() {
+            Some(id) if response.ids().next().is_none() => {
+                let mut reply = serde_json::from_slice::<Value>(&line)?;
+                reply["id"] = serde_json::from_str(id.get())?;
+                codec::line(reply.to_string())
+            }
+            _ => line.clone(),
+        };
+        if request.is_method("initialize") {
+            let internal = response.ids().any(|id| id_is(id, BRIDGE_INIT_ID));
+            let mut response = serde_json::from_slice::<Value>(&line)?;
+            let mut line = line.clone();
+
+            if let Some(device) = self.device.as_mut().filter(|d| d.negotiating) {
+                device.negotiating = false;
+                if accept_cbor(&mut response) {
+                    info!("Switched to CBOR framing with {}", self.config.addr);
+                    device.frames.decoder_mut().cbor = true;
+                    line = codec::line(response.to_string());
+                }
+            }
+
+            if let Some(result) = response.get("result") {
+                if self.cache.store_initialize(result) && internal {
+                    warn!("ESP32 firmware changed since its replies were cached; restart Warp to pick up its tools");
+                }
+            }
+
+            // Send what Warp asked for meanwhile
+            self.send_held().await?;
+            if internal || request.answered {
+                return Ok(());
+            }
+            return self.forward(line, permit);
+        }
+
+        if request.is_method("tools/list") {
+            let response = serde_json::from_slice::<Value>(&line)?;
+            if let Some(result) = response.get("result") {
+                self.cache.store_tools_list(result);
+            }
+        }
+
+        // Warp was told it timed out
+        if request.answered {
+            debug!("Dropping late reply from ESP32 at {}", self.config.addr);
+            return Ok(());
+        }
+
+        // Forward to Warp
+        self.forward(line.clone(), permit)
+    }
+
+    /// Send `request` to the ESP32, or hold it while there's no connection or
+    /// framing is being negotiated.
+    async fn send(&mut self, mut request: Request) -> Result<(), BridgeError> {
+        let Some(device) = self.device.as_mut().filter(|d| !d.negotiating) else {
+            self.held.push_back(request);
+            return Ok(());
+        };
+
+        let cbor = device.frames.decoder().cbor;
+        if request.is_method("initialize") && !device.initialized {
+            device.initialized = true;
+            if self.config.negotiate_cbor && !cbor {
+                let mut offer = serde_json::from_slice::<Value>(&request.line)?;
+                device.negotiating = offer_cbor(&mut offer).is_some();
+                request.line = codec::line(offer.to_string());
+            }
+        }
+
+        // A line goes out as it came; CBOR is encoded into a frame
+        let line = request.line.clone();
+        let frame = if cbor {
+            match encode_frame(&mut self.frame, &line) {
+                Ok(frame) => frame,
+                Err(e) => {
+                    warn!("Can't encode request for the ESP32: {:?}", e);
+                    for id in &request.ids {
+                        let response = error_response(id, -32700, "Parse error");
+                        self.to_warp(codec::line(response.to_string())).await?;
+                    }
+                    return Ok(());
+                }
+            }
+        } else {
+            line.clone()
+        };
+
+        // Tracked before writing, so a failed write is retried or answered
+        debug!(
+            "Forwarded to ESP32 at {}: {}",
+            self.config.addr,
+            String::from_utf8_lossy(&line).trim_end()
+        );
+        if !request.ids.is_empty() {
+            request.sent = Some(Instant::now());
+            self.inflight.insert(request);
+        }
+
+        // The writer task stops when a write fails
+        if device.writer.send(frame).await.is_err() {
+            if let Some(device) = self.device.take() {
+                if let Ok(Err(e)) = device.writing.await {
+                    error!("Error writing to ESP32 at {}: {}", self.config.addr, e);
+                }
+            }
+            if !self.disconnected().await? {
+                self.gave_up = true;
+            }
+        }
+        Ok(())
+    }
+
+    async fn send_held(&mut self) -> Result<(), BridgeError> {
+        while self.device.as_ref().is_some_and(|d| !d.negotiating) {
+            let Some(request) = self.held.pop_front() else {
+                break;
+            };
+            self.send(request).await?;
+        }
+        Ok(())
+    }
+
+    /// Use a new connection: replay Warp's handshake, then send what was held.
+    async fn connected(&mut self, stream: TcpStream) -> Result<(), BridgeError> {
+        self.device = Some(Device::new(
+            stream,
+            self.frame_stats.clone(),
+            self.metrics.clone(),
+        ));
+
+        // Unless Warp's own initialize is being retried, it's replayed under
+        // the bridge's id, followed by Warp's notification
+        let retrying_initialize = self.held.front().is_some_and(|r| r.is_method("initialize"));
+        if let (Some(handshake), false) = (&self.handshake, retrying_initialize) {
+            let mut replay = vec![handshake.clone()];
+            replay[0]["id"] = json!(BRIDGE_INIT_ID);
+            if self.initialized_notification {
+                replay.push(json!({"jsonrpc": "2.0", "method": "notifications/initialized"}));
+            }
+            for message in replay.into_iter().rev() {
+                let line = codec::line(message.to_string());
+                let request = Request::new(&Message::parse(&line)?, line.clone(), true);
+                self.held.push_front(request);
+            }
+        }
+
+        self.send_held().await
+    }
+
+    /// The connection dropped: answer what can't be retried, queue what can,
+    /// and start reconnecting. Returns whether the link should go on.
+    async fn disconnected(&mut self) -> Result<bool, BridgeError> {
+        self.device = None;
+
+        let mut retries = Vec::new();
+        let lost: Vec<Request> = self.inflight.drain().collect();
+        for request in lost {
+            // Nothing to do for the bridge's own requests, or ones Warp was
+            // already answered for
+            if request.answered
+                || request
+                    .ids
+                    .first()
+                    .is_some_and(|id| id_is(id, BRIDGE_INIT_ID))
+            {
+                continue;
+            }
+            if request.retry {
+                retries.push(request);
+                continue;
+            }
+
+            warn!(
+                "Not retrying request that may have run: {}",
+                String::from_utf8_lossy(&request.line).trim_end()
+            );
+            self.fail(
+                &request,
+                "ESP32 connection lost; the request may or may not have run",
+            )
+            .await?;
+        }
+
+        // Retries go out first, in their original order
+        for request in retries.into_iter().rev() {
+            self.held.push_front(request);
+        }
+
+        if self.config.reconnect_attempts == 0 {
+            return Ok(false);
+        }
+        info!("Reconnecting to ESP32 at {}", self.config.addr);
+        self.reconnecting = Some(tokio::spawn(reconnect(
+            self.config.addr,
+            self.config.timeout,
+            self.config.reconnect_attempts,
+        )));
+        Ok(true)
+    }
+
+    /// Answer everything still waiting, and everything queued for the link,
+    /// once the ESP32 can't be reached.
+    async fn give_up(&mut self, queue: &mut mpsc::Receiver<Bytes>) -> Result<(), BridgeError> {
+        let held: Vec<Request> = self.held.drain(..).collect();
+        for request in held {
+            if !request
+                .ids
+                .first()
+                .is_some_and(|id| id_is(id, BRIDGE_INIT_ID))
+            {
+                self.fail(&request, "ESP32 unreachable").await?;
+            }
+        }
+
+        queue.close();
+        while let Some(line) = queue.recv().await {
+            let Ok(request) = Message::parse(&line) else {
+                continue;
+            };
+            if !request.ids().any(|id| id_is(id, BRIDGE_INIT_ID)) {
+                let request = Request::new(&request, line.clone(), false);
+                self.fail(&request, "ESP32 unreachable").await?;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// The next message from the ESP32, or never while disconnected.
+async fn next_frame(device: &mut Option<Device>) -> Option<Result<Bytes, BridgeError>> {
+    match device {
+        Some(device) => device.frames.next().await,
+        None => std::future::pending().await,
+    }
+}
+
+/// Resolves once the writer queue of a device that has filled up has room.
+async fn writable(writer: &Option<Queue<Bytes>>) {
+    match writer {
+        Some(writer) => writer.ready().await,
+        None => std::future::pending().await,
+    }
+}
+
+async fn reconnected(task: &mut Option<JoinHandle<Option<TcpStream>>>) -> Option<TcpStream> {
+    match task {
+        Some(task) => task.await.ok().flatten(),
+        None => std::future::pending().await,
+    }
+}
+
+async fn run(mut link: Link, mut queue: mpsc::Receiver<Bytes>) {
+    let addr = link.config.addr;
+    info!("Attempting to connect to ESP32 at {}", addr);
+
+    let stopped = match connect(addr, link.config.timeout).await {
+        Ok(stream) => {
+            info!("Successfully connected to ESP32 MCP server at {}!", addr);
+            link.device = Some(Device::new(
+                stream,
+                link.frame_stats.clone(),
+                link.metrics.clone(),
+            ));
+            serve(&mut link, &mut queue).await
+        }
+        Err(e) => {
+            error!("{}: {}", addr, e);
+            link.give_up(&mut queue).await.and(Err(e))
+        }
+    };
+
+    match stopped {
+        // The session closed the queue and every reply due came in or timed
+        // out: let what's still queued for the ESP32 go out
+        Ok(false) => {
+            if let Some(task) = link.reconnecting.take() {
+                task.abort();
+            }
+            if let Some(device) = link.device.take() {
+                drop(device.writer);
+                if let Ok(Err(e)) = device.writing.await {
+                    warn!("Error writing to ESP32 at {}: {}", addr, e);
+                }
+            }
+        }
+        Ok(true) => {
+            let _ = link.closed.send((link.index, None));
+        }
+        // Nobody is listening once the session has closed
+        Err(BridgeError::SessionClosed) => {}
+        Err(e) => {
+            let _ = link.closed.send((link.index, Some(e)));
+        }
+    }
+
+    link.request_stats.log();
+    link.frame_stats.log();
+}
+
+/// Serve requests until the session closes the queue and no reply is due,
+/// or the ESP32 can't be reached any more. Returns whether the link gave up.
+async fn serve(link: &mut Link, queue: &mut mpsc::Receiver<Bytes>) -> Result<bool, BridgeError> {
+    let addr = link.config.addr;
+    let replies = link.replies.queue.clone();
+    let mut draining = false;
+    loop {
+        if link.gave_up {
+            link.give_up(queue).await?;
+            return Ok(true);
+        }
+        if draining && !link.waiting() {
+            return Ok(false);
+        }
+
+        // A request is only taken while it can be written without waiting,
+        // so replies keep being read while the ESP32 is slow to take more
+        let full = link
+            .device
+            .as_ref()
+            .filter(|d| !d.negotiating && d.writer.is_full())
+            .map(|d| d.writer.clone());
+        let deadline = link.next_deadline();
+
+        tokio::select! {
+            // Requests from Warp, routed here by the session
+            line = queue.recv(), if full.is_none() && !draining => {
+                match line {
+                    Some(line) => link.from_warp(line).await?,
+                    None => {
+                        debug!("Waiting for outstanding replies from ESP32 at {}", addr);
+                        draining = true;
+                    }
+                }
+            }
+
+            _ = writable(&full), if full.is_some() => {}
+
+            // Read from ESP32 while there's no reply waiting for Warp's queue
+            line_result = next_frame(&mut link.device), if link.reply.is_none() => {
+                let more = match line_result {
+                    Some(Ok(line)) => {
+                        link.reply = Some(line);
+                        true
+                    }
+                    Some(Err(e)) => {
+                        error!("Error reading from ESP32 at {}: {}", addr, e);
+                        link.disconnected().await?
+                    }
+                    None => {
+                        info!("ESP32 at {} disconnected", addr);
+                        link.disconnected().await?
+                    }
+                };
+                if !more {
+                    link.give_up(queue).await?;
+                    return Ok(true);
+                }
+            }
+
+            // Forward it once there's room
+            permit = replies.reserve(), if link.reply.is_some() => {
+                if let Some(line) = link.reply.take() {
+                    link.from_device(line, permit).await?;
+                }
+            }
+
+            _ = tokio::time::sleep_until(deadline.unwrap_or_else(Instant::now).into()), if deadline.is_some() => {
+                link.expire().await?;
+            }
+
+            stream = reconnected(&mut link.reconnecting) => {
+                link.reconnecting = None;
+                match stream {
+                    Some(stream) => {
+                        info!("Reconnected to ESP32 at {}", addr);
+                        link.connected(stream).await?;
+                    }
+                    None => {
+                        error!(
+                            "Giving up on ESP32 at {} after {} reconnect attempts",
+                            addr, link.config.reconnect_attempts
+                        );
+                        link.give_up(queue).await?;
+                        return Ok(true);
+                    }
+                }
+            }
+        }
+    }
+}
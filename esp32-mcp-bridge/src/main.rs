@@ -1,9 +1,35 @@
-use clap::Parser;
-use serde_json::Value;
+mod aggregate;
+mod bench;
+mod cache;
+mod codec;
+mod inflight;
+mod link;
+mod message;
+mod metrics;
+mod queue;
+mod remap;
+
+use aggregate::{Aggregate, Route};
+use bytes::Bytes;
+use cache::ResponseCache;
+use clap::{Parser, Subcommand};
+use codec::LineCodec;
+use futures::StreamExt;
+use inflight::{Deadlines, Request};
+use link::{LinkConfig, Replies, BRIDGE_INIT_ID};
+use message::{id_is, Message};
+use metrics::{Metrics, Sink};
+use queue::{Queue, Stats};
+use remap::Remap;
+use serde::Serialize;
+use serde_json::{json, Value};
 use std::net::SocketAddr;
+use std::path::PathBuf;
+use std::sync::{Arc, Mutex};
 use thiserror::Error;
-use tokio::io::{AsyncBufReadExt, AsyncWriteExt, BufReader};
-use tokio::net::TcpStream;
+use tokio::sync::mpsc;
+use tokio::time::Duration;
+use tokio_util::codec::FramedRead;
 use tracing::{debug, error, info, warn};
 
 #[derive(Error, Debug)]
@@ -16,6 +42,58 @@ pub enum BridgeError {
     Connection(String),
     #[error("Invalid response: {0}")]
     InvalidResponse(String),
+    #[error("Bridge session closed")]
+    SessionClosed,
+}
+
+/// One ESP32 given with `--device`.
+#[derive(Clone, Debug)]
+struct DeviceArg {
+    name: String,
+    host: String,
+    port: Option<u16>,
+}
+
+fn parse_device(arg: &str) -> Result<DeviceArg, String> {
+    let (name, addr) = arg
+        .split_once('=')
+        .ok_or_else(|| format!("expected NAME=HOST[:PORT], got '{}'", arg))?;
+    let valid = |c: char| c.is_ascii_alphanumeric() || c == '_' || c == '-';
+    if name.is_empty() || !name.chars().all(valid) || name.contains(aggregate::SEPARATOR) {
+        return Err(format!(
+            "device name '{}' must be letters, digits, '-' and single '_'",
+            name
+        ));
+    }
+    let (host, port) = match addr.rsplit_once(':') {
+        Some((host, port)) => {
+            let port = port
+                .parse()
+                .map_err(|_| format!("invalid port '{}'", port))?;
+            (host, Some(port))
+        }
+        None => (addr, None),
+    };
+    Ok(DeviceArg {
+        name: name.to_string(),
+        host: host.to_string(),
+        port,
+    })
+}
+
+fn parse_seconds(arg: &str) -> Result<Duration, String> {
+    arg.parse()
+        .ok()
+        .and_then(|secs| Duration::try_from_secs_f64(secs).ok())
+        .ok_or_else(|| format!("expected seconds, got '{}'", arg))
+}
+
+/// A deadline given with `--method-timeout`.
+fn parse_method_timeout(arg: &str) -> Result<(String, Duration), String> {
+    let (name, secs) = arg
+        .split_once('=')
+        .ok_or_else(|| format!("expected NAME=SECONDS, got '{}'", arg))?;
+    Ok((name.to_string(), parse_seconds(secs)?))
 }
 
 #[derive(Parser, Debug)]
@@ -30,17 +108,87 @@ struct Args {
     #[arg(short, long, default_value = "3000")]
     port: u16,
 
+    /// Serve several ESP32s as one MCP server, as NAME=HOST[:PORT]; repeat
+    /// for each. Their tools are listed as NAME__tool. Replaces --esp32-ip
+    #[arg(short, long = "device", value_parser = parse_device)]
+    devices: Vec<DeviceArg>,
+
     /// Connection timeout in seconds
     #[arg(short, long, default_value = "10")]
     timeout: u64,
 
+    /// Reconnect attempts after the ESP32 connection drops; 0 ends the
+    /// session instead. A tools/call in flight is only sent again if a
+    /// tools/list, live or cached, annotated its tool as read-only or
+    /// idempotent
+    #[arg(long, default_value = "10")]
+    reconnect_attempts: u32,
+
     /// Enable verbose logging
     #[arg(short, long)]
     verbose: bool,
+
+    /// Keep newline-delimited JSON to the ESP32 instead of negotiating CBOR
+    #[arg(long)]
+    json_framing: bool,
+
+    /// Seconds Warp waits for a reply before the bridge answers the request
+    /// with a timeout error
+    #[arg(long, default_value = "30", value_parser = parse_seconds)]
+    request_timeout: Duration,
+
+    /// Deadline for one method or tool instead, as NAME=SECONDS, e.g.
+    /// tools/list=5 or led_control=2; repeat for each
+    #[arg(long = "method-timeout", value_parser = parse_method_timeout)]
+    method_timeouts: Vec<(String, Duration)>,
+
+    /// Messages each queue between the bridge's tasks holds before the side
+    /// filling it waits
+    #[arg(long, default_value = "64")]
+    queue_depth: usize,
+
+    /// Write latency and throughput metrics in Prometheus text format to
+    /// this file on SIGUSR1 and on exit
+    #[arg(long)]
+    stats_file: Option<PathBuf>,
+
+    /// Send them to this Unix socket instead
+    #[cfg(unix)]
+    #[arg(long, conflicts_with = "stats_file")]
+    stats_socket: Option<PathBuf>,
+
+    /// Also write them every this many seconds
+    #[arg(long, value_parser = parse_seconds)]
+    stats_interval: Option<Duration>,
+
+    /// Save initialize and tools/list replies here to answer them on later
+    /// runs without asking the ESP32
+    #[arg(long)]
+    cache_dir: Option<PathBuf>,
+
+    #[command(subcommand)]
+    command: Option<Command>,
+}
+
+#[derive(Subcommand, Debug)]
+enum Command {
+    /// Load the ESP32 with tools/call requests instead of bridging Warp, and
+    /// report throughput, latency and errors as JSON
+    Bench(bench::BenchArgs),
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let runtime = tokio::runtime::Runtime::new()?;
+    let result = runtime.block_on(run());
+
+    // Reading stdin blocks a thread until a line or EOF comes. A session the
+    // ESP32 ended leaves Warp's stdin open, so that read isn't waited for;
+    // replies and metrics have been written by now
+    runtime.shutdown_background();
+    result
 }
 
-#[tokio::main]
-async fn main() -> Result<(), Box<dyn std::error::Error>> {
+async fn run() -> Result<(), Box<dyn std::error::Error>> {
     let args = Args::parse();
 
     // Initialize tracing
@@ -50,146 +198,264 @@ async fn main() -> Result<(), Box<dyn std::error::Error>> {
         .with_writer(std::io::stderr)
         .init();
 
-    info!(
-        "ESP32 MCP Bridge starting - connecting to {}:{}",
-        args.esp32_ip, args.port
-    );
+    // Without --device, the one ESP32 is served as it is
+    let devices = if args.devices.is_empty() {
+        vec![DeviceArg {
+            name: String::new(),
+            host: args.esp32_ip.clone(),
+            port: None,
+        }]
+    } else {
+        args.devices.clone()
+    };
 
-    // Create ESP32 address
-    let esp32_addr: SocketAddr = format!("{}:{}", args.esp32_ip, args.port)
-        .parse()
-        .map_err(|e| BridgeError::Connection(format!("Invalid address: {}", e)))?;
+    let deadlines = Deadlines {
+        default: args.request_timeout,
+        methods: args.method_timeouts.iter().cloned().collect(),
+    };
+
+    let metrics = Metrics::new();
+    let mut names = Vec::new();
+    let mut links = Vec::new();
+    for device in devices {
+        if names.contains(&device.name) {
+            return Err(format!("device name '{}' given twice", device.name).into());
+        }
+
+        // Create ESP32 address
+        let esp32_addr: SocketAddr =
+            format!("{}:{}", device.host, device.port.unwrap_or(args.port))
+                .parse()
+                .map_err(|e| BridgeError::Connection(format!("Invalid address: {}", e)))?;
+        info!("ESP32 MCP Bridge starting - connecting to {}", esp32_addr);
+
+        let config = LinkConfig {
+            addr: esp32_addr,
+            timeout: Duration::from_secs(args.timeout),
+            reconnect_attempts: args.reconnect_attempts,
+            negotiate_cbor: !args.json_framing,
+            queue_depth: args.queue_depth,
+            deadlines: deadlines.clone(),
+        };
+        let cache = ResponseCache::open(args.cache_dir.as_deref(), esp32_addr);
+        names.push(device.name);
+        links.push((config, cache));
+    }
+
+    if let Some(Command::Bench(bench)) = &args.command {
+        let configs = links.into_iter().map(|(config, _)| config).collect();
+        bench::run(configs, bench).await?;
+        return Ok(());
+    }
+
+    // Metrics are exported until the bridge ends, then once more
+    #[cfg(unix)]
+    let socket = args.stats_socket.clone().map(Sink::Socket);
+    #[cfg(not(unix))]
+    let socket = None;
+    let sink = args.stats_file.clone().map(Sink::File).or(socket);
+    let exporter = sink.map(|sink| {
+        let task = metrics::spawn_exporter(metrics.clone(), sink.clone(), args.stats_interval);
+        (sink, task)
+    });
 
     // Start the bridge
-    run_bridge(esp32_addr, args.timeout).await?;
+    let aggregate = (!args.devices.is_empty()).then(|| Aggregate::new(names));
+    let drain = deadlines.longest() + DRAIN_TIMEOUT;
+    let result = run_bridge(links, aggregate, args.queue_depth, drain, metrics.clone()).await;
+
+    if let Some((sink, task)) = exporter {
+        task.abort();
+        metrics.export(&sink).await;
+    }
+    result?;
 
     Ok(())
 }
 
-async fn run_bridge(esp32_addr: SocketAddr, timeout_secs: u64) -> Result<(), BridgeError> {
-    info!("Attempting to connect to ESP32 at {}", esp32_addr);
-
-    // Connect to ESP32 MCP server with timeout
-    let esp32_stream = tokio::time::timeout(
-        tokio::time::Duration::from_secs(timeout_secs),
-        TcpStream::connect(esp32_addr),
-    )
-    .await
-    .map_err(|_| {
-        error!("Connection timed out after {} seconds", timeout_secs);
-        BridgeError::Connection(format!("Connection timeout after {} seconds", timeout_secs))
-    })?
-    .map_err(|e| {
-        error!("TCP connection failed: {}", e);
-        BridgeError::Connection(format!("Failed to connect: {}", e))
-    })?;
-
-    // Set TCP_NODELAY to reduce latency
-    if let Err(e) = esp32_stream.set_nodelay(true) {
-        warn!("Failed to set TCP_NODELAY: {}", e);
-    }
+fn error_response<I: Serialize + ?Sized>(id: &I, code: i32, message: &str) -> Value {
+    json!({
+        "jsonrpc": "2.0",
+        "id": id,
+        "error": {
+            "code": code,
+            "message": message
+        }
+    })
+}
 
-    info!("Successfully connected to ESP32 MCP server!");
+// How long queued messages get to go out once the session ends, on top of
+// the longest wait for a reply
+const DRAIN_TIMEOUT: Duration = Duration::from_secs(5);
 
-    let (esp32_reader, mut esp32_writer) = esp32_stream.into_split();
-    let mut esp32_buf_reader = BufReader::new(esp32_reader).lines();
+/// Warp's MCP session, served by one link per ESP32.
+struct Session {
+    warp: Replies,
+    links: Vec<Queue<Bytes>>,
+    metrics: Arc<Metrics>,
+}
 
-    // Set up stdin/stdout for MCP communication with Warp
-    let stdin = tokio::io::stdin();
-    let mut stdin_reader = BufReader::new(stdin).lines();
-    let mut stdout = tokio::io::stdout();
+impl Session {
+    /// Queue a line the bridge answers itself for Warp.
+    async fn to_warp(&mut self, line: Bytes) -> Result<(), BridgeError> {
+        let line = self.warp.remap.lock().unwrap().reply(line);
+        debug!(
+            "Forwarded to Warp: {}",
+            String::from_utf8_lossy(&line).trim_end()
+        );
+        self.warp
+            .queue
+            .send(line)
+            .await
+            .map_err(|_| BridgeError::SessionClosed)
+    }
 
-    info!("Bridge established - ready for MCP communication");
+    async fn from_warp(&mut self, line: Bytes) -> Result<(), BridgeError> {
+        self.metrics.warp.received.record(1, line.len());
+        if codec::is_blank(&line) {
+            return Ok(());
+        }
 
-    loop {
-        tokio::select! {
-            // Read from Warp (stdin) and forward to ESP32
-            line_result = stdin_reader.next_line() => {
-                match line_result {
-                    Ok(Some(line)) => {
-                        if line.trim().is_empty() {
-                            continue;
-                        }
+        // Before routing, so even the requests the bridge answers itself
+        // carry the same ids as what it sends the ESP32s
+        let line = self.warp.remap.lock().unwrap().request(line);
+        let routes = match &self.warp.aggregate {
+            Some(aggregate) => aggregate.lock().unwrap().route(&line),
+            None => vec![Route::Device(0, line)],
+        };
+        for route in routes {
+            match route {
+                Route::Device(device, line) => self.to_device(device, line).await?,
+                Route::Warp(line) => self.to_warp(line).await?,
+            }
+        }
+        Ok(())
+    }
 
-                        debug!("Received from Warp: {}", line);
+    /// Queue `line` for a device's link, waiting while its queue is full. A
+    /// link that has just stopped can't answer it, so the session does.
+    async fn to_device(&mut self, device: usize, line: Bytes) -> Result<(), BridgeError> {
+        let Err(line) = self.links[device].send(line).await else {
+            return Ok(());
+        };
+        let Ok(request) = Message::parse(&line) else {
+            return Ok(());
+        };
+        if request.ids().any(|id| id_is(id, BRIDGE_INIT_ID)) {
+            return Ok(());
+        }
+        let request = Request::new(&request, line.clone(), false);
+        match link::failure(&request, -32000, "ESP32 unreachable") {
+            Some(response) => self.warp.send(response).await,
+            None => Ok(()),
+        }
+    }
 
-                        // Validate JSON before forwarding
-                        match serde_json::from_str::<Value>(&line) {
-                            Ok(_) => {
-                                // Forward to ESP32
-                                esp32_writer.write_all(line.as_bytes()).await?;
-                                esp32_writer.write_all(b"\n").await?;
-                                esp32_writer.flush().await?;
-                                debug!("Forwarded to ESP32: {}", line);
-                            }
-                            Err(e) => {
-                                warn!("Invalid JSON from Warp, skipping: {}", e);
-
-                                // Send error response back to Warp
-                                let error_response = serde_json::json!({
-                                    "jsonrpc": "2.0",
-                                    "id": null,
-                                    "error": {
-                                        "code": -32700,
-                                        "message": "Parse error"
-                                    }
-                                });
-
-                                let response_str = serde_json::to_string(&error_response)?;
-                                stdout.write_all(response_str.as_bytes()).await?;
-                                stdout.write_all(b"\n").await?;
-                                stdout.flush().await?;
-                            }
+    async fn run(
+        &mut self,
+        closed: &mut mpsc::UnboundedReceiver<(usize, Option<BridgeError>)>,
+    ) -> Result<(), BridgeError> {
+        // Set up stdin for MCP communication with Warp
+        let mut stdin_reader = FramedRead::new(tokio::io::stdin(), LineCodec::default());
+
+        info!("Bridge established - ready for MCP communication");
+
+        loop {
+            tokio::select! {
+                // Read from Warp (stdin) and forward to the ESP32s
+                line_result = stdin_reader.next() => {
+                    match line_result {
+                        Some(Ok(line)) => self.from_warp(line).await?,
+                        None => {
+                            info!("Warp disconnected (stdin closed)");
+                            return Ok(());
+                        }
+                        Some(Err(e)) => {
+                            error!("Error reading from Warp: {}", e);
+                            return Ok(());
                         }
-                    }
-                    Ok(None) => {
-                        info!("Warp disconnected (stdin closed)");
-                        break;
-                    }
-                    Err(e) => {
-                        error!("Error reading from Warp: {}", e);
-                        break;
                     }
                 }
-            }
 
-            // Read from ESP32 and forward to Warp (stdout)
-            line_result = esp32_buf_reader.next_line() => {
-                match line_result {
-                    Ok(Some(line)) => {
-                        if line.trim().is_empty() {
-                            continue;
-                        }
-
-                        debug!("Received from ESP32: {}", line);
-
-                        // Validate JSON before forwarding
-                        match serde_json::from_str::<Value>(&line) {
-                            Ok(_) => {
-                                // Forward to Warp
-                                stdout.write_all(line.as_bytes()).await?;
-                                stdout.write_all(b"\n").await?;
-                                stdout.flush().await?;
-                                debug!("Forwarded to Warp: {}", line);
-                            }
-                            Err(e) => {
-                                warn!("Invalid JSON from ESP32: {} - Raw: {}", e, line);
+                // Links that stopped for good
+                stopped = closed.recv() => {
+                    let Some((device, e)) = stopped else {
+                        return Ok(());
+                    };
+                    match &self.warp.aggregate {
+                        // The other devices carry on without it
+                        Some(aggregate) => {
+                            if !aggregate.lock().unwrap().closed(device) {
+                                error!("No ESP32 left to serve");
+                                return Ok(());
                             }
                         }
-                    }
-                    Ok(None) => {
-                        info!("ESP32 disconnected");
-                        break;
-                    }
-                    Err(e) => {
-                        error!("Error reading from ESP32: {}", e);
-                        break;
+                        None => return e.map_or(Ok(()), Err),
                     }
                 }
             }
         }
     }
+}
+
+async fn run_bridge(
+    devices: Vec<(LinkConfig, ResponseCache)>,
+    aggregate: Option<Aggregate>,
+    queue_depth: usize,
+    drain: Duration,
+    metrics: Arc<Metrics>,
+) -> Result<(), BridgeError> {
+    // Replies are written to Warp's stdout by a task of their own
+    let warp_stats = Stats::new("replies to Warp".to_string(), queue_depth);
+    let (queue, replies) = queue::bounded(warp_stats.clone());
+    let writer = queue::spawn_writer(tokio::io::stdout(), replies, metrics.warp.clone());
+    let warp = Replies {
+        queue,
+        aggregate: aggregate.map(|aggregate| Arc::new(Mutex::new(aggregate))),
+        remap: Arc::new(Mutex::new(Remap::default())),
+    };
+
+    // Connect to every ESP32 at once; requests wait in each link meanwhile
+    let (closed_tx, mut closed) = mpsc::unbounded_channel();
+    let (links, tasks): (Vec<_>, Vec<_>) = devices
+        .into_iter()
+        .enumerate()
+        .map(|(index, (config, cache))| {
+            link::spawn(
+                index,
+                config,
+                cache,
+                warp.clone(),
+                closed_tx.clone(),
+                &metrics,
+            )
+        })
+        .unzip();
+    drop(closed_tx);
+
+    let mut session = Session {
+        warp,
+        links,
+        metrics,
+    };
+    let result = session.run(&mut closed).await;
+
+    // Closing the links' queues lets each write out what it holds, wait for
+    // the replies still due and end; once they all have, the last replies
+    // are written to Warp
+    drop(session);
+    let drained = tokio::time::timeout(drain, async {
+        futures::future::join_all(tasks).await;
+        writer.await
+    })
+    .await;
+    match drained {
+        Ok(Ok(Err(e))) => warn!("Error writing to Warp: {}", e),
+        Err(_) => warn!("Gave up draining queues after {:?}", drain),
+        _ => {}
+    }
+    warp_stats.log();
 
     info!("Bridge connection closed");
-    Ok(())
+    result
 }
@@ -0,0 +1,84 @@
+// The parts of a JSON-RPC message the bridge reads, borrowed from its line.
+//
+// Deserializing a line into these checks that it's well-formed JSON without
+// building a DOM: fields the bridge doesn't route on are skipped over, so a
+// forwarded message is parsed once and its bytes are passed on untouched.
+
+use serde::de::IgnoredAny;
+use serde::Deserialize;
+use serde_json::value::RawValue;
+use std::borrow::Cow;
+
+#[derive(Deserialize)]
+pub struct Envelope<'a> {
+    /// A null id reads as none.
+    #[serde(borrow, default)]
+    pub id: Option<&'a RawValue>,
+    #[serde(borrow, default)]
+    pub method: Option<Cow<'a, str>>,
+    #[serde(borrow, default)]
+    pub params: Option<Params<'a>>,
+}
+
+#[derive(Deserialize)]
+pub struct Params<'a> {
+    /// Tool name of a tools/call.
+    #[serde(borrow, default)]
+    pub name: Option<Cow<'a, str>>,
+    /// Page asked for by a tools/list.
+    #[serde(default)]
+    pub cursor: Option<IgnoredAny>,
+}
+
+/// One request or reply, or a batch of them.
+pub enum Message<'a> {
+    Single(Envelope<'a>),
+    Batch(Vec<Envelope<'a>>),
+}
+
+impl<'a> Message<'a> {
+    pub fn parse(line: &'a [u8]) -> serde_json::Result<Self> {
+        let batch = line
+            .iter()
+            .find(|b| !b.is_ascii_whitespace())
+            .is_some_and(|&b| b == b'[');
+        Ok(if batch {
+            Message::Batch(serde_json::from_slice(line)?)
+        } else {
+            Message::Single(serde_json::from_slice(line)?)
+        })
+    }
+
+    /// The message itself, unless it's a batch.
+    pub fn single(&self) -> Option<&Envelope<'a>> {
+        match self {
+            Message::Single(envelope) => Some(envelope),
+            Message::Batch(_) => None,
+        }
+    }
+
+    pub fn is_method(&self, method: &str) -> bool {
+        self.single()
+            .and_then(|envelope| envelope.method.as_deref())
+            == Some(method)
+    }
+
+    /// Tool name of a single tools/call.
+    pub fn tool(&self) -> Option<&str> {
+        self.single()?.params.as_ref()?.name.as_deref()
+    }
+
+    /// Every non-null id, in order.
+    pub fn ids(&self) -> impl Iterator<Item = &'a RawValue> + '_ {
+        let envelopes = match self {
+            Message::Single(envelope) => std::slice::from_ref(envelope),
+            Message::Batch(envelopes) => envelopes.as_slice(),
+        };
+        envelopes.iter().filter_map(|envelope| envelope.id)
+    }
+}
+
+/// Whether `id` is the number `n`, as the bridge writes its own ids.
+pub fn id_is(id: &RawValue, n: u32) -> bool {
+    id.get().parse() == Ok(n)
+}
@@ -0,0 +1,496 @@
+// Latency and throughput of the bridge, exported in Prometheus text format.
+//
+// Each peer, Warp or an ESP32, counts the messages and bytes going each way,
+// as they're read or written on the wire. Each ESP32 also keeps a latency
+// histogram per method and per tool, from writing a request to reading its
+// reply. The counters are atomics bumped where the bytes are read and
+// written; the histograms are only locked once per reply.
+//
+// Metrics are written to a file or a Unix socket on SIGUSR1, every
+// `--stats-interval` and on exit.
+
+use crate::inflight::Request;
+use std::collections::BTreeMap;
+use std::fmt::Write as _;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+use tokio::task::JoinHandle;
+use tracing::warn;
+
+// Quantiles reported for each histogram; 1 is the maximum
+const QUANTILES: [f64; 4] = [0.5, 0.9, 0.99, 1.0];
+
+/// Latencies in microseconds, in log-linear buckets as HdrHistogram keeps
+/// them: exact below 128µs, then 64 buckets per power of two, so a quantile
+/// is within 1.6% of the true value whatever its magnitude.
+#[derive(Default)]
+pub struct Histogram {
+    // Grown to the largest bucket recorded
+    counts: Vec<u64>,
+    count: u64,
+    sum: u64,
+    max: u64,
+}
+
+// Significant bits kept of each value
+const SUB_BITS: u32 = 7;
+const HALF: usize = 1 << (SUB_BITS - 1);
+
+fn bucket(value: u64) -> usize {
+    let bits = u64::BITS - value.leading_zeros();
+    if bits <= SUB_BITS {
+        return value as usize;
+    }
+    let shift = bits - SUB_BITS;
+    ((shift as usize) << (SUB_BITS - 1)) + (value >> shift) as usize
+}
+
+/// The largest value that falls in `bucket`.
+fn bucket_max(bucket: usize) -> u64 {
+    if bucket < 2 * HALF {
+        return bucket as u64;
+    }
+    let shift = bucket / HALF - 1;
+    let lowest = ((HALF + bucket % HALF) as u64) << shift;
+    lowest + ((1 << shift) - 1)
+}
+
+impl Histogram {
+    pub fn record(&mut self, elapsed: Duration) {
+        let micros = u64::try_from(elapsed.as_micros()).unwrap_or(u64::MAX);
+        let i = bucket(micros);
+        if self.counts.len() <= i {
+            self.counts.resize(i + 1, 0);
+        }
+        self.counts[i] += 1;
+        self.count += 1;
+        self.sum = self.sum.saturating_add(micros);
+        self.max = self.max.max(micros);
+    }
+
+    /// The value at quantile `q`, in microseconds; 1 is the maximum.
+    pub fn quantile(&self, q: f64) -> u64 {
+        let rank = ((q * self.count as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (i, count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return bucket_max(i).min(self.max);
+            }
+        }
+        self.max
+    }
+
+    pub fn merge(&mut self, other: &Histogram) {
+        if self.counts.len() < other.counts.len() {
+            self.counts.resize(other.counts.len(), 0);
+        }
+        for (count, other) in self.counts.iter_mut().zip(&other.counts) {
+            *count += other;
+        }
+        self.count += other.count;
+        self.sum = self.sum.saturating_add(other.sum);
+        self.max = self.max.max(other.max);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    /// Mean in microseconds.
+    pub fn mean(&self) -> f64 {
+        if self.count == 0 {
+            return 0.0;
+        }
+        self.sum as f64 / self.count as f64
+    }
+}
+
+/// Messages and bytes going one way.
+#[derive(Default)]
+pub struct Traffic {
+    messages: AtomicU64,
+    bytes: AtomicU64,
+    // Totals at the last export, for rates since
+    exported: [AtomicU64; 2],
+}
+
+impl Traffic {
+    pub fn record(&self, messages: u64, bytes: usize) {
+        self.messages.fetch_add(messages, Ordering::Relaxed);
+        self.bytes.fetch_add(bytes as u64, Ordering::Relaxed);
+    }
+
+    /// Messages and bytes so far.
+    pub fn totals(&self) -> (u64, u64) {
+        (
+            self.messages.load(Ordering::Relaxed),
+            self.bytes.load(Ordering::Relaxed),
+        )
+    }
+
+    /// Totals, and how much they grew since the last call.
+    fn take(&self) -> [(u64, u64); 2] {
+        let totals = [
+            self.messages.load(Ordering::Relaxed),
+            self.bytes.load(Ordering::Relaxed),
+        ];
+        [0, 1].map(|i| {
+            let before = self.exported[i].swap(totals[i], Ordering::Relaxed);
+            (totals[i], totals[i] - before)
+        })
+    }
+}
+
+#[derive(Default)]
+struct Latency {
+    methods: BTreeMap<String, Histogram>,
+    tools: BTreeMap<String, Histogram>,
+    timeouts: BTreeMap<String, u64>,
+}
+
+/// Warp or one ESP32, as the bridge sees it.
+pub struct Peer {
+    name: String,
+    /// Written by the bridge to the peer.
+    pub sent: Traffic,
+    /// Read by the bridge from the peer.
+    pub received: Traffic,
+    latency: Mutex<Latency>,
+}
+
+impl Peer {
+    /// `request` was answered `elapsed` after it was written.
+    pub fn replied(&self, request: &Request, elapsed: Duration) {
+        let mut latency = self.latency.lock().unwrap();
+        let method = request.method.as_deref().unwrap_or("batch");
+        histogram(&mut latency.methods, method).record(elapsed);
+        if let Some(tool) = &request.tool {
+            histogram(&mut latency.tools, tool).record(elapsed);
+        }
+    }
+
+    /// Warp was answered with a timeout error for `request`.
+    pub fn timed_out(&self, request: &Request) {
+        let method = request.method.as_deref().unwrap_or("batch");
+        *self
+            .latency
+            .lock()
+            .unwrap()
+            .timeouts
+            .entry(method.to_string())
+            .or_default() += 1;
+    }
+}
+
+/// The histogram for `name`, added on first use without allocating after.
+fn histogram<'a>(histograms: &'a mut BTreeMap<String, Histogram>, name: &str) -> &'a mut Histogram {
+    if !histograms.contains_key(name) {
+        histograms.insert(name.to_string(), Histogram::default());
+    }
+    histograms.get_mut(name).unwrap()
+}
+
+pub struct Metrics {
+    pub warp: Arc<Peer>,
+    devices: Mutex<Vec<Arc<Peer>>>,
+    started: Instant,
+    exported: Mutex<Instant>,
+}
+
+impl Metrics {
+    pub fn new() -> Arc<Self> {
+        Arc::new(Self {
+            warp: Self::peer("warp"),
+            devices: Mutex::new(Vec::new()),
+            started: Instant::now(),
+            exported: Mutex::new(Instant::now()),
+        })
+    }
+
+    fn peer(name: &str) -> Arc<Peer> {
+        Arc::new(Peer {
+            name: name.to_string(),
+            sent: Traffic::default(),
+            received: Traffic::default(),
+            latency: Mutex::new(Latency::default()),
+        })
+    }
+
+    /// Metrics for one ESP32, named by its address.
+    pub fn device(&self, name: &str) -> Arc<Peer> {
+        let peer = Self::peer(name);
+        self.devices.lock().unwrap().push(peer.clone());
+        peer
+    }
+
+    /// Everything recorded, in Prometheus text format. Rates are over the
+    /// time since the last call.
+    pub fn render(&self) -> String {
+        let now = Instant::now();
+        let since = {
+            let mut exported = self.exported.lock().unwrap();
+            let since = now - *exported;
+            *exported = now;
+            since.as_secs_f64()
+        };
+        let devices = self.devices.lock().unwrap().clone();
+        let peers: Vec<&Peer> = std::iter::once(&*self.warp)
+            .chain(devices.iter().map(|peer| &**peer))
+            .collect();
+
+        let mut out = String::new();
+        header(
+            &mut out,
+            "bridge_uptime_seconds",
+            "gauge",
+            "Time since the bridge started.",
+        );
+        let _ = writeln!(
+            out,
+            "bridge_uptime_seconds {}",
+            (now - self.started).as_secs_f64()
+        );
+
+        // Totals and rates, read once so they agree
+        let traffic: Vec<_> = peers
+            .iter()
+            .flat_map(|peer| {
+                [("sent", &peer.sent), ("received", &peer.received)]
+                    .map(|(direction, traffic)| (peer.name.as_str(), direction, traffic.take()))
+            })
+            .collect();
+        for (i, unit) in ["messages", "bytes"].into_iter().enumerate() {
+            let total = format!("bridge_{}_total", unit);
+            header(
+                &mut out,
+                &total,
+                "counter",
+                &format!("JSON-RPC {} the bridge sent or received, by peer.", unit),
+            );
+            for (peer, direction, counts) in &traffic {
+                let _ = writeln!(
+                    out,
+                    "{}{{peer=\"{}\",direction=\"{}\"}} {}",
+                    total,
+                    escape(peer),
+                    direction,
+                    counts[i].0
+                );
+            }
+            let rate = format!("bridge_{}_per_second", unit);
+            header(
+                &mut out,
+                &rate,
+                "gauge",
+                &format!(
+                    "JSON-RPC {} per second since the last export, by peer.",
+                    unit
+                ),
+            );
+            for (peer, direction, counts) in &traffic {
+                let per_second = if since > 0.0 {
+                    counts[i].1 as f64 / since
+                } else {
+                    0.0
+                };
+                let _ = writeln!(
+                    out,
+                    "{}{{peer=\"{}\",direction=\"{}\"}} {}",
+                    rate,
+                    escape(peer),
+                    direction,
+                    per_second
+                );
+            }
+        }
+
+        let latencies: Vec<_> = devices
+            .iter()
+            .map(|peer| (peer.name.as_str(), peer.latency.lock().unwrap()))
+            .collect();
+        header(
+            &mut out,
+            "bridge_request_latency_seconds",
+            "summary",
+            "Time from writing a request to an ESP32 to reading its reply, by method.",
+        );
+        for (peer, latency) in &latencies {
+            for (method, histogram) in &latency.methods {
+                let labels = format!("peer=\"{}\",method=\"{}\"", escape(peer), escape(method));
+                summary(
+                    &mut out,
+                    "bridge_request_latency_seconds",
+                    &labels,
+                    histogram,
+                );
+            }
+        }
+        header(
+            &mut out,
+            "bridge_tool_latency_seconds",
+            "summary",
+            "Time from writing a tools/call to an ESP32 to reading its reply, by tool.",
+        );
+        for (peer, latency) in &latencies {
+            for (tool, histogram) in &latency.tools {
+                let labels = format!("peer=\"{}\",tool=\"{}\"", escape(peer), escape(tool));
+                summary(&mut out, "bridge_tool_latency_seconds", &labels, histogram);
+            }
+        }
+        header(
+            &mut out,
+            "bridge_request_timeouts_total",
+            "counter",
+            "Requests answered with a timeout error, by method.",
+        );
+        for (peer, latency) in &latencies {
+            for (method, count) in &latency.timeouts {
+                let _ = writeln!(
+                    out,
+                    "bridge_request_timeouts_total{{peer=\"{}\",method=\"{}\"}} {}",
+                    escape(peer),
+                    escape(method),
+                    count
+                );
+            }
+        }
+        out
+    }
+
+    /// Write what's recorded to `sink`, logging if that fails.
+    pub async fn export(&self, sink: &Sink) {
+        if let Err(e) = sink.write(self.render().as_bytes()).await {
+            warn!("Can't write metrics to {}: {}", sink, e);
+        }
+    }
+}
+
+fn header(out: &mut String, name: &str, kind: &str, help: &str) {
+    let _ = writeln!(out, "# HELP {} {}", name, help);
+    let _ = writeln!(out, "# TYPE {} {}", name, kind);
+}
+
+fn summary(out: &mut String, name: &str, labels: &str, histogram: &Histogram) {
+    for q in QUANTILES {
+        let value = histogram.quantile(q) as f64 / 1e6;
+        let _ = writeln!(out, "{}{{{},quantile=\"{}\"}} {}", name, labels, q, value);
+    }
+    let sum = histogram.sum as f64 / 1e6;
+    let _ = writeln!(out, "{}_sum{{{}}} {}", name, labels, sum);
+    let _ = writeln!(out, "{}_count{{{}}} {}", name, labels, histogram.count);
+}
+
+/// A label value, which may be any tool name the ESP32 lists.
+fn escape(value: &str) -> String {
+    value
+        .replace('\\', "\\\\")
+        .replace('"', "\\\"")
+        .replace('\n', "\\n")
+}
+
+/// Where metrics are written.
+#[derive(Clone, Debug)]
+pub enum Sink {
+    /// Replaced as a whole each time, so a reader never sees half of it.
+    File(PathBuf),
+    /// Connected to and written to each time.
+    #[cfg(unix)]
+    Socket(PathBuf),
+}
+
+impl std::fmt::Display for Sink {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Sink::File(path) => write!(f, "{}", path.display()),
+            #[cfg(unix)]
+            Sink::Socket(path) => write!(f, "socket {}", path.display()),
+        }
+    }
+}
+
+impl Sink {
+    async fn write(&self, text: &[u8]) -> std::io::Result<()> {
+        match self {
+            Sink::File(path) => {
+                let mut partial = path.clone().into_os_string();
+                partial.push(".tmp");
+                tokio::fs::write(&partial, text).await?;
+                tokio::fs::rename(&partial, path).await
+            }
+            #[cfg(unix)]
+            Sink::Socket(path) => {
+                use tokio::io::AsyncWriteExt;
+                let mut socket = tokio::net::UnixStream::connect(path).await?;
+                socket.write_all(text).await?;
+                socket.shutdown().await
+            }
+        }
+    }
+}
+
+/// Export to `sink` on SIGUSR1 and every `interval`, until aborted.
+pub fn spawn_exporter(
+    metrics: Arc<Metrics>,
+    sink: Sink,
+    interval: Option<Duration>,
+) -> JoinHandle<()> {
+    tokio::spawn(async move {
+        let mut usr1 = usr1();
+        let mut ticks = interval.map(|interval| {
+            let start = tokio::time::Instant::now() + interval;
+            let mut ticks = tokio::time::interval_at(start, interval);
+            ticks.set_missed_tick_behavior(tokio::time::MissedTickBehavior::Delay);
+            ticks
+        });
+
+        loop {
+            tokio::select! {
+                _ = tick(&mut ticks) => {}
+                _ = signalled(&mut usr1) => {}
+            }
+            metrics.export(&sink).await;
+        }
+    })
+}
+
+async fn tick(ticks: &mut Option<tokio::time::Interval>) {
+    match ticks {
+        Some(ticks) => {
+            ticks.tick().await;
+        }
+        None => std::future::pending().await,
+    }
+}
+
+#[cfg(unix)]
+type Signal = tokio::signal::unix::Signal;
+#[cfg(not(unix))]
+type Signal = std::convert::Infallible;
+
+#[cfg(unix)]
+fn usr1() -> Option<Signal> {
+    use tokio::signal::unix::{signal, SignalKind};
+    signal(SignalKind::user_defined1())
+        .map_err(|e| warn!("Can't listen for SIGUSR1: {}", e))
+        .ok()
+}
+
+#[cfg(not(unix))]
+fn usr1() -> Option<Signal> {
+    None
+}
+
+/// Resolves on each SIGUSR1, or never where there's none.
+#[cfg_attr(not(unix), allow(unused_variables))]
+async fn signalled(signal: &mut Option<Signal>) {
+    #[cfg(unix)]
+    if let Some(signal) = signal {
+        if signal.recv().await.is_some() {
+            return;
+        }
+    }
+    std::future::pending().await
+}
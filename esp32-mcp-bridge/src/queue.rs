@@ -0,0 +1,159 @@
+// Bounded queues between the bridge's tasks, and the writer tasks that drain
+// them into stdout or a socket.
+//
+// Each direction has its own queue and writer, so a slow reader on one side
+// only holds up what's going its way. A sender that finds its queue full
+// waits for room; how often and how long is kept in the queue's stats.
+
+use crate::metrics::Peer;
+use bytes::Bytes;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use tokio::io::{AsyncWrite, AsyncWriteExt, BufWriter};
+use tokio::sync::mpsc;
+use tokio::task::JoinHandle;
+use tracing::info;
+
+/// Backpressure seen by one queue, over every channel that used the name.
+pub struct Stats {
+    name: String,
+    depth: usize,
+    sent: AtomicU64,
+    /// Sends that found the queue full and waited.
+    full: AtomicU64,
+    waited_us: AtomicU64,
+    peak: AtomicUsize,
+}
+
+impl Stats {
+    pub fn new(name: String, depth: usize) -> Arc<Self> {
+        Arc::new(Self {
+            name,
+            depth,
+            sent: AtomicU64::new(0),
+            full: AtomicU64::new(0),
+            waited_us: AtomicU64::new(0),
+            peak: AtomicUsize::new(0),
+        })
+    }
+
+    pub fn log(&self) {
+        info!(
+            "Queue {}: {} sent, full {} times for {:?} in total, peak {}/{}",
+            self.name,
+            self.sent.load(Ordering::Relaxed),
+            self.full.load(Ordering::Relaxed),
+            Duration::from_micros(self.waited_us.load(Ordering::Relaxed)),
+            self.peak.load(Ordering::Relaxed),
+            self.depth
+        );
+    }
+}
+
+pub struct Queue<T> {
+    tx: mpsc::Sender<T>,
+    stats: Arc<Stats>,
+}
+
+// Not derived, which would require T: Clone
+impl<T> Clone for Queue<T> {
+    fn clone(&self) -> Self {
+        Self {
+            tx: self.tx.clone(),
+            stats: self.stats.clone(),
+        }
+    }
+}
+
+pub fn bounded<T>(stats: Arc<Stats>) -> (Queue<T>, mpsc::Receiver<T>) {
+    let (tx, rx) = mpsc::channel(stats.depth);
+    (Queue { tx, stats }, rx)
+}
+
+impl<T> Queue<T> {
+    /// Queue `item`, waiting for room. Gives it back if the receiver is gone.
+    pub async fn send(&self, item: T) -> Result<(), T> {
+        match self.reserve().await {
+            Some(permit) => {
+                permit.send(item);
+                Ok(())
+            }
+            None => Err(item),
+        }
+    }
+
+    /// Wait for room for one item, or none if the receiver is gone.
+    pub async fn reserve(&self) -> Option<Permit<'_, T>> {
+        let permit = match self.tx.try_reserve() {
+            Ok(permit) => permit,
+            Err(mpsc::error::TrySendError::Closed(())) => return None,
+            Err(mpsc::error::TrySendError::Full(())) => {
+                let start = Instant::now();
+                let permit = self.tx.reserve().await.ok()?;
+                self.stats.full.fetch_add(1, Ordering::Relaxed);
+                self.stats
+                    .waited_us
+                    .fetch_add(start.elapsed().as_micros() as u64, Ordering::Relaxed);
+                permit
+            }
+        };
+        Some(Permit {
+            permit,
+            queue: self,
+        })
+    }
+
+    /// Whether a send would wait.
+    pub fn is_full(&self) -> bool {
+        self.tx.capacity() == 0
+    }
+
+    /// Wait until a send wouldn't.
+    pub async fn ready(&self) {
+        let _ = self.tx.reserve().await;
+    }
+}
+
+/// Room for one item in a queue.
+pub struct Permit<'a, T> {
+    permit: mpsc::Permit<'a, T>,
+    queue: &'a Queue<T>,
+}
+
+impl<T> Permit<'_, T> {
+    pub fn send(self, item: T) {
+        self.permit.send(item);
+        let stats = &self.queue.stats;
+        stats.sent.fetch_add(1, Ordering::Relaxed);
+        let queued = self.queue.tx.max_capacity() - self.queue.tx.capacity();
+        stats.peak.fetch_max(queued, Ordering::Relaxed);
+    }
+}
+
+/// Write what arrives on `queue` to `writer` until every sender is gone,
+/// flushing whenever the queue runs empty so a burst goes out in few writes,
+/// and count it as sent to `peer`. Ends early with the error if a write
+/// fails.
+pub fn spawn_writer<W>(
+    writer: W,
+    mut queue: mpsc::Receiver<Bytes>,
+    peer: Arc<Peer>,
+) -> JoinHandle<std::io::Result<()>>
+where
+    W: AsyncWrite + Unpin + Send + 'static,
+{
+    tokio::spawn(async move {
+        let mut writer = BufWriter::new(writer);
+        while let Some(bytes) = queue.recv().await {
+            writer.write_all(&bytes).await?;
+            peer.sent.record(1, bytes.len());
+            while let Ok(bytes) = queue.try_recv() {
+                writer.write_all(&bytes).await?;
+                peer.sent.record(1, bytes.len());
+            }
+            writer.flush().await?;
+        }
+        Ok(())
+    })
+}
@@ -0,0 +1,141 @@
+// Warp's ids that clash with the bridge's own.
+//
+// The bridge asks the ESP32 things of its own under ids from RESERVED_BASE
+// up: merged tools/list parts, then BRIDGE_INIT_ID for the handshake. The
+// firmware only takes numeric ids, so the bridge can't pick a type Warp
+// doesn't use. Instead, a request from Warp with an id in that range goes on
+// under a stand-in from REMAP_BASE up, and whatever answers it gets Warp's
+// id back. Other lines pass through untouched and unparsed.
+
+use crate::codec;
+use crate::link::BRIDGE_INIT_ID;
+use crate::message::Message;
+use bytes::Bytes;
+use serde_json::value::RawValue;
+use serde_json::{json, Value};
+use std::collections::hash_map::{Entry, HashMap};
+
+/// The first id the bridge keeps for itself.
+pub const RESERVED_BASE: u32 = 0xF000_0000;
+
+/// Stand-ins for Warp's ids run from here up to BRIDGE_INIT_ID; the
+/// bridge's tools/list ids stay below.
+pub const REMAP_BASE: u32 = 0xF800_0000;
+
+// The reserved ids are the only ones written with ten digits
+const RESERVED_DIGITS: usize = 10;
+
+pub struct Remap {
+    next: u32,
+    /// Warp's id by the stand-in it went to the ESP32 under.
+    warp: HashMap<u32, u32>,
+}
+
+impl Default for Remap {
+    fn default() -> Self {
+        Self {
+            next: REMAP_BASE,
+            warp: HashMap::new(),
+        }
+    }
+}
+
+/// An id the bridge keeps for itself, as Warp or the ESP32 wrote it.
+fn reserved(id: &RawValue) -> Option<u32> {
+    id.get().parse().ok().filter(|&n| n >= RESERVED_BASE)
+}
+
+/// The same, once the line is parsed in full.
+fn reserved_value(id: &Value) -> Option<u32> {
+    let n = u32::try_from(id.as_u64()?).ok()?;
+    (n >= RESERVED_BASE).then_some(n)
+}
+
+/// Every message in a single message or a batch.
+fn envelopes(message: &mut Value) -> &mut [Value] {
+    match message {
+        Value::Array(batch) => batch,
+        single => std::slice::from_mut(single),
+    }
+}
+
+/// Whether `line` has a number long enough to be a reserved id. Most lines
+/// don't, and are passed on without being parsed.
+fn may_be_reserved(line: &[u8]) -> bool {
+    let mut digits = 0;
+    line.iter().any(|b| {
+        digits = if b.is_ascii_digit() { digits + 1 } else { 0 };
+        digits == RESERVED_DIGITS
+    })
+}
+
+impl Remap {
+    fn stand_in(&mut self, warp: u32) -> u32 {
+        // Skip stand-ins still waiting on an answer
+        loop {
+            let id = self.next;
+            self.next = match self.next + 1 {
+                BRIDGE_INIT_ID => REMAP_BASE,
+                next => next,
+            };
+            if let Entry::Vacant(entry) = self.warp.entry(id) {
+                entry.insert(warp);
+                return id;
+            }
+        }
+    }
+
+    /// A request line from Warp, with stand-ins for ids the bridge keeps.
+    pub fn request(&mut self, line: Bytes) -> Bytes {
+        if !may_be_reserved(&line) {
+            return line;
+        }
+        let clashes = Message::parse(&line)
+            .is_ok_and(|request| request.ids().any(|id| reserved(id).is_some()));
+        let Some(mut request) = clashes
+            .then(|| serde_json::from_slice::<Value>(&line).ok())
+            .flatten()
+        else {
+            return line;
+        };
+
+        for envelope in envelopes(&mut request) {
+            let Some(id) = envelope.get_mut("id") else {
+                continue;
+            };
+            if let Some(warp) = reserved_value(id) {
+                *id = json!(self.stand_in(warp));
+            }
+        }
+        codec::line(request.to_string())
+    }
+
+    /// A line for Warp, with Warp's ids back in place of stand-ins.
+    pub fn reply(&mut self, line: Bytes) -> Bytes {
+        if self.warp.is_empty() {
+            return line;
+        }
+        let stood_in = Message::parse(&line).is_ok_and(|reply| {
+            reply
+                .ids()
+                .filter_map(reserved)
+                .any(|id| self.warp.contains_key(&id))
+        });
+        let Some(mut reply) = stood_in
+            .then(|| serde_json::from_slice::<Value>(&line).ok())
+            .flatten()
+        else {
+            return line;
+        };
+
+        for envelope in envelopes(&mut reply) {
+            let Some(id) = envelope.get_mut("id") else {
+                continue;
+            };
+            if let Some(warp) = reserved_value(id).and_then(|n| self.warp.remove(&n)) {
+                *id = json!(warp);
+            }
+        }
+        codec::line(reply.to_string())
+    }
+}
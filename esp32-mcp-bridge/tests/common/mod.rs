@@ -0,0 +1,177 @@
+// The bridge binary between a pipe standing in for Warp and a fake ESP32
+// on loopback TCP, for the tests that run it end to end.
+//
+// The fake ESP32 speaks newline-delimited JSON (`--json-framing`) and answers
+// only what each test tells it to, so every line the bridge sends it, and
+// every line Warp gets back, is checked in order.
+
+// Each test binary uses only some of these
+#![allow(dead_code)]
+
+use serde_json::{json, Value};
+use std::future::Future;
+use std::process::{ExitStatus, Stdio};
+use std::time::Duration;
+use tokio::io::{AsyncBufReadExt, AsyncWriteExt, BufReader, Lines};
+use tokio::net::tcp::{OwnedReadHalf, OwnedWriteHalf};
+use tokio::net::TcpListener;
+use tokio::process::{Child, ChildStdin, ChildStdout, Command};
+
+// Long enough for a few reconnect backoffs, short enough to fail a hang fast
+const WAIT: Duration = Duration::from_secs(10);
+
+pub const BRIDGE_INIT_ID: u32 = u32::MAX;
+
+pub async fn within<T>(what: &str, future: impl Future<Output = T>) -> T {
+    tokio::time::timeout(WAIT, future)
+        .await
+        .unwrap_or_else(|_| panic!("timed out waiting for {}", what))
+}
+
+pub fn initialize(id: u32) -> Value {
+    json!({"jsonrpc": "2.0", "id": id, "method": "initialize", "params": {
+        "protocolVersion": "2024-11-05",
+        "capabilities": {},
+        "clientInfo": {"name": "warp", "version": "1.0"}
+    }})
+}
+
+pub fn initialize_result(id: &Value) -> Value {
+    json!({"jsonrpc": "2.0", "id": id, "result": {
+        "protocolVersion": "2024-11-05",
+        "capabilities": {"tools": {}},
+        "serverInfo": {"name": "esp32-c6-mcp", "version": "0.1.0"}
+    }})
+}
+
+/// The bridge, with its stdin and stdout as Warp's end of the session.
+pub struct Bridge {
+    child: Child,
+    stdin: ChildStdin,
+    stdout: Lines<BufReader<ChildStdout>>,
+}
+
+impl Bridge {
+    /// Start the bridge for the ESP32 on `port`, with options of its own.
+    pub fn spawn(port: u16, args: &[&str]) -> Self {
+        let mut child = Command::new(env!("CARGO_BIN_EXE_esp32-mcp-bridge"))
+            .args(["--json-framing", "--esp32-ip", "127.0.0.1", "--port"])
+            .arg(port.to_string())
+            .args(args)
+            .stdin(Stdio::piped())
+            .stdout(Stdio::piped())
+            .stderr(Stdio::null())
+            .kill_on_drop(true)
+            .spawn()
+            .expect("start the bridge");
+        let stdin = child.stdin.take().expect("bridge stdin");
+        let stdout = BufReader::new(child.stdout.take().expect("bridge stdout")).lines();
+        Self {
+            child,
+            stdin,
+            stdout,
+        }
+    }
+
+    pub async fn send(&mut self, message: Value) {
+        let line = format!("{}\n", message);
+        self.stdin
+            .write_all(line.as_bytes())
+            .await
+            .expect("write to the bridge");
+    }
+
+    /// Write `bytes` as they are, which fails once the bridge has exited.
+    pub async fn send_bytes(&mut self, bytes: &[u8]) -> std::io::Result<()> {
+        self.stdin.write_all(bytes).await
+    }
+
+    pub async fn receive(&mut self) -> Value {
+        let line = within("a reply from the bridge", self.stdout.next_line())
+            .await
+            .expect("read from the bridge")
+            .expect("bridge closed its stdout");
+        serde_json::from_str(&line).expect("reply is JSON")
+    }
+
+    /// Every reply until the bridge closes its stdout.
+    pub async fn receive_all(&mut self) -> Vec<Value> {
+        let mut replies = Vec::new();
+        while let Some(line) = within("the bridge to finish", self.stdout.next_line())
+            .await
+            .expect("read from the bridge")
+        {
+            replies.push(serde_json::from_str(&line).expect("reply is JSON"));
+        }
+        replies
+    }
+
+    /// Wait for the bridge to end on its own, with Warp's stdin still open.
+    pub async fn exited(&mut self) -> ExitStatus {
+        within("the bridge to exit", self.child.wait())
+            .await
+            .expect("wait for the bridge")
+    }
+}
+
+/// One connection from the bridge, as the fake ESP32 sees it.
+pub struct Connection {
+    reader: Lines<BufReader<OwnedReadHalf>>,
+    writer: OwnedWriteHalf,
+}
+
+impl Connection {
+    pub async fn accept(listener: &TcpListener) -> Self {
+        let (stream, _) = within("the bridge to connect", listener.accept())
+            .await
+            .expect("accept the bridge");
+        let (reader, writer) = stream.into_split();
+        Self {
+            reader: BufReader::new(reader).lines(),
+            writer,
+        }
+    }
+
+    pub async fn receive(&mut self) -> Value {
+        let line = within("a request from the bridge", self.reader.next_line())
+            .await
+            .expect("read from the bridge")
+            .expect("bridge closed the connection");
+        serde_json::from_str(&line).expect("request is JSON")
+    }
+
+    pub async fn send(&mut self, message: Value) {
+        let line = format!("{}\n", message);
+        self.writer
+            .write_all(line.as_bytes())
+            .await
+            .expect("write to the bridge");
+    }
+
+    /// Write `bytes` as they are, which fails once the bridge has hung up.
+    pub async fn send_bytes(&mut self, bytes: &[u8]) -> std::io::Result<()> {
+        self.writer.write_all(bytes).await
+    }
+
+    /// Complete Warp's handshake on this connection.
+    pub async fn handshake(&mut self, bridge: &mut Bridge) {
+        bridge.send(initialize(1)).await;
+        let request = self.receive().await;
+        assert_eq!(request["method"], "initialize");
+        self.send(initialize_result(&request["id"])).await;
+        assert_eq!(bridge.receive().await, initialize_result(&json!(1)));
+
+        bridge
+            .send(json!({"jsonrpc": "2.0", "method": "notifications/initialized"}))
+            .await;
+        assert_eq!(self.receive().await["method"], "notifications/initialized");
+    }
+}
+
+pub async fn listen() -> (TcpListener, u16) {
+    let listener = TcpListener::bind("127.0.0.1:0")
+        .await
+        .expect("bind loopback");
+    let port = listener.local_addr().expect("listener address").port();
+    (listener, port)
+}
@@ -0,0 +1,87 @@
+// Deadlines, end to end: Warp is answered with a timeout error for its own
+// requests only, and only for those the ESP32 didn't answer.
+//
+//     cargo test --test deadlines
+
+mod common;
+
+use common::{initialize, listen, Bridge, Connection, BRIDGE_INIT_ID};
+use serde_json::json;
+use std::time::Duration;
+
+#[tokio::test]
+async fn never_times_out_the_bridges_own_initialize() {
+    let (listener, port) = listen().await;
+    let device = format!("esp32=127.0.0.1:{}", port);
+    let mut bridge = Bridge::spawn(port, &["--device", &device, "--request-timeout", "0.2"]);
+    let mut esp32 = Connection::accept(&listener).await;
+
+    // With --device the bridge answers initialize and passes it on under
+    // its own id
+    bridge.send(initialize(1)).await;
+    assert_eq!(bridge.receive().await["id"], 1);
+    assert_eq!(esp32.receive().await["id"], BRIDGE_INIT_ID);
+
+    // The ESP32 never answers it; past the deadline, the next line Warp
+    // gets is the reply to its ping
+    tokio::time::sleep(Duration::from_millis(500)).await;
+    let ping = json!({"jsonrpc": "2.0", "id": 2, "method": "ping"});
+    bridge.send(ping).await;
+    assert_eq!(
+        bridge.receive().await,
+        json!({"jsonrpc": "2.0", "id": 2, "result": {}})
+    );
+}
+
+#[tokio::test]
+async fn times_out_warps_requests() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &["--request-timeout", "0.2"]);
+    let mut esp32 = Connection::accept(&listener).await;
+    esp32.handshake(&mut bridge).await;
+
+    let list = json!({"jsonrpc": "2.0", "id": 2, "method": "tools/list"});
+    bridge.send(list).await;
+    assert_eq!(esp32.receive().await["id"], 2);
+
+    let reply = bridge.receive().await;
+    assert_eq!(reply["id"], 2, "unexpected reply: {}", reply);
+    assert_eq!(
+        reply["error"]["code"], -32001,
+        "unexpected reply: {}",
+        reply
+    );
+}
+
+#[tokio::test]
+async fn answers_an_unreadable_request_once() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &["--request-timeout", "0.2"]);
+    let mut esp32 = Connection::accept(&listener).await;
+    esp32.handshake(&mut bridge).await;
+
+    let list = json!({"jsonrpc": "2.0", "id": 2, "method": "tools/list"});
+    bridge.send(list).await;
+    assert_eq!(esp32.receive().await["id"], 2);
+
+    // The ESP32 couldn't parse it, so its error has a null id
+    let error = json!({"jsonrpc": "2.0", "id": null,
+        "error": {"code": -32700, "message": "Parse error"}});
+    esp32.send(error).await;
+    let reply = bridge.receive().await;
+    assert_eq!(reply["id"], 2, "unexpected reply: {}", reply);
+    assert_eq!(
+        reply["error"]["code"], -32700,
+        "unexpected reply: {}",
+        reply
+    );
+
+    // Past the deadline, the next line Warp gets is the reply to its ping
+    tokio::time::sleep(Duration::from_millis(500)).await;
+    let ping = json!({"jsonrpc": "2.0", "id": 3, "method": "ping"});
+    bridge.send(ping).await;
+    assert_eq!(esp32.receive().await["id"], 3);
+    let pong = json!({"jsonrpc": "2.0", "id": 3, "result": {}});
+    esp32.send(pong.clone()).await;
+    assert_eq!(bridge.receive().await, pong);
+}
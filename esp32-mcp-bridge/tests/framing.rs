@@ -0,0 +1,33 @@
+// Line framing, end to end: neither side can make the bridge buffer a line
+// past codec::MAX_FRAME by never sending its newline.
+//
+//     cargo test --test framing
+
+mod common;
+
+use common::{listen, within, Bridge, Connection};
+
+// One byte past the bridge's limit
+const TOO_LONG: usize = (1 << 20) + 1;
+
+#[tokio::test]
+async fn drops_an_esp32_that_never_ends_its_line() {
+    let (listener, port) = listen().await;
+    let _bridge = Bridge::spawn(port, &["--reconnect-attempts", "1"]);
+    let mut esp32 = Connection::accept(&listener).await;
+
+    // The bridge hangs up partway and reconnects
+    let _ = esp32.send_bytes(&vec![b' '; TOO_LONG]).await;
+    Connection::accept(&listener).await;
+}
+
+#[tokio::test]
+async fn ends_the_session_when_warp_never_ends_its_line() {
+    let (_listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &[]);
+
+    // The write fails once the bridge exits, unless it's all buffered first
+    let line = vec![b' '; TOO_LONG];
+    let _ = within("the bridge to read", bridge.send_bytes(&line)).await;
+    assert!(bridge.exited().await.success());
+}
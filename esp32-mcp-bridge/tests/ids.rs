@@ -0,0 +1,64 @@
+// Warp's ids, end to end: ones that clash with the ids the bridge uses for
+// its own requests reach the ESP32 as stand-ins and come back as they were.
+//
+//     cargo test --test ids
+
+mod common;
+
+use common::{initialize, initialize_result, listen, Bridge, Connection, BRIDGE_INIT_ID};
+use serde_json::json;
+
+// The first of the bridge's tools/list ids with several devices
+const LIST_ID_BASE: u32 = 0xF000_0000;
+
+#[tokio::test]
+async fn answers_an_initialize_with_the_bridges_own_id() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &[]);
+    let mut esp32 = Connection::accept(&listener).await;
+
+    bridge.send(initialize(BRIDGE_INIT_ID)).await;
+    let request = esp32.receive().await;
+    assert_eq!(request["method"], "initialize");
+    assert_ne!(request["id"], BRIDGE_INIT_ID);
+
+    esp32.send(initialize_result(&request["id"])).await;
+    assert_eq!(
+        bridge.receive().await,
+        initialize_result(&json!(BRIDGE_INIT_ID))
+    );
+}
+
+#[tokio::test]
+async fn keeps_warps_calls_apart_from_merged_tools_lists() {
+    let (listener, port) = listen().await;
+    let device = format!("esp32=127.0.0.1:{}", port);
+    let mut bridge = Bridge::spawn(port, &["--device", &device]);
+    let mut esp32 = Connection::accept(&listener).await;
+
+    // The bridge asks the ESP32 for its tools under its first tools/list id,
+    // which is also the id of Warp's call
+    bridge
+        .send(json!({"jsonrpc": "2.0", "id": 1, "method": "tools/list"}))
+        .await;
+    let list = esp32.receive().await;
+    assert_eq!(list["id"], LIST_ID_BASE);
+
+    let call = json!({"jsonrpc": "2.0", "id": LIST_ID_BASE, "method": "tools/call",
+        "params": {"name": "esp32__compute_add", "arguments": {"a": 2, "b": 3}}});
+    bridge.send(call).await;
+    let call = esp32.receive().await;
+    assert_ne!(call["id"], LIST_ID_BASE);
+
+    let sum = |id| json!({"jsonrpc": "2.0", "id": id, "result": {"content": []}});
+    esp32.send(sum(call["id"].clone())).await;
+    assert_eq!(bridge.receive().await, sum(json!(LIST_ID_BASE)));
+
+    let tool = json!({"name": "compute_add"});
+    esp32
+        .send(json!({"jsonrpc": "2.0", "id": list["id"], "result": {"tools": [tool]}}))
+        .await;
+    let merged = bridge.receive().await;
+    assert_eq!(merged["id"], 1);
+    assert_eq!(merged["result"]["tools"][0]["name"], "esp32__compute_add");
+}
@@ -0,0 +1,178 @@
+// Reconnects, end to end: the fake ESP32 drops the connection, and the
+// bridge replays the handshake on a new one or gives up.
+//
+//     cargo test --test reconnect
+
+mod common;
+
+use common::{initialize, initialize_result, listen, Bridge, Connection, BRIDGE_INIT_ID};
+use serde_json::{json, Value};
+use std::time::Duration;
+
+fn assert_error(reply: &Value, id: u32, message: &str) {
+    assert_eq!(reply["id"], id, "unexpected reply: {}", reply);
+    assert_eq!(
+        reply["error"]["code"], -32000,
+        "unexpected reply: {}",
+        reply
+    );
+    let text = reply["error"]["message"].as_str().unwrap_or_default();
+    assert!(text.contains(message), "unexpected reply: {}", reply);
+}
+
+#[tokio::test]
+async fn replays_the_handshake_and_retry_safe_requests() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &["--reconnect-attempts", "3"]);
+    let mut esp32 = Connection::accept(&listener).await;
+    esp32.handshake(&mut bridge).await;
+
+    // tools/list is safe to send again; a tools/call to an unannotated tool
+    // isn't
+    let list = json!({"jsonrpc": "2.0", "id": 2, "method": "tools/list"});
+    let call = json!({"jsonrpc": "2.0", "id": 3, "method": "tools/call",
+        "params": {"name": "compute_add", "arguments": {"a": 2, "b": 3}}});
+    bridge.send(list.clone()).await;
+    bridge.send(call).await;
+    assert_eq!(esp32.receive().await["id"], 2);
+    assert_eq!(esp32.receive().await["id"], 3);
+    drop(esp32);
+
+    let reply = bridge.receive().await;
+    assert_error(&reply, 3, "may or may not have run");
+
+    // The handshake goes first on the new connection, under the bridge's id
+    let mut esp32 = Connection::accept(&listener).await;
+    let replay = esp32.receive().await;
+    assert_eq!(replay["method"], "initialize");
+    assert_eq!(replay["id"], BRIDGE_INIT_ID);
+    assert_eq!(replay["params"], initialize(1)["params"]);
+    assert_eq!(esp32.receive().await["method"], "notifications/initialized");
+    assert_eq!(esp32.receive().await, list);
+
+    // The reply to the replay isn't Warp's to see
+    esp32.send(initialize_result(&replay["id"])).await;
+    let tools = json!({"jsonrpc": "2.0", "id": 2, "result": {"tools": []}});
+    esp32.send(tools.clone()).await;
+    assert_eq!(bridge.receive().await, tools);
+}
+
+#[tokio::test]
+async fn retries_calls_to_tools_a_live_tools_list_annotates() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &["--reconnect-attempts", "3"]);
+    let mut esp32 = Connection::accept(&listener).await;
+    esp32.handshake(&mut bridge).await;
+
+    // Without --cache-dir, and on a page the cache doesn't keep
+    let list = json!({"jsonrpc": "2.0", "id": 2, "method": "tools/list"});
+    bridge.send(list).await;
+    assert_eq!(esp32.receive().await["id"], 2);
+    let tools = json!({"jsonrpc": "2.0", "id": 2, "result": {"nextCursor": "2", "tools": [
+        {"name": "compute_add", "inputSchema": {"type": "object"},
+         "annotations": {"readOnlyHint": true}}]}});
+    esp32.send(tools.clone()).await;
+    assert_eq!(bridge.receive().await, tools);
+
+    let call = json!({"jsonrpc": "2.0", "id": 3, "method": "tools/call",
+        "params": {"name": "compute_add", "arguments": {"a": 2, "b": 3}}});
+    bridge.send(call.clone()).await;
+    assert_eq!(esp32.receive().await["id"], 3);
+    drop(esp32);
+
+    let mut esp32 = Connection::accept(&listener).await;
+    let replay = esp32.receive().await;
+    assert_eq!(replay["id"], BRIDGE_INIT_ID);
+    assert_eq!(esp32.receive().await["method"], "notifications/initialized");
+    assert_eq!(esp32.receive().await, call);
+
+    esp32.send(initialize_result(&replay["id"])).await;
+    let sum = json!({"jsonrpc": "2.0", "id": 3, "result": {"content": []}});
+    esp32.send(sum.clone()).await;
+    assert_eq!(bridge.receive().await, sum);
+}
+
+#[tokio::test]
+async fn ends_the_session_without_reconnect_attempts() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &["--reconnect-attempts", "0"]);
+    let mut esp32 = Connection::accept(&listener).await;
+    esp32.handshake(&mut bridge).await;
+
+    bridge
+        .send(json!({"jsonrpc": "2.0", "id": 2, "method": "tools/list"}))
+        .await;
+    assert_eq!(esp32.receive().await["id"], 2);
+    drop(esp32);
+
+    assert_error(&bridge.receive().await, 2, "ESP32 unreachable");
+    assert!(bridge.exited().await.success());
+}
+
+#[tokio::test]
+async fn gives_up_once_reconnect_attempts_run_out() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &["--reconnect-attempts", "2"]);
+    let mut esp32 = Connection::accept(&listener).await;
+    esp32.handshake(&mut bridge).await;
+
+    bridge
+        .send(json!({"jsonrpc": "2.0", "id": 2, "method": "tools/list"}))
+        .await;
+    assert_eq!(esp32.receive().await["id"], 2);
+
+    // Nothing listens any more, so every reconnect is refused
+    drop(listener);
+    drop(esp32);
+
+    assert_error(&bridge.receive().await, 2, "ESP32 unreachable");
+    assert!(bridge.exited().await.success());
+}
+
+#[tokio::test]
+async fn ends_the_session_when_a_write_finds_the_connection_gone() {
+    let (listener, port) = listen().await;
+    let mut bridge = Bridge::spawn(port, &["--reconnect-attempts", "0", "--queue-depth", "1"]);
+    let mut esp32 = Connection::accept(&listener).await;
+    esp32.handshake(&mut bridge).await;
+
+    // Warp stops reading while the ESP32 answers more than its stdout pipe
+    // holds, so the bridge stops reading the ESP32 and only a write can
+    // find the connection gone
+    let pad = "x".repeat(4096);
+    for id in 100..132 {
+        bridge
+            .send(json!({"jsonrpc": "2.0", "id": id, "method": "tools/list"}))
+            .await;
+        assert_eq!(esp32.receive().await["id"], id);
+    }
+    for id in 100..132 {
+        let tools = json!({"jsonrpc": "2.0", "id": id, "result": {"tools": [], "pad": pad}});
+        esp32.send(tools).await;
+    }
+    drop(esp32);
+
+    // The first write is reset, the second fails and the third finds the
+    // writer gone
+    tokio::time::sleep(Duration::from_millis(100)).await;
+    for id in 200..203 {
+        let call = json!({"jsonrpc": "2.0", "id": id, "method": "tools/call",
+            "params": {"name": "compute_add", "arguments": {"a": 2, "b": 3}}});
+        bridge.send(call).await;
+        tokio::time::sleep(Duration::from_millis(50)).await;
+    }
+
+    let replies = bridge.receive_all().await;
+    for id in 200..203 {
+        let reply = replies
+            .iter()
+            .find(|reply| reply["id"] == id)
+            .unwrap_or_else(|| panic!("no reply to {}", id));
+        assert_eq!(
+            reply["error"]["code"], -32000,
+            "unexpected reply: {}",
+            reply
+        );
+    }
+    assert!(bridge.exited().await.success());
+}
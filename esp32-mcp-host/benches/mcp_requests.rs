@@ -0,0 +1,176 @@
+// Request handling benchmarks for the MCP core.
+//
+// Each case is parsed and handled exactly as the firmware does it
+// (`serde_json_core` for the envelope, then `handle_mcp_request`). Criterion
+// reports time per call; a counting global allocator reports allocations per
+// call, printed before each case is measured.
+//
+//     cargo bench
+//     cargo bench -- adversarial/
+
+use criterion::{black_box, criterion_group, criterion_main, Criterion};
+use esp32_c6_mcp_rs::buffers::MCP_RESULT_BUFFER_SIZE;
+use esp32_c6_mcp_rs::hal::{set_led_sink, LedSink};
+use esp32_c6_mcp_rs::mcp::{handle_mcp_request, LedCommand, McpRequest};
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+struct CountingAllocator;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+/// Accepts LED commands so led_control measures the handler, not an error.
+struct NullLed;
+
+impl LedSink for NullLed {
+    fn send(&self, _command: LedCommand) -> Result<(), &'static str> {
+        Ok(())
+    }
+}
+
+static LED: &dyn LedSink = &NullLed;
+
+const ALLOCATION_SAMPLE_CALLS: usize = 1000;
+
+/// Parse and handle one request; returns the reply length so nothing is
+/// optimized away.
+fn handle(raw: &str, out: &mut [u8]) -> usize {
+    let (request, _) =
+        serde_json_core::from_str::<McpRequest>(raw).expect("benchmark request must parse");
+    let response = handle_mcp_request(&request, raw, out);
+    match response.error {
+        Some(error) => error.message.len(),
+        None => response.result.map_or(0, str::len),
+    }
+}
+
+fn allocations_per_call(raw: &str, out: &mut [u8]) -> f64 {
+    let before = ALLOCATIONS.load(Ordering::Relaxed);
+    for _ in 0..ALLOCATION_SAMPLE_CALLS {
+        black_box(handle(black_box(raw), out));
+    }
+    (ALLOCATIONS.load(Ordering::Relaxed) - before) as f64 / ALLOCATION_SAMPLE_CALLS as f64
+}
+
+fn tools_call(tool: &str, arguments: &str) -> String {
+    format!(
+        r#"{{"jsonrpc":"2.0","id":1,"method":"tools/call","params":{{"name":"{}","arguments":{}}}}}"#,
+        tool, arguments
+    )
+}
+
+/// What Warp and the bridge actually send.
+fn realistic() -> Vec<(&'static str, String)> {
+    vec![
+        (
+            "initialize",
+            r#"{"jsonrpc":"2.0","id":1,"method":"initialize","params":{"protocolVersion":"2024-11-05","capabilities":{},"clientInfo":{"name":"warp","version":"1.0"}}}"#.to_string(),
+        ),
+        (
+            "tools/list",
+            r#"{"jsonrpc":"2.0","id":2,"method":"tools/list","params":{}}"#.to_string(),
+        ),
+        ("wifi_status", tools_call("wifi_status", "{}")),
+        (
+            "wifi_status/detailed",
+            tools_call("wifi_status", r#"{"detailed":true}"#),
+        ),
+        (
+            "led_control/color",
+            tools_call("led_control", r#"{"color":"green","brightness":50}"#),
+        ),
+        (
+            "led_control/rgb",
+            tools_call("led_control", r#"{"r":12,"g":200,"b":77}"#),
+        ),
+        ("compute_add", tools_call("compute_add", r#"{"a":2,"b":3.5}"#)),
+        (
+            "compute_multiply",
+            tools_call("compute_multiply", r#"{"a":-1.25e3,"b":0.004}"#),
+        ),
+    ]
+}
+
+/// Inputs that stress the scanner and decoders rather than the handlers.
+fn adversarial() -> Vec<(&'static str, String)> {
+    let long = "x".repeat(2000);
+    let escaped = r#"\"\\é\n"#.repeat(200);
+    let nested = format!("{}0{}", "[".repeat(256), "]".repeat(256));
+
+    vec![
+        (
+            "long_string_argument",
+            tools_call("led_control", &format!(r#"{{"color":"{}"}}"#, long)),
+        ),
+        (
+            "long_unknown_argument",
+            tools_call("compute_add", &format!(r#"{{"note":"{}","a":1,"b":2}}"#, long)),
+        ),
+        (
+            "escaped_string_argument",
+            tools_call("compute_add", &format!(r#"{{"a":1,"note":"{}","b":2}}"#, escaped)),
+        ),
+        (
+            "nested_argument",
+            tools_call("compute_add", &format!(r#"{{"a":1,"b":2,"extra":{}}}"#, nested)),
+        ),
+        (
+            "keys_reordered",
+            r#"{"params":{"arguments":{"b":3.5,"a":2},"name":"compute_add"},"method":"tools/call","id":1,"jsonrpc":"2.0"}"#.to_string(),
+        ),
+        (
+            "whitespace",
+            "{\r\n\t\"jsonrpc\" : \"2.0\" ,\r\n\t\"id\" : 1 ,\r\n\t\"method\" : \"tools/call\" ,\r\n\t\"params\" : {\r\n\t\t\"name\" : \"led_control\" ,\r\n\t\t\"arguments\" : {\r\n\t\t\t\"r\" : 1 ,\r\n\t\t\t\"g\" : 2 ,\r\n\t\t\t\"b\" : 3 ,\r\n\t\t\t\"brightness\" : 40\r\n\t\t}\r\n\t}\r\n}   ".to_string(),
+        ),
+        (
+            "unicode",
+            tools_call(
+                "compute_multiply",
+                r#"{"label":"température 🌡️ – 温度 🌡","a":21.5,"b":1.8}"#,
+            ),
+        ),
+        ("unknown_tool", tools_call("does_not_exist", r#"{"a":1}"#)),
+    ]
+}
+
+fn bench_requests(c: &mut Criterion) {
+    set_led_sink(&LED);
+    let mut out = [0u8; MCP_RESULT_BUFFER_SIZE];
+
+    for (group_name, cases) in [("realistic", realistic()), ("adversarial", adversarial())] {
+        let mut group = c.benchmark_group(group_name);
+        for (name, raw) in &cases {
+            println!(
+                "{}/{}: {} bytes, {:.2} allocations/call",
+                group_name,
+                name,
+                raw.len(),
+                allocations_per_call(raw, &mut out)
+            );
+            group.bench_function(*name, |b| b.iter(|| handle(black_box(raw), &mut out)));
+        }
+        group.finish();
+    }
+}
+
+criterion_group!(benches, bench_requests);
+criterion_main!(benches);
@@ -0,0 +1,142 @@
+// Number codec benchmarks: the cost of one conversion with `num` versus core.
+//
+// Each case runs over a small set of inputs and reports per-element
+// throughput, so Criterion's time is the cost per conversion. The host has an
+// FPU, so the ratios understate the difference on the ESP32-C6, where every
+// f32 operation in core's slow paths is a soft-float call.
+//
+//     cargo bench --bench num_codec
+//     cargo bench --bench num_codec -- format/
+
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use esp32_c6_mcp_rs::num::{parse_f32, Number, Shortest};
+use std::fmt::Write;
+
+/// Decimals as tools receive them: short, mostly within the exact fast path.
+const SHORT: &[&str] = &[
+    "3.5", "-1250", "0.004", "21.5", "1.8", "255", "-0.25", "100.125",
+];
+
+/// Long or extreme literals that take the fallback path.
+const LONG: &[&str] = &[
+    "3.4028235e38",
+    "1.17549435e-38",
+    "0.30000000000000004",
+    "123456789.123456789",
+    "-6.02214076e23",
+    "1e-45",
+];
+
+const INTEGERS: &[&str] = &["2", "-17", "4096", "123456789", "-9007199254740993"];
+
+/// Results as compute handlers produce them.
+const FLOATS: &[f32] = &[
+    5.5,
+    -1.25e3,
+    0.004,
+    38.7,
+    1.0 / 3.0,
+    3.4028235e38,
+    1.1754944e-38,
+    -0.1,
+];
+
+fn parse_cases() -> [(&'static str, &'static [&'static str]); 3] {
+    [("short", SHORT), ("long", LONG), ("integers", INTEGERS)]
+}
+
+fn bench_parse(c: &mut Criterion) {
+    let mut group = c.benchmark_group("parse");
+    for (name, inputs) in parse_cases() {
+        group.throughput(Throughput::Elements(inputs.len() as u64));
+        group.bench_with_input(
+            BenchmarkId::new("num::parse_f32", name),
+            inputs,
+            |b, inputs| {
+                b.iter(|| {
+                    for raw in inputs {
+                        black_box(parse_f32(black_box(raw)));
+                    }
+                })
+            },
+        );
+        group.bench_with_input(
+            BenchmarkId::new("Number::parse", name),
+            inputs,
+            |b, inputs| {
+                b.iter(|| {
+                    for raw in inputs {
+                        black_box(Number::parse(black_box(raw)));
+                    }
+                })
+            },
+        );
+        group.bench_with_input(BenchmarkId::new("core", name), inputs, |b, inputs| {
+            b.iter(|| {
+                for raw in inputs {
+                    black_box(black_box(raw).parse::<f32>().ok());
+                }
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_format(c: &mut Criterion) {
+    let mut group = c.benchmark_group("format");
+    group.throughput(Throughput::Elements(FLOATS.len() as u64));
+    let mut out = String::with_capacity(64);
+
+    group.bench_function("num::Shortest", |b| {
+        b.iter(|| {
+            for &value in FLOATS {
+                out.clear();
+                write!(out, "{}", Shortest(black_box(value))).unwrap();
+                black_box(out.len());
+            }
+        })
+    });
+    group.bench_function("core", |b| {
+        b.iter(|| {
+            for &value in FLOATS {
+                out.clear();
+                write!(out, "{}", black_box(value)).unwrap();
+                black_box(out.len());
+            }
+        })
+    });
+    group.finish();
+}
+
+/// compute_add end to end on integral operands: parse, add, print.
+fn bench_integral_add(c: &mut Criterion) {
+    let mut group = c.benchmark_group("integral_add");
+    let pairs: Vec<_> = INTEGERS.iter().zip(INTEGERS.iter().rev()).collect();
+    group.throughput(Throughput::Elements(pairs.len() as u64));
+    let mut out = String::with_capacity(64);
+
+    group.bench_function("Number", |b| {
+        b.iter(|| {
+            for (a, b) in &pairs {
+                let (a, b) = (Number::parse(black_box(a)), Number::parse(black_box(b)));
+                out.clear();
+                write!(out, "{}", a.unwrap() + b.unwrap()).unwrap();
+                black_box(out.len());
+            }
+        })
+    });
+    group.bench_function("f32", |b| {
+        b.iter(|| {
+            for (a, b) in &pairs {
+                let (a, b) = (black_box(a).parse::<f32>(), black_box(b).parse::<f32>());
+                out.clear();
+                write!(out, "{}", a.unwrap() + b.unwrap()).unwrap();
+                black_box(out.len());
+            }
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, bench_parse, bench_format, bench_integral_add);
+criterion_main!(benches);
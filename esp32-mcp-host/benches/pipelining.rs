@@ -0,0 +1,133 @@
+// Connection throughput: messages per second on one socket, with requests
+// sent one at a time or pipelined.
+//
+// A server thread serves the MCP core over loopback TCP exactly as
+// esp32-mcp-host does. Lockstep sends a request and waits for its reply
+// before sending the next. Pipelined writes a whole burst at once: the
+// connection handler answers every request already buffered back to back
+// and flushes their replies together. Criterion reports both in messages
+// per second. Before pipelining, the firmware slept 10 ms after every reply,
+// which capped a connection at 100 messages per second either way.
+//
+//     cargo bench --bench pipelining
+
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
+use embedded_io_adapters::tokio_1::FromTokio;
+use esp32_c6_mcp_rs::buffers::{
+    MCP_FRAME_BUFFER_SIZE, MCP_JSON_BUFFER_SIZE, MCP_RESULT_BUFFER_SIZE,
+};
+use esp32_c6_mcp_rs::server::handle_mcp_connection;
+use std::io::{BufRead, BufReader, Write};
+use std::net::{SocketAddr, TcpStream};
+use tokio::io::BufStream;
+
+// Requests per measured iteration
+const BURST: usize = 32;
+
+const REQUEST: &str = r#"{"jsonrpc":"2.0","id":1,"method":"tools/call","params":{"name":"compute_add","arguments":{"a":2,"b":3.5}}}"#;
+
+/// Serve MCP connections on a loopback port from a thread of their own.
+fn spawn_server() -> SocketAddr {
+    let listener = std::net::TcpListener::bind("127.0.0.1:0").expect("bind loopback");
+    let addr = listener.local_addr().expect("listener address");
+    listener
+        .set_nonblocking(true)
+        .expect("nonblocking listener");
+
+    std::thread::spawn(move || {
+        let runtime = tokio::runtime::Builder::new_current_thread()
+            .enable_all()
+            .build()
+            .expect("tokio runtime");
+        // As in esp32-mcp-host, connection futures aren't Send
+        let tasks = tokio::task::LocalSet::new();
+        tasks.block_on(&runtime, async move {
+            let listener = tokio::net::TcpListener::from_std(listener).expect("tokio listener");
+            while let Ok((stream, _)) = listener.accept().await {
+                tokio::task::spawn_local(async move {
+                    stream.set_nodelay(true)?;
+                    let mut socket = FromTokio::new(BufStream::new(stream));
+                    let mut frame_buf = vec![0u8; MCP_FRAME_BUFFER_SIZE];
+                    let mut json_buf = vec![0u8; MCP_JSON_BUFFER_SIZE];
+                    let mut result_buf = vec![0u8; MCP_RESULT_BUFFER_SIZE];
+                    handle_mcp_connection(
+                        &mut socket,
+                        &mut frame_buf,
+                        &mut json_buf,
+                        &mut result_buf,
+                    )
+                    .await
+                });
+            }
+        });
+    });
+    addr
+}
+
+/// One client connection, read a line at a time.
+struct Client {
+    writer: TcpStream,
+    reader: BufReader<TcpStream>,
+    line: String,
+}
+
+impl Client {
+    fn connect(addr: SocketAddr) -> Self {
+        let writer = TcpStream::connect(addr).expect("connect to server");
+        writer.set_nodelay(true).expect("nodelay");
+        let reader = BufReader::new(writer.try_clone().expect("clone stream"));
+        Self {
+            writer,
+            reader,
+            line: String::new(),
+        }
+    }
+
+    fn send(&mut self, requests: &[u8]) {
+        self.writer.write_all(requests).expect("write requests");
+    }
+
+    fn receive(&mut self, replies: usize) {
+        for _ in 0..replies {
+            self.line.clear();
+            self.reader.read_line(&mut self.line).expect("read reply");
+            assert!(
+                self.line.contains(r#""result""#),
+                "unexpected reply: {}",
+                self.line
+            );
+        }
+    }
+}
+
+fn bench_pipelining(c: &mut Criterion) {
+    let addr = spawn_server();
+    let request = format!("{}\n", REQUEST);
+    let burst = request.repeat(BURST);
+
+    let mut group = c.benchmark_group("connection");
+    group.throughput(Throughput::Elements(BURST as u64));
+
+    let mut client = Client::connect(addr);
+    group.bench_function("lockstep", |b| {
+        b.iter(|| {
+            for _ in 0..BURST {
+                client.send(request.as_bytes());
+                client.receive(1);
+            }
+        })
+    });
+
+    let mut client = Client::connect(addr);
+    group.bench_function("pipelined", |b| {
+        b.iter(|| {
+            client.send(burst.as_bytes());
+            client.receive(BURST);
+        })
+    });
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_pipelining);
+criterion_main!(benches);
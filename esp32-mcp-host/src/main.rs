@@ -0,0 +1,155 @@
+use clap::Parser;
+use embedded_io_adapters::tokio_1::FromTokio;
+use esp32_c6_mcp_rs::buffers::{
+    MCP_FRAME_BUFFER_SIZE, MCP_JSON_BUFFER_SIZE, MCP_RESULT_BUFFER_SIZE,
+};
+use esp32_c6_mcp_rs::hal::{set_led_sink, set_wifi_source, LedSink, WifiStatusSource};
+use esp32_c6_mcp_rs::mcp::LedCommand;
+use esp32_c6_mcp_rs::server::handle_mcp_connection;
+use esp32_c6_mcp_rs::telemetry::WifiSnapshot;
+use esp32_c6_mcp_rs::trace::EVENTS;
+use tokio::io::BufStream;
+use tokio::net::{TcpListener, TcpStream};
+use tokio::time::Duration;
+use tracing::{debug, error, info, warn};
+
+#[derive(Parser, Debug)]
+#[command(name = "esp32-mcp-host")]
+#[command(about = "The ESP32-C6 MCP server core running on the host, for testing and profiling")]
+struct Args {
+    /// Address to listen on
+    #[arg(short, long, default_value = "0.0.0.0")]
+    bind: String,
+
+    /// MCP server port
+    #[arg(short, long, default_value = "3000")]
+    port: u16,
+
+    /// Enable verbose logging
+    #[arg(short, long)]
+    verbose: bool,
+
+    /// Close each connection this many milliseconds after it opens, to
+    /// exercise client reconnects
+    #[arg(long)]
+    drop_after_ms: Option<u64>,
+}
+
+/// Logs LED commands instead of driving a SmartLED.
+struct LoggingLed;
+
+impl LedSink for LoggingLed {
+    fn send(&self, command: LedCommand) -> Result<(), &'static str> {
+        debug!("LED command: {:?}", command);
+        Ok(())
+    }
+}
+
+/// Reports a fixed, always-connected network so wifi_status formats every
+/// field, as it does on a connected board.
+struct HostWifi;
+
+impl WifiStatusSource for HostWifi {
+    fn snapshot(&self) -> WifiSnapshot {
+        WifiSnapshot {
+            connected: true,
+            ipv4: Some([127, 0, 0, 1]),
+            rssi: Some(-50),
+            channel: Some(1),
+            bssid: Some([0x02, 0, 0, 0, 0, 0x01]),
+            ssid: heapless::String::try_from("host").unwrap_or_default(),
+            reconnects: 0,
+        }
+    }
+}
+
+static LED: &dyn LedSink = &LoggingLed;
+static WIFI: &dyn WifiStatusSource = &HostWifi;
+
+// Same cadence as the firmware's log drain task
+const LOG_DRAIN_INTERVAL_MS: u64 = 200;
+
+#[tokio::main(flavor = "current_thread")]
+async fn main() -> std::io::Result<()> {
+    let args = Args::parse();
+
+    // Initialize tracing; the MCP core logs through `log`, which is forwarded
+    let log_level = if args.verbose { "debug" } else { "info" };
+    tracing_subscriber::fmt()
+        .with_env_filter(format!("esp32_mcp_host={0},esp32_c6_mcp_rs={0}", log_level))
+        .with_writer(std::io::stderr)
+        .init();
+
+    set_led_sink(&LED);
+    set_wifi_source(&WIFI);
+
+    let drop_after = args.drop_after_ms.map(Duration::from_millis);
+    let listener = TcpListener::bind((args.bind.as_str(), args.port)).await?;
+    info!("MCP server listening on {}", listener.local_addr()?);
+
+    // The connection handler's futures aren't Send (embedded-io-async traits),
+    // so connections run as local tasks on one thread, like the firmware's
+    // single-core executor
+    let tasks = tokio::task::LocalSet::new();
+    tasks.spawn_local(drain_events());
+    tasks
+        .run_until(async move {
+            loop {
+                match listener.accept().await {
+                    Ok((stream, peer)) => {
+                        info!("MCP client connected: {}", peer);
+                        tokio::task::spawn_local(async move {
+                            let served = match drop_after {
+                                Some(after) => tokio::select! {
+                                    served = serve(stream) => served,
+                                    _ = tokio::time::sleep(after) => {
+                                        info!("Dropping MCP client {} on purpose", peer);
+                                        Ok(())
+                                    }
+                                },
+                                None => serve(stream).await,
+                            };
+                            match served {
+                                Ok(()) => info!("MCP client {} disconnected", peer),
+                                Err(e) => warn!("MCP connection error from {}: {:?}", peer, e),
+                            }
+                        });
+                    }
+                    Err(e) => {
+                        error!("Accept error: {}", e);
+                        tokio::time::sleep(Duration::from_millis(100)).await;
+                    }
+                }
+            }
+        })
+        .await
+}
+
+async fn serve(stream: TcpStream) -> std::io::Result<()> {
+    stream.set_nodelay(true)?;
+
+    // Buffer writes like the firmware's socket tx buffer; the connection
+    // handler flushes once per read
+    let mut socket = FromTokio::new(BufStream::new(stream));
+    let mut frame_buf = vec![0u8; MCP_FRAME_BUFFER_SIZE];
+    let mut json_buf = vec![0u8; MCP_JSON_BUFFER_SIZE];
+    let mut result_buf = vec![0u8; MCP_RESULT_BUFFER_SIZE];
+
+    handle_mcp_connection(&mut socket, &mut frame_buf, &mut json_buf, &mut result_buf).await
+}
+
+/// Print the MCP core's deferred event log, as the firmware's drain task does.
+async fn drain_events() {
+    let mut interval = tokio::time::interval(Duration::from_millis(LOG_DRAIN_INTERVAL_MS));
+    loop {
+        interval.tick().await;
+
+        while let Some(entry) = EVENTS.pop() {
+            debug!("{}", entry);
+        }
+        let dropped = EVENTS.take_dropped();
+        if dropped > 0 {
+            debug!("Event log full, dropped {} entries", dropped);
+        }
+    }
+}
@@ -0,0 +1,136 @@
+// The request path's allocation budget: none.
+//
+// Each request is parsed and handled exactly as the firmware does it
+// (`serde_json_core` for the envelope, then `handle_mcp_request`) under a
+// global allocator that counts what the calling thread allocates. Results go
+// into the caller's buffer or are static, so any allocation is a regression.
+//
+//     cargo test --test allocations
+
+use esp32_c6_mcp_rs::buffers::MCP_RESULT_BUFFER_SIZE;
+use esp32_c6_mcp_rs::hal::{set_led_sink, LedSink};
+use esp32_c6_mcp_rs::mcp::{handle_mcp_request, LedCommand, McpRequest};
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+
+struct CountingAllocator;
+
+thread_local! {
+    // Per thread, so the test harness's own threads don't count
+    static ALLOCATIONS: Cell<usize> = const { Cell::new(0) };
+}
+
+fn count() {
+    // Unavailable only while the thread is being torn down
+    let _ = ALLOCATIONS.try_with(|n| n.set(n.get() + 1));
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        count();
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        count();
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+/// Accepts LED commands so led_control reaches its result, not an error.
+struct NullLed;
+
+impl LedSink for NullLed {
+    fn send(&self, _command: LedCommand) -> Result<(), &'static str> {
+        Ok(())
+    }
+}
+
+static LED: &dyn LedSink = &NullLed;
+
+/// Allocations made parsing and handling `raw` once.
+fn allocations(raw: &str, out: &mut [u8]) -> usize {
+    let before = ALLOCATIONS.with(Cell::get);
+    let (request, _) =
+        serde_json_core::from_str::<McpRequest>(raw).expect("test request must parse");
+    let response = handle_mcp_request(&request, raw, out);
+    assert!(
+        response.result.is_some() || response.error.is_some(),
+        "no reply to {}",
+        raw
+    );
+    ALLOCATIONS.with(Cell::get) - before
+}
+
+fn tools_call(tool: &str, arguments: &str) -> String {
+    format!(
+        r#"{{"jsonrpc":"2.0","id":1,"method":"tools/call","params":{{"name":"{}","arguments":{}}}}}"#,
+        tool, arguments
+    )
+}
+
+/// Every method and tool, their error paths, and arguments that stress the
+/// scanner.
+fn requests() -> Vec<String> {
+    vec![
+        r#"{"jsonrpc":"2.0","id":1,"method":"initialize","params":{"protocolVersion":"2024-11-05","capabilities":{},"clientInfo":{"name":"warp","version":"1.0"}}}"#.to_string(),
+        r#"{"jsonrpc":"2.0","id":1,"method":"initialize","params":{"protocolVersion":"2024-11-05","capabilities":{"experimental":{"cborFraming":{}}},"clientInfo":{"name":"esp32-mcp-bridge","version":"0.1.0"}}}"#.to_string(),
+        r#"{"jsonrpc":"2.0","id":2,"method":"tools/list","params":{}}"#.to_string(),
+        r#"{"jsonrpc":"2.0","id":3,"method":"resources/list"}"#.to_string(),
+        tools_call("wifi_status", "{}"),
+        tools_call("wifi_status", r#"{"detailed":true}"#),
+        tools_call("led_control", r#"{"color":"green","brightness":50}"#),
+        tools_call("led_control", r#"{"r":12,"g":200,"b":77}"#),
+        tools_call("led_control", r#"{"color":"off"}"#),
+        tools_call("led_control", r#"{"color":"pink"}"#),
+        tools_call("led_control", r#"{"brightness":200}"#),
+        tools_call("compute_add", r#"{"a":2,"b":3.5}"#),
+        tools_call("compute_add", r#"{"a":2}"#),
+        tools_call("compute_multiply", r#"{"a":-1.25e3,"b":0.004}"#),
+        tools_call("compute_batch", r#"{"op":"dot","a":[1,2,3.5],"b":[4,5,6]}"#),
+        tools_call("compute_batch", r#"{"op":"scale","a":[1,-2,0.25],"factor":3}"#),
+        tools_call("compute_batch", r#"{"op":"mean","a":[]}"#),
+        tools_call("does_not_exist", r#"{"a":1}"#),
+        tools_call(
+            "compute_add",
+            &format!(r#"{{"a":1,"note":"{}","b":2}}"#, r#"\"\\é\n\ud83c\udf21"#.repeat(50)),
+        ),
+        tools_call(
+            "compute_add",
+            &format!(r#"{{"a":1,"b":2,"extra":{}0{}}}"#, "[".repeat(64), "]".repeat(64)),
+        ),
+        r#"{"params":{"arguments":{"b":3.5,"a":2},"name":"compute_add"},"method":"tools/call","id":1,"jsonrpc":"2.0"}"#.to_string(),
+    ]
+}
+
+#[test]
+fn requests_do_not_allocate() {
+    set_led_sink(&LED);
+    let mut out = [0u8; MCP_RESULT_BUFFER_SIZE];
+    let requests = requests();
+
+    // Once first, for anything initialized on first use
+    for raw in &requests {
+        allocations(raw, &mut out);
+    }
+
+    let allocating: Vec<String> = requests
+        .iter()
+        .filter_map(|raw| match allocations(raw, &mut out) {
+            0 => None,
+            n => Some(format!("{} allocation(s): {}", n, raw)),
+        })
+        .collect();
+    assert!(
+        allocating.is_empty(),
+        "requests allocated:\n{}",
+        allocating.join("\n")
+    );
+}